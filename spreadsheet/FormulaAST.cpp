@@ -1,15 +1,27 @@
 
 #include "FormulaAST.h"
 
+#ifdef SPREADSHEET_WITH_ANTLR
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
+#endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 namespace ASTImpl
 {
@@ -77,7 +89,17 @@ namespace ASTImpl
         virtual ~Expr() = default;
         virtual void Print(std::ostream& out) const = 0;
         virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-        virtual double Evaluate(const std::function<double(Position)>& args) const = 0; 
+        // range_values — буфер для значений диапазонов, общий на всё
+        // вычисление формулы.
+        virtual double Evaluate(const CellValueGetter& args, const RangeValuesGetter& ranges,
+                                std::vector<double>& range_values) const = 0;
+        virtual void Compile(Program& program) const = 0;
+
+        // Диапазон, если узел — аргумент функции вида A1:B2.
+        virtual const Range* GetRange() const
+        {
+            return nullptr;
+        }
 
         virtual ExprPrecedence GetPrecedence() const = 0;
 
@@ -115,10 +137,10 @@ namespace ASTImpl
             };
 
         public:
-            explicit BinaryOpExpr(Type type, std::unique_ptr<Expr> lhs, std::unique_ptr<Expr> rhs)
+            explicit BinaryOpExpr(Type type, const Expr* lhs, const Expr* rhs)
                 : type_(type)
-                , lhs_(std::move(lhs))
-                , rhs_(std::move(rhs))
+                , lhs_(lhs)
+                , rhs_(rhs)
             {}
 
             void Print(std::ostream& out) const override
@@ -155,40 +177,63 @@ namespace ASTImpl
                 }
             }
 
-            double Evaluate(const std::function<double(Position)>& func) const override
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
             {
-                // Скопируйте ваше решение из предыдущих уроков.
+                double lhs = lhs_->Evaluate(func, ranges, range_values);
+                if (IsErrorValue(lhs))
+                {
+                    return lhs;
+                }
+                double rhs = rhs_->Evaluate(func, ranges, range_values);
+                if (IsErrorValue(rhs))
+                {
+                    return rhs;
+                }
                 switch (type_)
                 {
                 case Type::Add:
-                    return (lhs_.get()->Evaluate(func) + rhs_.get()->Evaluate(func));
-                    break;
+                    return lhs + rhs;
                 case Type::Subtract:
-                    return (lhs_.get()->Evaluate(func) - rhs_.get()->Evaluate(func));
-                    break;
+                    return lhs - rhs;
                 case Type::Multiply:
-                    return (lhs_.get()->Evaluate(func) * rhs_.get()->Evaluate(func));
-                    break;
+                    return lhs * rhs;
                 case Type::Divide:
-                    if (std::isfinite(lhs_.get()->Evaluate(func) / rhs_.get()->Evaluate(func)))
-                    {
-                        return (lhs_.get()->Evaluate(func) / rhs_.get()->Evaluate(func));
-                    }
-                    else
+                    if (std::isfinite(lhs / rhs))
                     {
-                        throw FormulaError(FormulaError::Category::Arithmetic);
+                        return lhs / rhs;
                     }
-                    break;
+                    return MakeErrorValue(FormulaError::Category::Arithmetic);
                 default:
-                    throw FormulaError(FormulaError::Category::Value);
+                    return MakeErrorValue(FormulaError::Category::Value);
+                }
+            }
+
+            void Compile(Program& program) const override
+            {
+                lhs_->Compile(program);
+                rhs_->Compile(program);
+                switch (type_)
+                {
+                case Type::Add:
+                    program.Apply(Program::OpCode::Add);
+                    break;
+                case Type::Subtract:
+                    program.Apply(Program::OpCode::Subtract);
+                    break;
+                case Type::Multiply:
+                    program.Apply(Program::OpCode::Multiply);
+                    break;
+                case Type::Divide:
+                    program.Apply(Program::OpCode::Divide);
                     break;
                 }
             }
 
         private:
             Type type_;
-            std::unique_ptr<Expr> lhs_;
-            std::unique_ptr<Expr> rhs_;
+            const Expr* lhs_;
+            const Expr* rhs_;
         };
 
         class UnaryOpExpr final : public Expr
@@ -201,9 +246,9 @@ namespace ASTImpl
             };
 
         public:
-            explicit UnaryOpExpr(Type type, std::unique_ptr<Expr> operand)
+            explicit UnaryOpExpr(Type type, const Expr* operand)
                 : type_(type)
-                , operand_(std::move(operand))
+                , operand_(operand)
             {}
 
             void Print(std::ostream& out) const override
@@ -224,41 +269,52 @@ namespace ASTImpl
                 return EP_UNARY;
             }
 
-            double Evaluate(const std::function<double(Position)>& func) const override
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
             {
                 // Скопируйте ваше решение из предыдущих уроков.
+                double value = operand_->Evaluate(func, ranges, range_values);
+                // Смена знака стёрла бы признак ошибки в NaN.
+                if (IsErrorValue(value))
+                {
+                    return value;
+                }
                 switch (type_)
                 {
                 case Type::UnaryMinus:
-                    return (-1.0) * operand_->Evaluate(func);
-                    break;
+                    return -value;
                 default:
-                    return operand_->Evaluate(func);
-                    break;
+                    return value;
                 }
             }
 
+            void Compile(Program& program) const override
+            {
+                operand_->Compile(program);
+                program.Apply(type_ == Type::UnaryMinus ? Program::OpCode::Negate : Program::OpCode::UnaryPlus);
+            }
+
         private:
             Type type_;
-            std::unique_ptr<Expr> operand_;
+            const Expr* operand_;
         };
 
         class CellExpr final : public Expr
         {
         public:
-            explicit CellExpr(const Position* cell)
+            explicit CellExpr(Position cell)
                 : cell_(cell)
             {}
 
             void Print(std::ostream& out) const override
             {
-                if (!cell_->IsValid())
+                if (!cell_.IsValid())
                 {
                     out << FormulaError::Category::Ref;
                 }
                 else
                 {
-                    out << cell_->ToString();
+                    out << cell_.ToString();
                 }
             }
 
@@ -272,17 +328,23 @@ namespace ASTImpl
                 return EP_ATOM;
             }
 
-            double Evaluate(const std::function<double(Position)>& func) const override
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
             {
-                if (!cell_->IsValid())
+                if (!cell_.IsValid())
                 {
-                    throw FormulaError(FormulaError::Category::Ref);
+                    return MakeErrorValue(FormulaError::Category::Ref);
                 }
-                return func(*cell_);
+                return func(cell_);
+            }
+
+            void Compile(Program& program) const override
+            {
+                program.LoadCell(cell_);
             }
 
         private:
-            const Position* cell_;
+            Position cell_;
         };
 
         class NumberExpr final : public Expr
@@ -307,30 +369,794 @@ namespace ASTImpl
                 return EP_ATOM;
             }
 
-            double Evaluate(const std::function<double(Position)>& func) const override
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
             {
                 return value_;
             }
 
+            void Compile(Program& program) const override
+            {
+                program.PushNumber(value_);
+            }
+
         private:
             double value_;
         };
 
+        // Свёртки массивов чисел для агрегатных функций. Несколько независимых
+        // частичных результатов позволяют компилятору векторизовать циклы, не
+        // меняя порядок сложений внутри каждого из них.
+        constexpr std::size_t KERNEL_LANES = 4;
+
+        double SumKernel(const double* values, std::size_t count)
+        {
+            double partial[KERNEL_LANES] = {};
+            std::size_t i = 0;
+            for (; i + KERNEL_LANES <= count; i += KERNEL_LANES)
+            {
+                for (std::size_t lane = 0; lane < KERNEL_LANES; ++lane)
+                {
+                    partial[lane] += values[i + lane];
+                }
+            }
+            double sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+            for (; i < count; ++i)
+            {
+                sum += values[i];
+            }
+            return sum;
+        }
+
+        template <typename Select>
+        double SelectKernel(const double* values, std::size_t count, double initial, Select select)
+        {
+            double partial[KERNEL_LANES] = { initial, initial, initial, initial };
+            std::size_t i = 0;
+            for (; i + KERNEL_LANES <= count; i += KERNEL_LANES)
+            {
+                for (std::size_t lane = 0; lane < KERNEL_LANES; ++lane)
+                {
+                    partial[lane] = select(partial[lane], values[i + lane]);
+                }
+            }
+            double result = select(select(partial[0], partial[1]), select(partial[2], partial[3]));
+            for (; i < count; ++i)
+            {
+                result = select(result, values[i]);
+            }
+            return result;
+        }
+
+        double MinKernel(const double* values, std::size_t count)
+        {
+            return SelectKernel(values, count, std::numeric_limits<double>::infinity(),
+                [](double lhs, double rhs) { return rhs < lhs ? rhs : lhs; });
+        }
+
+        double MaxKernel(const double* values, std::size_t count)
+        {
+            return SelectKernel(values, count, -std::numeric_limits<double>::infinity(),
+                [](double lhs, double rhs) { return rhs > lhs ? rhs : lhs; });
+        }
+
+        // Промежуточный результат агрегатной функции. Тривиальный, чтобы стек
+        // накопителей интерпретатора не требовал инициализации.
+        struct Accumulator
+        {
+            Program::OpCode function;
+            double value;
+            std::size_t count;
+
+            static Accumulator Start(Program::OpCode function)
+            {
+                switch (function)
+                {
+                case Program::OpCode::Min:
+                    return { function, std::numeric_limits<double>::infinity(), 0 };
+                case Program::OpCode::Max:
+                    return { function, -std::numeric_limits<double>::infinity(), 0 };
+                default:
+                    return { function, 0.0, 0 };
+                }
+            }
+
+            void Add(double number)
+            {
+                Add(&number, 1);
+            }
+
+            void Add(const double* numbers, std::size_t size)
+            {
+                switch (function)
+                {
+                case Program::OpCode::Sum:
+                case Program::OpCode::Average:
+                    value += SumKernel(numbers, size);
+                    break;
+                case Program::OpCode::Min:
+                    value = std::min(value, MinKernel(numbers, size));
+                    break;
+                case Program::OpCode::Max:
+                    value = std::max(value, MaxKernel(numbers, size));
+                    break;
+                default:
+                    break;
+                }
+                count += size;
+            }
+
+            // Функции от пустого набора чисел дают ноль, кроме AVERAGE: она
+            // даёт ошибку #ARITHM!.
+            double Finish() const
+            {
+                switch (function)
+                {
+                case Program::OpCode::Average:
+                    if (count == 0)
+                    {
+                        return MakeErrorValue(FormulaError::Category::Arithmetic);
+                    }
+                    return value / static_cast<double>(count);
+                case Program::OpCode::Min:
+                case Program::OpCode::Max:
+                    return count > 0 ? value : 0.0;
+                case Program::OpCode::Count:
+                    return static_cast<double>(count);
+                default:
+                    return value;
+                }
+            }
+        };
+
+        constexpr std::pair<Program::OpCode, std::string_view> FUNCTION_NAMES[] = {
+            { Program::OpCode::Sum, "SUM" },
+            { Program::OpCode::Min, "MIN" },
+            { Program::OpCode::Max, "MAX" },
+            { Program::OpCode::Average, "AVERAGE" },
+            { Program::OpCode::Count, "COUNT" },
+        };
+
+        std::string_view GetFunctionName(Program::OpCode function)
+        {
+            for (const auto& [code, name] : FUNCTION_NAMES)
+            {
+                if (code == function)
+                {
+                    return name;
+                }
+            }
+            assert(false);
+            return {};
+        }
+
+        std::optional<Program::OpCode> FindFunction(std::string_view name)
+        {
+            for (const auto& [code, function_name] : FUNCTION_NAMES)
+            {
+                if (function_name == name)
+                {
+                    return code;
+                }
+            }
+            return std::nullopt;
+        }
+
+        // Диапазон встречается только среди аргументов функции: сам по себе он
+        // не имеет значения.
+        class RangeExpr final : public Expr
+        {
+        public:
+            explicit RangeExpr(Range range)
+                : range_(range)
+            {}
+
+            void Print(std::ostream& out) const override
+            {
+                out << range_.ToString();
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
+            {
+                Print(out);
+            }
+
+            ExprPrecedence GetPrecedence() const override
+            {
+                return EP_ATOM;
+            }
+
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
+            {
+                return MakeErrorValue(FormulaError::Category::Value);
+            }
+
+            void Compile(Program& program) const override
+            {
+                program.LoadRange(range_);
+            }
+
+            const Range* GetRange() const override
+            {
+                return &range_;
+            }
+
+        private:
+            Range range_;
+        };
+
+        class FunctionExpr final : public Expr
+        {
+        public:
+            FunctionExpr(Program::OpCode function, const Expr* const* args, std::size_t args_count)
+                : function_(function)
+                , args_(args)
+                , args_count_(args_count)
+            {}
+
+            void Print(std::ostream& out) const override
+            {
+                out << '(' << GetFunctionName(function_);
+                for (std::size_t i = 0; i < args_count_; ++i)
+                {
+                    out << ' ';
+                    args_[i]->Print(out);
+                }
+                out << ')';
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override
+            {
+                out << GetFunctionName(function_) << '(';
+                for (std::size_t i = 0; i < args_count_; ++i)
+                {
+                    if (i > 0)
+                    {
+                        out << ',';
+                    }
+                    args_[i]->PrintFormula(out, EP_ATOM);
+                }
+                out << ')';
+            }
+
+            ExprPrecedence GetPrecedence() const override
+            {
+                return EP_ATOM;
+            }
+
+            double Evaluate(const CellValueGetter& func, const RangeValuesGetter& ranges,
+                            std::vector<double>& range_values) const override
+            {
+                // Значения диапазона складываются в накопитель до вычисления
+                // следующего аргумента, поэтому вложенные функции могут
+                // пользоваться тем же буфером.
+                auto accumulator = Accumulator::Start(function_);
+                for (std::size_t i = 0; i < args_count_; ++i)
+                {
+                    if (const Range* range = args_[i]->GetRange())
+                    {
+                        range_values.clear();
+                        ranges(*range, range_values);
+                        if (!range_values.empty() && IsErrorValue(range_values.back()))
+                        {
+                            return range_values.back();
+                        }
+                        accumulator.Add(range_values.data(), range_values.size());
+                    }
+                    else
+                    {
+                        double value = args_[i]->Evaluate(func, ranges, range_values);
+                        if (IsErrorValue(value))
+                        {
+                            return value;
+                        }
+                        accumulator.Add(value);
+                    }
+                }
+                return accumulator.Finish();
+            }
+
+            void Compile(Program& program) const override
+            {
+                program.Apply(Program::OpCode::AggregateBegin, static_cast<std::uint32_t>(function_));
+                for (std::size_t i = 0; i < args_count_; ++i)
+                {
+                    args_[i]->Compile(program);
+                    if (!args_[i]->GetRange())
+                    {
+                        program.Apply(Program::OpCode::AggregateValue);
+                    }
+                }
+                program.Apply(function_);
+            }
+
+        private:
+            Program::OpCode function_;
+            const Expr* const* args_;
+            std::size_t args_count_;
+        };
+
+        // Переводит литерал в число так же, как operator>> у istringstream:
+        // переполнение считается ошибкой, а слишком маленькие по модулю числа
+        // округляются.
+        double ParseNumber(std::string_view text)
+        {
+            double value = 0;
+            const char* end = text.data() + text.size();
+            auto result = std::from_chars(text.data(), end, value);
+            if (result.ec == std::errc::result_out_of_range)
+            {
+                value = std::strtod(std::string(text).c_str(), nullptr);
+                if (std::isinf(value))
+                {
+                    throw ParsingError("Invalid number: " + std::string(text));
+                }
+            }
+            else if (result.ec != std::errc() || result.ptr != end)
+            {
+                throw ParsingError("Invalid number: " + std::string(text));
+            }
+            return value;
+        }
+
+        // Число узлов формулы каждого вида; по нему оценивается объём арены.
+        struct NodeCounts
+        {
+            std::size_t numbers = 0;
+            std::size_t cells = 0;
+            std::size_t operators = 0;
+            std::size_t functions = 0;
+            std::size_t ranges = 0;
+            std::size_t args = 0;
+        };
+
+        // Объём арены для формулы с заданным числом узлов: сами узлы, байт-код,
+        // списки ячеек и диапазонов и массивы аргументов функций.
+        std::size_t GetArenaSize(const NodeCounts& counts)
+        {
+            constexpr std::size_t INSTRUCTION_SIZE = sizeof(Program::Instruction);
+            constexpr std::size_t NUMBER_SIZE = sizeof(NumberExpr) + sizeof(double) + INSTRUCTION_SIZE;
+            constexpr std::size_t CELL_SIZE =
+                sizeof(CellExpr) + 2 * sizeof(Position) + sizeof(std::uint32_t) + INSTRUCTION_SIZE;
+            constexpr std::size_t OPERATOR_SIZE =
+                std::max(sizeof(BinaryOpExpr), sizeof(UnaryOpExpr)) + INSTRUCTION_SIZE;
+            // Инструкции AggregateBegin и самой функции и выравнивание массива
+            // аргументов.
+            constexpr std::size_t FUNCTION_SIZE = sizeof(FunctionExpr) + 2 * INSTRUCTION_SIZE + alignof(const Expr*);
+            constexpr std::size_t RANGE_SIZE = sizeof(RangeExpr) + 2 * sizeof(Range) + INSTRUCTION_SIZE;
+            // Указатель в массиве аргументов и, возможно, AggregateValue.
+            constexpr std::size_t ARG_SIZE = sizeof(const Expr*) + INSTRUCTION_SIZE;
+            // Выравнивание массивов байт-кода, списков ячеек и диапазонов и
+            // номеров ячеек.
+            return 7 * alignof(double) + counts.numbers * NUMBER_SIZE + counts.cells * CELL_SIZE
+                + counts.operators * OPERATOR_SIZE + counts.functions * FUNCTION_SIZE
+                + counts.ranges * RANGE_SIZE + counts.args * ARG_SIZE;
+        }
+
+        // Лексер формул без ANTLR: выделяет лексемы Formula.g4 как подстроки
+        // исходной строки, ничего не копируя.
+        class NativeLexer
+        {
+        public:
+            enum class TokenType
+            {
+                Number,
+                Cell,
+                Add,
+                Sub,
+                Mul,
+                Div,
+                LeftParen,
+                RightParen,
+                Colon,
+                Comma,
+                // Буквы без цифр: имя функции.
+                Name,
+                End,
+            };
+
+            struct Token
+            {
+                TokenType type = TokenType::End;
+                std::string_view text;
+            };
+
+            explicit NativeLexer(std::string_view text)
+                : text_(text)
+            {
+                Advance();
+            }
+
+            const Token& Get() const
+            {
+                return token_;
+            }
+
+            void Advance()
+            {
+                while (pos_ < text_.size()
+                    && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r'))
+                {
+                    ++pos_;
+                }
+                if (pos_ == text_.size())
+                {
+                    token_ = { TokenType::End, "<EOF>" };
+                    return;
+                }
+
+                std::size_t end = pos_ + 1;
+                TokenType type;
+                switch (text_[pos_])
+                {
+                case '+':
+                    type = TokenType::Add;
+                    break;
+                case '-':
+                    type = TokenType::Sub;
+                    break;
+                case '*':
+                    type = TokenType::Mul;
+                    break;
+                case '/':
+                    type = TokenType::Div;
+                    break;
+                case '(':
+                    type = TokenType::LeftParen;
+                    break;
+                case ')':
+                    type = TokenType::RightParen;
+                    break;
+                case ':':
+                    type = TokenType::Colon;
+                    break;
+                case ',':
+                    type = TokenType::Comma;
+                    break;
+                default:
+                    if (IsDigit(text_[pos_]) || text_[pos_] == '.')
+                    {
+                        type = TokenType::Number;
+                        end = LexNumber(pos_);
+                    }
+                    else if (IsUpper(text_[pos_]))
+                    {
+                        end = LexCellOrName(pos_, type);
+                    }
+                    else
+                    {
+                        FailLexing(pos_);
+                    }
+                }
+                token_ = { type, text_.substr(pos_, end - pos_) };
+                pos_ = end;
+            }
+
+            [[noreturn]] void Fail() const
+            {
+                throw ParsingError("Error when parsing: " + std::string(token_.text));
+            }
+
+        private:
+            static bool IsDigit(char c)
+            {
+                return c >= '0' && c <= '9';
+            }
+
+            static bool IsUpper(char c)
+            {
+                return c >= 'A' && c <= 'Z';
+            }
+
+            std::size_t SkipDigits(std::size_t pos) const
+            {
+                while (pos < text_.size() && IsDigit(text_[pos]))
+                {
+                    ++pos;
+                }
+                return pos;
+            }
+
+            [[noreturn]] void FailLexing(std::size_t pos) const
+            {
+                throw ParsingError("Error when lexing: " + std::string(text_.substr(pos, 1)));
+            }
+
+            // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+            std::size_t LexNumber(std::size_t pos) const
+            {
+                std::size_t end = SkipDigits(pos);
+                if (end + 1 < text_.size() && text_[end] == '.' && IsDigit(text_[end + 1]))
+                {
+                    end = SkipDigits(end + 1);
+                }
+                else if (end == pos)
+                {
+                    FailLexing(pos);
+                }
+
+                if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E'))
+                {
+                    std::size_t exponent = end + 1;
+                    if (exponent < text_.size() && (text_[exponent] == '+' || text_[exponent] == '-'))
+                    {
+                        ++exponent;
+                    }
+                    if (exponent < text_.size() && IsDigit(text_[exponent]))
+                    {
+                        end = SkipDigits(exponent);
+                    }
+                }
+                return end;
+            }
+
+            // CELL: [A-Z]+[0-9]+ или FUNCTION: [A-Z]+
+            std::size_t LexCellOrName(std::size_t pos, TokenType& type) const
+            {
+                std::size_t letters_end = pos;
+                while (letters_end < text_.size() && IsUpper(text_[letters_end]))
+                {
+                    ++letters_end;
+                }
+                std::size_t end = SkipDigits(letters_end);
+                type = end == letters_end ? TokenType::Name : TokenType::Cell;
+                return end;
+            }
+
+            std::string_view text_;
+            std::size_t pos_ = 0;
+            Token token_;
+        };
+
+        // Разбор формулы без ANTLR подъёмом по приоритетам сразу в AST.
+        // Принимает в точности язык грамматики Formula.g4: унарные операции
+        // связывают сильнее бинарных, бинарные левоассоциативны.
+        //
+        // Узлы размещаются в арене формулы. Её размер заранее оценивается по
+        // лексемам так, чтобы в один блок уместились и дерево, и байт-код.
+        class NativeParser
+        {
+        public:
+            explicit NativeParser(std::string_view text)
+                : NativeParser(text, CountNodes(text))
+            {}
+
+            const Expr* ParseMain()
+            {
+                auto root = ParseExpr(PREC_ADD);
+                if (lexer_.Get().type != TokenType::End)
+                {
+                    lexer_.Fail();
+                }
+                return root;
+            }
+
+            Arena MoveArena()
+            {
+                return std::move(arena_);
+            }
+
+        private:
+            using TokenType = NativeLexer::TokenType;
+
+            enum BinaryPrecedence
+            {
+                PREC_NONE,
+                PREC_ADD,
+                PREC_MUL,
+            };
+
+            // Стек аргументов разбираемых функций размещается в той же арене.
+            // Каждый аргумент начинается после имени функции или запятой,
+            // поэтому их не больше counts.args.
+            NativeParser(std::string_view text, const NodeCounts& counts)
+                : arena_(GetArenaSize(counts) + counts.args * sizeof(const Expr*))
+                , lexer_(text)
+                , arg_stack_(arena_.NewArray<const Expr*>(counts.args))
+                , arg_stack_capacity_(counts.args)
+            {}
+
+            static NodeCounts CountNodes(std::string_view text)
+            {
+                NodeCounts counts;
+                for (NativeLexer lexer(text); lexer.Get().type != TokenType::End; lexer.Advance())
+                {
+                    switch (lexer.Get().type)
+                    {
+                    case TokenType::Number:
+                        ++counts.numbers;
+                        break;
+                    case TokenType::Cell:
+                        ++counts.cells;
+                        break;
+                    case TokenType::Name:
+                        ++counts.functions;
+                        ++counts.args;
+                        break;
+                    case TokenType::Colon:
+                        ++counts.ranges;
+                        break;
+                    case TokenType::Comma:
+                        ++counts.args;
+                        break;
+                    case TokenType::LeftParen:
+                    case TokenType::RightParen:
+                        break;
+                    default:
+                        ++counts.operators;
+                        break;
+                    }
+                }
+                return counts;
+            }
+
+            BinaryPrecedence GetBinaryPrecedence() const
+            {
+                switch (lexer_.Get().type)
+                {
+                case TokenType::Add:
+                case TokenType::Sub:
+                    return PREC_ADD;
+                case TokenType::Mul:
+                case TokenType::Div:
+                    return PREC_MUL;
+                default:
+                    return PREC_NONE;
+                }
+            }
+
+            const Expr* ParseExpr(BinaryPrecedence min_precedence)
+            {
+                const Expr* lhs = ParseUnary();
+                for (BinaryPrecedence precedence = GetBinaryPrecedence();
+                    precedence != PREC_NONE && precedence >= min_precedence;
+                    precedence = GetBinaryPrecedence())
+                {
+                    auto type = static_cast<BinaryOpExpr::Type>(lexer_.Get().text.front());
+                    lexer_.Advance();
+                    const Expr* rhs = ParseExpr(static_cast<BinaryPrecedence>(precedence + 1));
+                    lhs = arena_.New<BinaryOpExpr>(type, lhs, rhs);
+                }
+                return lhs;
+            }
+
+            const Expr* ParseUnary()
+            {
+                const auto& token = lexer_.Get();
+                switch (token.type)
+                {
+                case TokenType::Add:
+                case TokenType::Sub:
+                {
+                    auto type = static_cast<UnaryOpExpr::Type>(token.text.front());
+                    lexer_.Advance();
+                    return arena_.New<UnaryOpExpr>(type, ParseUnary());
+                }
+                case TokenType::LeftParen:
+                {
+                    lexer_.Advance();
+                    auto expr = ParseExpr(PREC_ADD);
+                    if (lexer_.Get().type != TokenType::RightParen)
+                    {
+                        lexer_.Fail();
+                    }
+                    lexer_.Advance();
+                    return expr;
+                }
+                case TokenType::Number:
+                {
+                    auto node = arena_.New<NumberExpr>(ParseNumber(token.text));
+                    lexer_.Advance();
+                    return node;
+                }
+                case TokenType::Cell:
+                {
+                    auto value = ParsePosition(token.text);
+                    lexer_.Advance();
+                    return arena_.New<CellExpr>(value);
+                }
+                case TokenType::Name:
+                    return ParseFunction();
+                default:
+                    lexer_.Fail();
+                }
+            }
+
+            // FUNCTION '(' arg (',' arg)* ')'
+            const Expr* ParseFunction()
+            {
+                auto function = FindFunction(lexer_.Get().text);
+                if (!function)
+                {
+                    lexer_.Fail();
+                }
+                lexer_.Advance();
+                if (lexer_.Get().type != TokenType::LeftParen)
+                {
+                    lexer_.Fail();
+                }
+
+                // Вложенные функции кладут аргументы выше и снимают их до
+                // возврата, так что аргументы этой лежат подряд от base.
+                std::size_t base = arg_stack_size_;
+                do
+                {
+                    lexer_.Advance();
+                    const Expr* arg = ParseArgument();
+                    assert(arg_stack_size_ < arg_stack_capacity_);
+                    arg_stack_[arg_stack_size_++] = arg;
+                } while (lexer_.Get().type == TokenType::Comma);
+                if (lexer_.Get().type != TokenType::RightParen)
+                {
+                    lexer_.Fail();
+                }
+                lexer_.Advance();
+
+                std::size_t args_count = arg_stack_size_ - base;
+                auto args_array = arena_.NewArray<const Expr*>(args_count);
+                std::copy(arg_stack_ + base, arg_stack_ + arg_stack_size_, args_array);
+                arg_stack_size_ = base;
+                return arena_.New<FunctionExpr>(*function, args_array, args_count);
+            }
+
+            // arg: CELL ':' CELL | expr
+            const Expr* ParseArgument()
+            {
+                if (lexer_.Get().type == TokenType::Cell)
+                {
+                    NativeLexer next = lexer_;
+                    next.Advance();
+                    if (next.Get().type == TokenType::Colon)
+                    {
+                        Position from = ParsePosition(lexer_.Get().text);
+                        next.Advance();
+                        if (next.Get().type != TokenType::Cell)
+                        {
+                            next.Fail();
+                        }
+                        Position to = ParsePosition(next.Get().text);
+                        next.Advance();
+                        lexer_ = next;
+                        return arena_.New<RangeExpr>(Range::FromCorners(from, to));
+                    }
+                }
+                return ParseExpr(PREC_ADD);
+            }
+
+            static Position ParsePosition(std::string_view text)
+            {
+                auto pos = Position::FromString(text);
+                if (!pos.IsValid())
+                {
+                    throw FormulaException("Invalid position: " + std::string(text));
+                }
+                return pos;
+            }
+
+            Arena arena_;
+            NativeLexer lexer_;
+            const Expr** arg_stack_;
+            std::size_t arg_stack_capacity_;
+            std::size_t arg_stack_size_ = 0;
+        };
+
+#ifdef SPREADSHEET_WITH_ANTLR
         class ParseASTListener final : public FormulaBaseListener
         {
         public:
-            std::unique_ptr<Expr> MoveRoot()
+            const Expr* MoveRoot()
             {
                 assert(args_.size() == 1);
-                auto root = std::move(args_.front());
+                auto root = args_.front();
                 args_.clear();
 
                 return root;
             }
 
-            std::forward_list<Position> MoveCells()
+            Arena MoveArena()
             {
-                return std::move(cells_);
+                return std::move(arena_);
             }
 
         public:
@@ -338,7 +1164,7 @@ namespace ASTImpl
             {
                 assert(args_.size() >= 1);
 
-                auto operand = std::move(args_.back());
+                auto operand = args_.back();
 
                 UnaryOpExpr::Type type;
                 if (ctx->SUB())
@@ -351,8 +1177,7 @@ namespace ASTImpl
                     type = UnaryOpExpr::UnaryPlus;
                 }
 
-                auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-                args_.back() = std::move(node);
+                args_.back() = arena_.New<UnaryOpExpr>(type, operand);
             }
 
             void exitLiteral(FormulaParser::LiteralContext* ctx) override
@@ -366,8 +1191,7 @@ namespace ASTImpl
                     throw ParsingError("Invalid number: " + valueStr);
                 }
 
-                auto node = std::make_unique<NumberExpr>(value);
-                args_.push_back(std::move(node));
+                args_.push_back(arena_.New<NumberExpr>(value));
             }
 
             void exitCell(FormulaParser::CellContext* ctx) override
@@ -379,19 +1203,17 @@ namespace ASTImpl
                     throw FormulaException("Invalid position: " + value_str);
                 }
 
-                cells_.push_front(value);
-                auto node = std::make_unique<CellExpr>(&cells_.front());
-                args_.push_back(std::move(node));
+                args_.push_back(arena_.New<CellExpr>(value));
             }
 
             void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override
             {
                 assert(args_.size() >= 2);
 
-                auto rhs = std::move(args_.back());
+                auto rhs = args_.back();
                 args_.pop_back();
 
-                auto lhs = std::move(args_.back());
+                auto lhs = args_.back();
 
                 BinaryOpExpr::Type type;
                 if (ctx->ADD())
@@ -412,8 +1234,35 @@ namespace ASTImpl
                     type = BinaryOpExpr::Divide;
                 }
 
-                auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
-                args_.back() = std::move(node);
+                args_.back() = arena_.New<BinaryOpExpr>(type, lhs, rhs);
+            }
+
+            void exitRange(FormulaParser::RangeContext* ctx) override
+            {
+                auto from_str = ctx->CELL(0)->getSymbol()->getText();
+                auto to_str = ctx->CELL(1)->getSymbol()->getText();
+                auto from = Position::FromString(from_str);
+                auto to = Position::FromString(to_str);
+                if (!from.IsValid() || !to.IsValid())
+                {
+                    throw FormulaException("Invalid position: " + (from.IsValid() ? to_str : from_str));
+                }
+
+                args_.push_back(arena_.New<RangeExpr>(Range::FromCorners(from, to)));
+            }
+
+            void exitFunction(FormulaParser::FunctionContext* ctx) override
+            {
+                std::size_t args_count = ctx->arg().size();
+                assert(args_.size() >= args_count);
+
+                auto function = FindFunction(ctx->FUNCTION()->getSymbol()->getText());
+                assert(function.has_value());
+
+                auto args = arena_.NewArray<const Expr*>(args_count);
+                std::copy(args_.end() - args_count, args_.end(), args);
+                args_.resize(args_.size() - args_count);
+                args_.push_back(arena_.New<FunctionExpr>(*function, args, args_count));
             }
 
             void visitErrorNode(antlr4::tree::ErrorNode* node) override
@@ -422,8 +1271,8 @@ namespace ASTImpl
             }
 
         private:
-            std::vector<std::unique_ptr<Expr>> args_;
-            std::forward_list<Position> cells_;
+            std::vector<const Expr*> args_;
+            Arena arena_;
         };
 
         class BailErrorListener : public antlr4::BaseErrorListener
@@ -437,39 +1286,268 @@ namespace ASTImpl
                 throw ParsingError("Error when lexing: " + msg);
             }
         };
+#endif
+
+        std::atomic<FormulaParserBackend> default_backend =
+#if defined(SPREADSHEET_WITH_ANTLR) && !defined(SPREADSHEET_NATIVE_FORMULA_PARSER)
+            FormulaParserBackend::Antlr;
+#else
+            FormulaParserBackend::Native;
+#endif
 
     }  // namespace
 }  // namespace ASTImpl
 
-FormulaAST ParseFormulaAST(std::istream& in)
+bool IsFormulaParserBackendAvailable(FormulaParserBackend backend)
+{
+#ifdef SPREADSHEET_WITH_ANTLR
+    return true;
+#else
+    return backend == FormulaParserBackend::Native;
+#endif
+}
+
+void SetFormulaParserBackend(FormulaParserBackend backend)
+{
+    if (!IsFormulaParserBackendAvailable(backend))
+    {
+        throw std::invalid_argument("The ANTLR formula parser is not built in");
+    }
+    ASTImpl::default_backend.store(backend, std::memory_order_relaxed);
+}
+
+FormulaParserBackend GetFormulaParserBackend()
 {
-    using namespace antlr4;
+    return ASTImpl::default_backend.load(std::memory_order_relaxed);
+}
 
-    ANTLRInputStream input(in);
+namespace
+{
+    FormulaAST ParseFormulaASTNative(std::string_view in)
+    {
+        ASTImpl::NativeParser parser(in);
+        auto root = parser.ParseMain();
+        return FormulaAST(parser.MoveArena(), root);
+    }
 
-    FormulaLexer lexer(&input);
-    ASTImpl::BailErrorListener error_listener;
-    lexer.removeErrorListeners();
-    lexer.addErrorListener(&error_listener);
+#ifdef SPREADSHEET_WITH_ANTLR
+    FormulaAST ParseFormulaASTAntlr(std::istream& in)
+    {
+        using namespace antlr4;
 
-    CommonTokenStream tokens(&lexer);
+        ANTLRInputStream input(in);
+
+        FormulaLexer lexer(&input);
+        ASTImpl::BailErrorListener error_listener;
+        lexer.removeErrorListeners();
+        lexer.addErrorListener(&error_listener);
+
+        CommonTokenStream tokens(&lexer);
+
+        FormulaParser parser(&tokens);
+        auto error_handler = std::make_shared<BailErrorStrategy>();
+        parser.setErrorHandler(error_handler);
+        parser.removeErrorListeners();
+
+        tree::ParseTree* tree = parser.main();
+        ASTImpl::ParseASTListener listener;
+        tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+
+        auto root = listener.MoveRoot();
+        return FormulaAST(listener.MoveArena(), root);
+    }
+#endif
+}  // namespace
+
+FormulaAST ParseFormulaAST(std::string_view in, FormulaParserBackend backend)
+{
+    if (backend == FormulaParserBackend::Native)
+    {
+        return ParseFormulaASTNative(in);
+    }
+#ifdef SPREADSHEET_WITH_ANTLR
+    std::istringstream stream{ std::string(in) };
+    return ParseFormulaASTAntlr(stream);
+#else
+    throw std::invalid_argument("The ANTLR formula parser is not built in");
+#endif
+}
+
+FormulaAST BuildFormulaAST(const ASTImpl::Program::OpCode* code, std::size_t code_size,
+                           const double* numbers, std::size_t numbers_size,
+                           const Position* cells, std::size_t cells_size,
+                           const Range* ranges, std::size_t ranges_size)
+{
+    using namespace ASTImpl;
+    using OpCode = Program::OpCode;
+
+    NodeCounts counts;
+    for (const OpCode* op = code; op != code + code_size; ++op)
+    {
+        switch (*op)
+        {
+        case OpCode::PushNumber:
+            ++counts.numbers;
+            break;
+        case OpCode::LoadCell:
+            ++counts.cells;
+            break;
+        case OpCode::AggregateBegin:
+            ++counts.functions;
+            break;
+        case OpCode::AggregateValue:
+            ++counts.args;
+            break;
+        case OpCode::AggregateRange:
+            ++counts.ranges;
+            ++counts.args;
+            break;
+        case OpCode::Sum:
+        case OpCode::Min:
+        case OpCode::Max:
+        case OpCode::Average:
+        case OpCode::Count:
+            break;
+        default:
+            ++counts.operators;
+            break;
+        }
+    }
+    if (counts.numbers != numbers_size || counts.cells != cells_size || counts.ranges != ranges_size)
+    {
+        throw ParsingError("Invalid bytecode: operands do not match instructions");
+    }
 
-    FormulaParser parser(&tokens);
-    auto error_handler = std::make_shared<BailErrorStrategy>();
-    parser.setErrorHandler(error_handler);
-    parser.removeErrorListeners();
+    // Аргументы вызова функции лежат на стеке выше base; до инструкции
+    // функции их нельзя снимать операциями.
+    struct Frame
+    {
+        std::size_t base;
+        std::size_t args;
+    };
 
-    tree::ParseTree* tree = parser.main();
-    ASTImpl::ParseASTListener listener;
-    tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    Arena arena(GetArenaSize(counts));
+    std::vector<const Expr*> stack;
+    std::vector<Frame> frames;
+    std::size_t next_number = 0;
+    std::size_t next_cell = 0;
+    std::size_t next_range = 0;
+    auto pop = [&stack, &frames]()
+    {
+        std::size_t floor = frames.empty() ? 0 : frames.back().base + frames.back().args;
+        if (stack.size() <= floor)
+        {
+            throw ParsingError("Invalid bytecode: stack underflow");
+        }
+        auto expr = stack.back();
+        stack.pop_back();
+        return expr;
+    };
+    auto push_binary = [&](BinaryOpExpr::Type type)
+    {
+        auto rhs = pop();
+        auto lhs = pop();
+        stack.push_back(arena.New<BinaryOpExpr>(type, lhs, rhs));
+    };
+    auto push_function = [&](OpCode function)
+    {
+        if (frames.empty() || frames.back().args == 0
+            || stack.size() != frames.back().base + frames.back().args)
+        {
+            throw ParsingError("Invalid bytecode: malformed function call");
+        }
+        std::size_t args_count = frames.back().args;
+        frames.pop_back();
+        auto args = arena.NewArray<const Expr*>(args_count);
+        std::copy(stack.end() - args_count, stack.end(), args);
+        stack.resize(stack.size() - args_count);
+        stack.push_back(arena.New<FunctionExpr>(function, args, args_count));
+    };
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    for (const OpCode* op = code; op != code + code_size; ++op)
+    {
+        switch (*op)
+        {
+        case OpCode::PushNumber:
+            stack.push_back(arena.New<NumberExpr>(numbers[next_number++]));
+            break;
+        case OpCode::LoadCell:
+            if (!cells[next_cell].IsValid())
+            {
+                throw ParsingError("Invalid bytecode: invalid cell");
+            }
+            stack.push_back(arena.New<CellExpr>(cells[next_cell++]));
+            break;
+        case OpCode::Add:
+            push_binary(BinaryOpExpr::Add);
+            break;
+        case OpCode::Subtract:
+            push_binary(BinaryOpExpr::Subtract);
+            break;
+        case OpCode::Multiply:
+            push_binary(BinaryOpExpr::Multiply);
+            break;
+        case OpCode::Divide:
+            push_binary(BinaryOpExpr::Divide);
+            break;
+        case OpCode::Negate:
+            stack.push_back(arena.New<UnaryOpExpr>(UnaryOpExpr::UnaryMinus, pop()));
+            break;
+        case OpCode::UnaryPlus:
+            stack.push_back(arena.New<UnaryOpExpr>(UnaryOpExpr::UnaryPlus, pop()));
+            break;
+        case OpCode::AggregateBegin:
+            frames.push_back({ stack.size(), 0 });
+            break;
+        case OpCode::AggregateValue:
+            if (frames.empty() || stack.size() != frames.back().base + frames.back().args + 1)
+            {
+                throw ParsingError("Invalid bytecode: malformed function call");
+            }
+            ++frames.back().args;
+            break;
+        case OpCode::AggregateRange:
+            if (frames.empty() || stack.size() != frames.back().base + frames.back().args
+                || !ranges[next_range].IsValid())
+            {
+                throw ParsingError("Invalid bytecode: malformed function call or invalid range");
+            }
+            stack.push_back(arena.New<RangeExpr>(ranges[next_range++]));
+            ++frames.back().args;
+            break;
+        case OpCode::Sum:
+        case OpCode::Min:
+        case OpCode::Max:
+        case OpCode::Average:
+        case OpCode::Count:
+            push_function(*op);
+            break;
+        default:
+            throw ParsingError("Invalid bytecode: unknown instruction");
+        }
+    }
+    if (stack.size() != 1 || !frames.empty())
+    {
+        throw ParsingError("Invalid bytecode: not a single expression");
+    }
+    return FormulaAST(std::move(arena), stack.back());
+}
+
+FormulaAST ParseFormulaAST(std::istream& in)
+{
+#ifdef SPREADSHEET_WITH_ANTLR
+    if (GetFormulaParserBackend() == FormulaParserBackend::Antlr)
+    {
+        return ParseFormulaASTAntlr(in);
+    }
+#endif
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return ParseFormulaASTNative(text);
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str)
 {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+    return ParseFormulaAST(in_str, GetFormulaParserBackend());
 }
 
 void FormulaAST::PrintCells(std::ostream& out) const
@@ -490,16 +1568,240 @@ void FormulaAST::PrintFormula(std::ostream& out) const
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute(const std::function<double(Position)>& func) const
+void ASTImpl::Program::PushNumber(double value)
+{
+    if (code)
+    {
+        code[code_size] = { OpCode::PushNumber, numbers_size };
+        numbers[numbers_size] = value;
+    }
+    ++code_size;
+    ++numbers_size;
+    stack_size = std::max(stack_size, ++depth);
+}
+
+void ASTImpl::Program::LoadCell(Position pos)
+{
+    if (code)
+    {
+        code[code_size] = { OpCode::LoadCell, cells_size };
+        cells[cells_size] = pos;
+    }
+    ++code_size;
+    ++cells_size;
+    stack_size = std::max(stack_size, ++depth);
+}
+
+void ASTImpl::Program::LoadRange(const Range& range)
 {
-    return root_expr_->Evaluate(func);
+    if (code)
+    {
+        code[code_size] = { OpCode::AggregateRange, ranges_size };
+        ranges[ranges_size] = range;
+    }
+    ++code_size;
+    ++ranges_size;
+}
+
+void ASTImpl::Program::Apply(OpCode op, std::uint32_t operand)
+{
+    if (code)
+    {
+        code[code_size] = { op, operand };
+    }
+    ++code_size;
+    switch (op)
+    {
+    case OpCode::Negate:
+    case OpCode::UnaryPlus:
+        break;
+    case OpCode::AggregateBegin:
+        aggregate_size = std::max(aggregate_size, ++aggregate_depth);
+        break;
+    case OpCode::Sum:
+    case OpCode::Min:
+    case OpCode::Max:
+    case OpCode::Average:
+    case OpCode::Count:
+        --aggregate_depth;
+        stack_size = std::max(stack_size, ++depth);
+        break;
+    default:
+        --depth;
+        break;
+    }
+}
+
+namespace {
+    // Выполняет байт-код; load_cell(operand) возвращает значение ячейки
+    // program.cells[operand]. На первой ошибке вычисление прекращается и
+    // возвращается значение ошибки.
+    template <typename LoadCell>
+    double ExecuteProgram(const ASTImpl::Program& program, LoadCell&& load_cell, const RangeValuesGetter& ranges)
+    {
+        using OpCode = ASTImpl::Program::OpCode;
+        using ASTImpl::Accumulator;
+
+        // Стек обычных формул умещается в локальный массив.
+        constexpr std::size_t INLINE_STACK_SIZE = 32;
+        std::array<double, INLINE_STACK_SIZE> inline_stack{};
+        std::vector<double> heap_stack;
+        double* stack = inline_stack.data();
+        if (program.stack_size > INLINE_STACK_SIZE)
+        {
+            heap_stack.resize(program.stack_size);
+            stack = heap_stack.data();
+        }
+
+        // То же для вложенных вызовов агрегатных функций.
+        constexpr std::size_t INLINE_AGGREGATES_SIZE = 8;
+        std::array<Accumulator, INLINE_AGGREGATES_SIZE> inline_aggregates;
+        std::vector<Accumulator> heap_aggregates;
+        Accumulator* aggregates = inline_aggregates.data();
+        if (program.aggregate_size > INLINE_AGGREGATES_SIZE)
+        {
+            heap_aggregates.resize(program.aggregate_size);
+            aggregates = heap_aggregates.data();
+        }
+        std::vector<double> range_values;
+
+        // top указывает на первую свободную ячейку стека, aggregate — на первый
+        // свободный накопитель.
+        double* top = stack;
+        Accumulator* aggregate = aggregates;
+        for (const auto* instruction = program.code; instruction != program.code + program.code_size; ++instruction)
+        {
+            switch (instruction->code)
+            {
+            case OpCode::PushNumber:
+                *top++ = program.numbers[instruction->operand];
+                break;
+            case OpCode::LoadCell:
+                if (!program.cells[instruction->operand].IsValid())
+                {
+                    return MakeErrorValue(FormulaError::Category::Ref);
+                }
+                *top = load_cell(instruction->operand);
+                if (IsErrorValue(*top))
+                {
+                    return *top;
+                }
+                ++top;
+                break;
+            case OpCode::Add:
+                --top;
+                top[-1] += *top;
+                break;
+            case OpCode::Subtract:
+                --top;
+                top[-1] -= *top;
+                break;
+            case OpCode::Multiply:
+                --top;
+                top[-1] *= *top;
+                break;
+            case OpCode::Divide:
+                --top;
+                top[-1] /= *top;
+                if (!std::isfinite(top[-1]))
+                {
+                    return MakeErrorValue(FormulaError::Category::Arithmetic);
+                }
+                break;
+            case OpCode::Negate:
+                top[-1] = -top[-1];
+                break;
+            case OpCode::UnaryPlus:
+                break;
+            case OpCode::AggregateBegin:
+                *aggregate++ = Accumulator::Start(static_cast<OpCode>(instruction->operand));
+                break;
+            case OpCode::AggregateValue:
+                aggregate[-1].Add(*--top);
+                break;
+            case OpCode::AggregateRange:
+                range_values.clear();
+                ranges(program.ranges[instruction->operand], range_values);
+                if (!range_values.empty() && IsErrorValue(range_values.back()))
+                {
+                    return range_values.back();
+                }
+                aggregate[-1].Add(range_values.data(), range_values.size());
+                break;
+            case OpCode::Sum:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Average:
+            case OpCode::Count:
+                *top = (--aggregate)->Finish();
+                if (IsErrorValue(*top))
+                {
+                    return *top;
+                }
+                ++top;
+                break;
+            }
+        }
+        assert(top == stack + 1 && aggregate == aggregates);
+        return stack[0];
+    }
+}  // namespace
+
+double FormulaAST::Execute(const CellValueGetter& func, const RangeValuesGetter& ranges) const
+{
+    return ExecuteProgram(program_, [this, &func](std::uint32_t operand) {
+        return func(program_.cells[operand]);
+    }, ranges);
+}
+
+double FormulaAST::Execute(const double* cell_values, const RangeValuesGetter& ranges) const
+{
+    return ExecuteProgram(program_, [this, cell_values](std::uint32_t operand) {
+        return cell_values[cell_indices_[operand]];
+    }, ranges);
+}
+
+double FormulaAST::ExecuteTree(const CellValueGetter& func, const RangeValuesGetter& ranges) const
+{
+    std::vector<double> range_values;
+    return root_expr_->Evaluate(func, ranges, range_values);
+}
+
+FormulaAST::FormulaAST(Arena arena, const ASTImpl::Expr* root_expr)
+    : arena_(std::move(arena))
+    , root_expr_(root_expr)
+{
+    ASTImpl::Program sizes;
+    root_expr_->Compile(sizes);
+    program_.code = arena_.NewArray<ASTImpl::Program::Instruction>(sizes.code_size);
+    program_.numbers = arena_.NewArray<double>(sizes.numbers_size);
+    program_.cells = arena_.NewArray<Position>(sizes.cells_size);
+    program_.ranges = arena_.NewArray<Range>(sizes.ranges_size);
+    root_expr_->Compile(program_);
+
+    Position* cells = arena_.NewArray<Position>(program_.cells_size);
+    Position* cells_end = std::copy(program_.cells, program_.cells + program_.cells_size, cells);
+    std::sort(cells, cells_end);
+    cells_end = std::unique(cells, cells_end);
+    cells_ = PositionRange(cells, cells_end - cells);
+
+    std::uint32_t* cell_indices = arena_.NewArray<std::uint32_t>(program_.cells_size);
+    for (std::uint32_t i = 0; i < program_.cells_size; ++i)
+    {
+        cell_indices[i] = static_cast<std::uint32_t>(std::lower_bound(cells, cells_end, program_.cells[i]) - cells);
+    }
+    cell_indices_ = cell_indices;
+
+    Range* ranges = arena_.NewArray<Range>(program_.ranges_size);
+    Range* ranges_end = std::copy(program_.ranges, program_.ranges + program_.ranges_size, ranges);
+    std::sort(ranges, ranges_end);
+    ranges_end = std::unique(ranges, ranges_end);
+    ranges_ = RangeList(ranges, ranges_end - ranges);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
-    : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells))
+std::size_t FormulaAST::GetMemoryUsage() const
 {
-    cells_.sort(); 
+    return sizeof(FormulaAST) + arena_.GetMemoryUsage();
 }
 
 FormulaAST::~FormulaAST() = default;
@@ -1,52 +1,246 @@
 #pragma once
 
-#include "FormulaLexer.h"
+#include "arena.h"
 #include "common.h"
 
-#include <forward_list>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <iosfwd>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace ASTImpl {
     class Expr;
+
+    // Формула в постфиксной записи: операнды кладутся на стек, операции
+    // снимают их и кладут результат. Числа и ячейки хранятся в отдельных
+    // массивах, а инструкция содержит только код операции и номер операнда.
+    //
+    // Пока массивы не выделены, инструкции только подсчитываются: так байт-код
+    // размещается в арене формулы массивами ровно нужного размера.
+    struct Program {
+        enum class OpCode : std::uint8_t {
+            PushNumber,
+            LoadCell,
+            Add,
+            Subtract,
+            Multiply,
+            Divide,
+            Negate,
+            // Ничего не вычисляет; нужен, чтобы по байт-коду восстанавливалось
+            // исходное выражение.
+            UnaryPlus,
+            // Агрегатная функция: AggregateBegin заводит накопитель,
+            // AggregateValue добавляет в него значение с вершины стека,
+            // AggregateRange — числа диапазона, а инструкция функции снимает
+            // накопитель и кладёт результат на стек.
+            AggregateBegin,
+            AggregateValue,
+            AggregateRange,
+            Sum,
+            Min,
+            Max,
+            Average,
+            Count,
+        };
+
+        struct Instruction {
+            OpCode code;
+            std::uint32_t operand = 0;
+        };
+
+        void PushNumber(double value);
+        void LoadCell(Position pos);
+        void LoadRange(const Range& range);
+        void Apply(OpCode code, std::uint32_t operand = 0);
+
+        Instruction* code = nullptr;
+        double* numbers = nullptr;
+        Position* cells = nullptr;
+        Range* ranges = nullptr;
+        std::uint32_t code_size = 0;
+        std::uint32_t numbers_size = 0;
+        std::uint32_t cells_size = 0;
+        std::uint32_t ranges_size = 0;
+
+        // Наибольшая глубина стека при вычислении и глубина после последней
+        // добавленной инструкции; то же для стека накопителей.
+        std::size_t stack_size = 0;
+        std::size_t depth = 0;
+        std::size_t aggregate_size = 0;
+        std::size_t aggregate_depth = 0;
+    };
 }
 
 class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Ошибка вычисления передаётся без исключений, как NaN, в свободных битах
+// которого записана категория ошибки. Числа в ячейках конечны, а NaN,
+// полученный арифметикой, не совпадает со значением ошибки, поэтому значения
+// ошибок не путаются с числами.
+namespace ASTImpl {
+    // Тихий NaN с меткой в старших битах мантиссы; категория — в младших.
+    constexpr std::uint64_t ERROR_VALUE_TAG = 0x7FFA'5E00'0000'0000;
+    constexpr std::uint64_t ERROR_CATEGORY_MASK = 0xFF;
+}
+
+inline double MakeErrorValue(FormulaError::Category category) {
+    std::uint64_t bits = ASTImpl::ERROR_VALUE_TAG | static_cast<std::uint64_t>(category);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline bool IsErrorValue(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & ~ASTImpl::ERROR_CATEGORY_MASK) == ASTImpl::ERROR_VALUE_TAG;
+}
+
+inline FormulaError::Category GetErrorCategory(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return static_cast<FormulaError::Category>(bits & ASTImpl::ERROR_CATEGORY_MASK);
+}
+
+// Значение ячейки в роли операнда формулы: число, ноль для пустой ячейки или
+// значение ошибки.
+inline double GetOperandValue(const NumericValue& value) {
+    switch (value.kind) {
+    case NumericValue::Kind::Blank:
+        return 0.0;
+    case NumericValue::Kind::Number:
+        return value.number;
+    default:
+        return MakeErrorValue(value.error);
+    }
+}
+
+// Возвращает значение ячейки: число или значение ошибки.
 using CellValueGetter = std::function<double(Position)>;
+// Дописывает в values числа из ячеек диапазона. Пустые и нечисловые ячейки
+// пропускаются. На ячейке с ошибкой дописывает значение ошибки и больше ничего
+// не добавляет.
+using RangeValuesGetter = std::function<void(const Range&, std::vector<double>&)>;
+
+// Массив, принадлежащий формуле.
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T* first, std::size_t size)
+        : first_(first)
+        , last_(first + size) {
+    }
+
+    const T* begin() const {
+        return first_;
+    }
+    const T* end() const {
+        return last_;
+    }
+    std::size_t size() const {
+        return last_ - first_;
+    }
+    bool empty() const {
+        return first_ == last_;
+    }
+
+private:
+    const T* first_ = nullptr;
+    const T* last_ = nullptr;
+};
+
+using PositionRange = ArrayView<Position>;
+using RangeList = ArrayView<Range>;
 
 class FormulaAST 
 {
 public:
 
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells);
+    // Узлы дерева должны быть размещены в arena, в ней же формула размещает
+    // байт-код и список ячеек.
+    explicit FormulaAST(Arena arena, const ASTImpl::Expr* root_expr);
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const CellValueGetter& args) const;
+    // Вычисляет формулу по байт-коду и возвращает число или значение первой
+    // по ходу вычисления ошибки. Функция ranges нужна только формулам с
+    // диапазонами.
+    double Execute(const CellValueGetter& args, const RangeValuesGetter& ranges = {}) const;
+    // То же по заранее найденным значениям: cell_values[i] — значение ячейки
+    // GetCells()[i].
+    double Execute(const double* cell_values, const RangeValuesGetter& ranges = {}) const;
+    // Вычисляет формулу обходом дерева. Результат совпадает с Execute;
+    // используется для проверки байт-кода и для сравнения скорости.
+    double ExecuteTree(const CellValueGetter& args, const RangeValuesGetter& ranges = {}) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
 
-    std::forward_list<Position>& GetCells() {
-        return cells_;
+    const ASTImpl::Program& GetProgram() const {
+        return program_;
     }
 
-    const std::forward_list<Position>& GetCells() const {
+    // Ячейки формулы по возрастанию, без повторов. Ячейки диапазонов сюда
+    // не входят.
+    PositionRange GetCells() const {
         return cells_;
     }
 
+    // Диапазоны из аргументов функций по возрастанию, без повторов.
+    RangeList GetRanges() const {
+        return ranges_;
+    }
+
+    // Объём памяти, занимаемой формулой, в байтах.
+    std::size_t GetMemoryUsage() const;
+
 private:
-    std::unique_ptr<ASTImpl::Expr> root_expr_;
+    Arena arena_;
+    const ASTImpl::Expr* root_expr_;
+    ASTImpl::Program program_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
-    std::forward_list<Position> cells_;
+    PositionRange cells_;
+    RangeList ranges_;
+    // Номер ячейки инструкции LoadCell в cells_.
+    const std::uint32_t* cell_indices_ = nullptr;
 };
 
+// Реализация разбора формул. Antlr доступна, если программа собрана с
+// SPREADSHEET_WITH_ANTLR; Native разбирает тот же язык без промежуточного
+// дерева разбора и копирования строки.
+enum class FormulaParserBackend {
+    Antlr,
+    Native,
+};
+
+bool IsFormulaParserBackendAvailable(FormulaParserBackend backend);
+
+// Выбирает реализацию, которой пользуются ParseFormulaAST без явного
+// указания реализации и ParseFormula. По умолчанию выбирается при сборке.
+void SetFormulaParserBackend(FormulaParserBackend backend);
+FormulaParserBackend GetFormulaParserBackend();
+
 FormulaAST ParseFormulaAST(std::istream& in);
 FormulaAST ParseFormulaAST(const std::string& in_str);
+FormulaAST ParseFormulaAST(std::string_view in, FormulaParserBackend backend);
+
+// Восстанавливает формулу по байт-коду без разбора текста. Операнды
+// PushNumber, LoadCell и AggregateRange берутся из numbers, cells и ranges по
+// порядку, как их размещает FormulaAST. Бросает ParsingError, если байт-код
+// не описывает ровно одно выражение.
+FormulaAST BuildFormulaAST(const ASTImpl::Program::OpCode* code, std::size_t code_size,
+                           const double* numbers, std::size_t numbers_size,
+                           const Position* cells, std::size_t cells_size,
+                           const Range* ranges, std::size_t ranges_size);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Линейный распределитель памяти: объекты размещаются подряд в блоках и
+// освобождаются все сразу вместе с распределителем. Деструкторы размещённых
+// объектов не вызываются, поэтому в нём хранятся только объекты, которым
+// нечего освобождать.
+class Arena {
+public:
+    static constexpr std::size_t MIN_BLOCK_SIZE = 256;
+
+    // Если заранее известен объём данных, их можно разместить в одном блоке.
+    explicit Arena(std::size_t capacity = 0) {
+        if (capacity > 0) {
+            AddBlock(capacity);
+        }
+    }
+
+    Arena(Arena&& other) noexcept
+        : last_(std::exchange(other.last_, nullptr))
+        , used_(std::exchange(other.used_, 0))
+        , memory_usage_(std::exchange(other.memory_usage_, 0)) {
+    }
+
+    Arena& operator=(Arena&& other) noexcept {
+        if (this != &other) {
+            Release();
+            last_ = std::exchange(other.last_, nullptr);
+            used_ = std::exchange(other.used_, 0);
+            memory_usage_ = std::exchange(other.memory_usage_, 0);
+        }
+        return *this;
+    }
+
+    ~Arena() {
+        Release();
+    }
+
+    void* Allocate(std::size_t size, std::size_t alignment) {
+        std::size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+        if (!last_ || offset + size > last_->capacity) {
+            AddBlock(std::max({ size, MIN_BLOCK_SIZE, last_ ? last_->capacity * 2 : 0 }));
+            offset = 0;
+        }
+        used_ = offset + size;
+        return last_->Data() + offset;
+    }
+
+    template <typename T, typename... Args>
+    T* New(Args&&... args) {
+        static_assert(alignof(T) <= alignof(std::max_align_t));
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    T* NewArray(std::size_t count) {
+        static_assert(std::is_trivially_destructible_v<T> && alignof(T) <= alignof(std::max_align_t));
+        if (count == 0) {
+            return nullptr;
+        }
+        T* data = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_value_construct_n(data, count);
+        return data;
+    }
+
+    // Объём памяти, полученной от системы, включая заголовки блоков.
+    std::size_t GetMemoryUsage() const {
+        return memory_usage_;
+    }
+
+private:
+    struct alignas(std::max_align_t) Block {
+        Block* prev;
+        std::size_t capacity;
+
+        char* Data() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    void AddBlock(std::size_t capacity) {
+        void* memory = ::operator new(sizeof(Block) + capacity);
+        last_ = new (memory) Block{ last_, capacity };
+        used_ = 0;
+        memory_usage_ += sizeof(Block) + capacity;
+    }
+
+    void Release() {
+        while (last_) {
+            Block* prev = last_->prev;
+            ::operator delete(last_);
+            last_ = prev;
+        }
+        used_ = 0;
+        memory_usage_ = 0;
+    }
+
+    Block* last_ = nullptr;
+    std::size_t used_ = 0;
+    std::size_t memory_usage_ = 0;
+};
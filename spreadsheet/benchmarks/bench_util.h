@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Возвращает время выполнения func в секундах.
+template <typename Func>
+double MeasureSeconds(Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Печатает строку отчёта: время и пропускную способность в операциях в секунду.
+inline void Report(std::string_view name, std::size_t operations, double seconds) {
+    std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << seconds * 1e3 << " ms"
+              << std::setw(12) << operations / seconds / 1e6 << " Mops/s" << std::endl;
+}
+
+// Не даёт компилятору выбросить вычисление, результат которого не используется.
+template <typename T>
+void DoNotOptimize(const T& value) {
+    volatile auto sink = value;
+    (void)sink;
+}
+
+// Объём памяти, выделенной в куче и ещё не освобождённой, в байтах, или ноль,
+// если библиотека C не сообщает его.
+inline std::size_t AllocatedBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
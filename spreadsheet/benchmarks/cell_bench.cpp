@@ -0,0 +1,86 @@
+// Замеряет операции над отдельными ячейками: запись текста в новые ячейки,
+// замену текста формулами, чтение значений и очистку. Лист занимает
+// ROWS x COLS ячеек; в столбце A записаны числа текстом, в остальных —
+// формулы, ссылающиеся на ячейку слева.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+constexpr int ROWS = 10'000;
+constexpr int COLS = 20;
+// Чтение значения занимает десятки наносекунд, поэтому лист читается
+// несколько раз.
+constexpr int READ_REPEATS = 20;
+
+template <typename Func>
+void ForEachPosition(Func&& func) {
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            func(Position{ row, col });
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    constexpr std::size_t CELLS = static_cast<std::size_t>(ROWS) * COLS;
+    std::vector<std::string> texts;
+    std::vector<std::string> formulas;
+    texts.reserve(CELLS);
+    formulas.reserve(CELLS);
+    ForEachPosition([&](Position pos) {
+        texts.push_back(std::to_string(pos.row * COLS + pos.col));
+        formulas.push_back(pos.col == 0 ? texts.back() : "=" + Position{ pos.row, pos.col - 1 }.ToString() + "+1");
+    });
+
+    Sheet sheet;
+    std::size_t i = 0;
+    Report("SetCell text into new cells", CELLS, MeasureSeconds([&] {
+        ForEachPosition([&](Position pos) {
+            sheet.SetCell(pos, texts[i++]);
+        });
+    }));
+    i = 0;
+    Report("SetCell formulas over text", CELLS, MeasureSeconds([&] {
+        ForEachPosition([&](Position pos) {
+            sheet.SetCell(pos, formulas[i++]);
+        });
+    }));
+    sheet.Recalculate();
+
+    double sum = 0;
+    Report("GetValue", CELLS * READ_REPEATS, MeasureSeconds([&] {
+        for (int repeat = 0; repeat < READ_REPEATS; ++repeat) {
+            ForEachPosition([&](Position pos) {
+                auto value = sheet.GetCell(pos)->GetValue();
+                sum += std::holds_alternative<double>(value) ? std::get<double>(value) : std::get<std::string>(value).size();
+            });
+        }
+    }));
+    Report("GetValueView", CELLS * READ_REPEATS, MeasureSeconds([&] {
+        for (int repeat = 0; repeat < READ_REPEATS; ++repeat) {
+            ForEachPosition([&](Position pos) {
+                auto value = sheet.GetCell(pos)->GetValueView();
+                sum += std::holds_alternative<double>(value) ? std::get<double>(value) : std::get<std::string_view>(value).size();
+            });
+        }
+    }));
+
+    // Формулы, ссылающиеся на ячейку, не дают её удалить: очищается сама
+    // ячейка, а не весь лист.
+    Report("ClearCell", CELLS, MeasureSeconds([&] {
+        for (int row = ROWS - 1; row >= 0; --row) {
+            for (int col = COLS - 1; col >= 0; --col) {
+                sheet.ClearCell({ row, col });
+            }
+        }
+    }));
+    DoNotOptimize(sum);
+}
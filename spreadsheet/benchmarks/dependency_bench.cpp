@@ -0,0 +1,82 @@
+// Замеряет сброс кэша зависимых формул на графе из миллиона рёбер. Лист
+// 1000x500: первая строка и первый столбец содержат числа, остальные ячейки —
+// формулы, ссылающиеся на соседей слева и сверху. Изменение B1 затрагивает все
+// формулы, изменение ячейки у правого нижнего угла — сотню. Пересчёт после
+// каждого изменения в замер не входит и замеряется отдельно.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int ROWS = 1000;
+constexpr int COLS = 500;
+
+std::vector<std::pair<Position, std::string>> MakeCells() {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(static_cast<std::size_t>(ROWS) * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            Position pos{ row, col };
+            if (row == 0 || col == 0) {
+                cells.emplace_back(pos, std::to_string(row + col));
+            }
+            else {
+                cells.emplace_back(pos, "=" + Position{ row, col - 1 }.ToString() + "+"
+                                            + Position{ row - 1, col }.ToString());
+            }
+        }
+    }
+    return cells;
+}
+
+// Изменяет ячейку pos repeats раз и возвращает суммарное время изменений.
+double MeasureEdits(Sheet& sheet, Position pos, int repeats) {
+    double seconds = 0;
+    for (int i = 0; i < repeats; ++i) {
+        seconds += MeasureSeconds([&] {
+            sheet.SetCell(pos, std::to_string(i % 2));
+        });
+        sheet.Recalculate();
+    }
+    return seconds;
+}
+
+}  // namespace
+
+int main() {
+    constexpr std::size_t EDGES = 2 * static_cast<std::size_t>(ROWS - 1) * (COLS - 1);
+    std::cout << "== " << ROWS << "x" << COLS << ": " << EDGES << " edges" << std::endl;
+
+    Sheet sheet;
+    Report("SetCells", static_cast<std::size_t>(ROWS) * COLS, MeasureSeconds([&] {
+        sheet.SetCells(MakeCells());
+    }));
+    Report("Recalculate", static_cast<std::size_t>(ROWS) * COLS, MeasureSeconds([&] {
+        sheet.Recalculate();
+    }));
+
+    constexpr int WHOLE_REPEATS = 10;
+    Report("invalidate all formulas (edges)", EDGES * WHOLE_REPEATS,
+           MeasureEdits(sheet, { 0, 1 }, WHOLE_REPEATS));
+
+    constexpr std::size_t FORMULAS = static_cast<std::size_t>(ROWS - 1) * (COLS - 1);
+    double recalc_seconds = 0;
+    for (int i = 0; i < WHOLE_REPEATS; ++i) {
+        sheet.SetCell({ 0, 1 }, std::to_string(i));
+        recalc_seconds += MeasureSeconds([&] {
+            sheet.Recalculate();
+        });
+    }
+    Report("recalculate all formulas (formulas)", FORMULAS * WHOLE_REPEATS, recalc_seconds);
+
+    // Ячейка и зависящие от неё формулы занимают квадрат 10x10 в правом
+    // нижнем углу.
+    constexpr int CORNER_REPEATS = 20'000;
+    Report("invalidate 100 formulas (edits)", CORNER_REPEATS,
+           MeasureEdits(sheet, { ROWS - 10, COLS - 10 }, CORNER_REPEATS));
+}
@@ -0,0 +1,48 @@
+// Замеряет пересчёт листа, в котором ошибка одной ячейки расходится по
+// тысячам зависимых формул. A1 содержит формулу, столбец B — формулы =A1+n,
+// столбец C — формулы =Bn*2+A1. После каждого изменения A1 пересчитываются
+// все формулы листа; для сравнения тот же пересчёт замеряется, когда A1
+// вычисляется в число.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int ROWS = 10'000;
+constexpr int REPEATS = 50;
+
+void RunScenario(const std::string& name, const std::string& first, const std::string& second) {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.emplace_back(Position{ 0, 0 }, first);
+    for (int row = 0; row < ROWS; ++row) {
+        Position pos{ row, 1 };
+        cells.emplace_back(pos, "=A1+" + std::to_string(row));
+        cells.emplace_back(Position{ row, 2 }, "=" + pos.ToString() + "*2+A1");
+    }
+
+    Sheet sheet;
+    sheet.SetCells(std::move(cells));
+    sheet.Recalculate();
+
+    double seconds = 0;
+    for (int i = 0; i < REPEATS; ++i) {
+        sheet.SetCell({ 0, 0 }, i % 2 == 0 ? second : first);
+        seconds += MeasureSeconds([&] {
+            sheet.Recalculate();
+        });
+    }
+    Report(name, static_cast<std::size_t>(2 * ROWS + 1) * REPEATS, seconds);
+    DoNotOptimize(sheet.GetCell({ ROWS - 1, 2 })->GetValue().index());
+}
+
+}  // namespace
+
+int main() {
+    RunScenario("recalculate errors (formulas)", "=1/0", "=Z1/0");
+    RunScenario("recalculate numbers (formulas)", "=1", "=2");
+}
@@ -0,0 +1,128 @@
+// Замеряет разбор формулы и стоимость одного вычисления: обходом дерева
+// (FormulaAST::ExecuteTree, как до перехода на байт-код), по байт-коду
+// (FormulaAST::Execute) и целиком через ParseFormula + Evaluate на листе,
+// где все ячейки содержат одно и то же число. Сумма 64 ссылок сравнивается
+// с SUM по диапазону тех же ячеек.
+
+#include "../FormulaAST.h"
+#include "../common.h"
+#include "../formula.h"
+#include "bench_util.h"
+
+#include <algorithm>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+class ConstantCell : public CellInterface {
+public:
+    Value GetValue() const override {
+        return 1.5;
+    }
+    std::string GetText() const override {
+        return "1.5";
+    }
+    std::vector<Position> GetReferencedCells() const override {
+        return {};
+    }
+};
+
+// Лист, в котором любая ячейка содержит число 1.5.
+class ConstantSheet : public SheetInterface {
+public:
+    void SetCell(Position, std::string) override {}
+    const CellInterface* GetCell(Position) const override {
+        return &cell_;
+    }
+    CellInterface* GetCell(Position) override {
+        return &cell_;
+    }
+    void ClearCell(Position) override {}
+    Size GetPrintableSize() const override {
+        return {};
+    }
+    void PrintValues(std::ostream&) const override {}
+    void PrintTexts(std::ostream&) const override {}
+
+private:
+    ConstantCell cell_;
+};
+
+constexpr std::size_t PARSES = 20'000;
+constexpr std::size_t EVALUATIONS = 2'000'000;
+
+std::string SumOfCells(int count) {
+    std::string expr = "A1";
+    for (int row = 2; row <= count; ++row) {
+        expr += "+A" + std::to_string(row);
+    }
+    return expr;
+}
+
+std::string NestedExpression(int depth) {
+    std::string expr = "B1";
+    for (int i = 0; i < depth; ++i) {
+        expr = "(" + expr + ")*2-" + std::to_string(i) + "/C" + std::to_string(i + 1);
+    }
+    return expr;
+}
+
+void RunScenario(const std::string& name, const std::string& expr) {
+    std::cout << "== " << name << ": " << expr.size() << " chars" << std::endl;
+
+    Report("ParseFormula", PARSES, MeasureSeconds([&] {
+        for (std::size_t i = 0; i < PARSES; ++i) {
+            DoNotOptimize(ParseFormula(expr).get());
+        }
+    }));
+
+    // Числовые операции занимают доли наносекунды, поэтому количество
+    // вычислений подбирается так, чтобы замер длился заметное время.
+    std::size_t evaluations = EVALUATIONS / std::max<std::size_t>(expr.size() / 8, 1);
+    CellValueGetter cell_value = [](Position pos) {
+        return 1.5 + pos.row;
+    };
+    RangeValuesGetter range_values = [&cell_value](const Range& range, std::vector<double>& values) {
+        for (int row = range.from.row; row <= range.to.row; ++row) {
+            for (int col = range.from.col; col <= range.to.col; ++col) {
+                values.push_back(cell_value({ row, col }));
+            }
+        }
+    };
+    FormulaAST ast = ParseFormulaAST(expr);
+
+    double sum = 0;
+    Report("FormulaAST::ExecuteTree", evaluations, MeasureSeconds([&] {
+        for (std::size_t i = 0; i < evaluations; ++i) {
+            sum += ast.ExecuteTree(cell_value, range_values);
+        }
+    }));
+    Report("FormulaAST::Execute", evaluations, MeasureSeconds([&] {
+        for (std::size_t i = 0; i < evaluations; ++i) {
+            sum += ast.Execute(cell_value, range_values);
+        }
+    }));
+
+    ConstantSheet sheet;
+    auto formula = ParseFormula(expr);
+    std::cout << "memory per formula: " << formula->GetMemoryUsage() << " bytes" << std::endl;
+    Report("Formula::Evaluate", evaluations, MeasureSeconds([&] {
+        for (std::size_t i = 0; i < evaluations; ++i) {
+            auto value = formula->Evaluate(sheet);
+            sum += std::holds_alternative<double>(value) ? std::get<double>(value) : 0;
+        }
+    }));
+    DoNotOptimize(sum);
+}
+
+}  // namespace
+
+int main() {
+    RunScenario("constants", "1+2*3-4/5");
+    RunScenario("few references", "A1+B2*C3-D4/E5");
+    RunScenario("sum of 64 references", SumOfCells(64));
+    RunScenario("SUM of a 64-cell range", "SUM(A1:A64)");
+    RunScenario("nested 32 levels", NestedExpression(32));
+}
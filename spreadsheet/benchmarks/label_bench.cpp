@@ -0,0 +1,88 @@
+// Замеряет таблицу с повторяющимися подписями: в каждой строке записаны
+// заказы со статусом, валютой, складом и примечанием из небольших наборов
+// значений, как в выгрузках из учётных систем. Печатает память кучи, занятую
+// листом, в расчёте на текстовую ячейку, а также скорость записи и чтения
+// значений.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <variant>
+
+namespace {
+
+constexpr int ROWS = 16'000;
+// Число заказов в строке; каждый занимает четыре столбца.
+constexpr int ORDERS_PER_ROW = 8;
+constexpr int COLS = ORDERS_PER_ROW * 4;
+
+constexpr std::array<std::string_view, 5> STATUSES = {
+    "PENDING", "SHIPPED", "DELIVERED", "CANCELLED BY CUSTOMER REQUEST", "RETURNED TO WAREHOUSE",
+};
+constexpr std::array<std::string_view, 4> CURRENCIES = { "USD", "EUR", "GBP", "JPY" };
+constexpr std::array<std::string_view, 3> WAREHOUSES = {
+    "North distribution center", "South distribution center", "'Central",
+};
+constexpr std::array<std::string_view, 3> NOTES = {
+    "Requires signature on delivery", "Leave at the front door", "Fragile: handle with care",
+};
+
+std::string_view Label(int row, int col) {
+    int order = row * ORDERS_PER_ROW + col / 4;
+    switch (col % 4) {
+    case 0:
+        return STATUSES[order % STATUSES.size()];
+    case 1:
+        return CURRENCIES[order % CURRENCIES.size()];
+    case 2:
+        return WAREHOUSES[order % WAREHOUSES.size()];
+    default:
+        return NOTES[order / 7 % NOTES.size()];
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::size_t heap_before = AllocatedBytes();
+    Sheet sheet;
+    double seconds = MeasureSeconds([&] {
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                sheet.SetCell({ row, col }, std::string(Label(row, col)));
+            }
+        }
+    });
+    std::size_t cell_count = static_cast<std::size_t>(ROWS) * COLS;
+    Report("SetCell labels (cells)", cell_count, seconds);
+
+    std::size_t heap = AllocatedBytes() - heap_before;
+    std::cout << "heap: " << heap / 1024 << " KiB, " << static_cast<double>(heap) / cell_count
+              << " bytes per cell" << std::endl;
+    const StringPool& strings = sheet.GetStringPool();
+    std::cout << "string pool: " << strings.Size() << " strings, " << strings.GetMemoryUsage() << " bytes"
+              << std::endl;
+
+    std::size_t total_length = 0;
+    seconds = MeasureSeconds([&] {
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                total_length += std::get<std::string>(sheet.GetCell({ row, col })->GetValue()).size();
+            }
+        }
+    });
+    Report("GetValue labels (cells)", cell_count, seconds);
+
+    seconds = MeasureSeconds([&] {
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                total_length += std::get<std::string_view>(sheet.GetCell({ row, col })->GetValueView()).size();
+            }
+        }
+    });
+    Report("GetValueView labels (cells)", cell_count, seconds);
+    DoNotOptimize(total_length);
+}
@@ -0,0 +1,138 @@
+// Сравнивает заполнение таблицы вызовами SetCell для каждой ячейки с
+// загрузкой того же набора одним вызовом SetCells. Половина ячеек содержит
+// числа, половина — формулы, ссылающиеся на соседей слева и сверху либо
+// справа и снизу; во втором случае SetCells не может обойтись без поиска
+// циклов. После загрузки все значения читаются, чтобы учесть и отложенный
+// пересчёт.
+//
+// Разбор формул и построение графа у обоих способов общие, поэтому от
+// SetCells требуется не кратное ускорение, а лишь обгон поячеечного цикла за
+// счёт того, что он не ищет циклы и не помечает зависимые для каждой ячейки
+// отдельно. Если на каком-то наборе SetCells медленнее, бенчмарк завершается
+// с кодом 1.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::vector<std::pair<Position, std::string>> MakeCells(int rows, int cols, bool forward) {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(static_cast<std::size_t>(rows) * cols);
+    int step = forward ? 1 : -1;
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            Position pos{ row, col };
+            bool border = forward ? row == rows - 1 || col == cols - 1 : row == 0 || col == 0;
+            if ((row + col) % 2 == 0 || border) {
+                cells.emplace_back(pos, std::to_string(row + col));
+            }
+            else {
+                cells.emplace_back(pos, "=" + Position{ row, col + step }.ToString() + "+"
+                                            + Position{ row + step, col }.ToString() + "/2");
+            }
+        }
+    }
+    return cells;
+}
+
+double ReadAllValues(const Sheet& sheet, const std::vector<std::pair<Position, std::string>>& cells) {
+    double sum = 0;
+    for (const auto& [pos, text] : cells) {
+        auto value = sheet.GetCell(pos)->GetValue();
+        if (std::holds_alternative<double>(value)) {
+            sum += std::get<double>(value);
+        }
+    }
+    return sum;
+}
+
+// Каждый способ загрузки повторяется REPEATS раз в паре с другим, и
+// печатается лучшее время. Скорость машины заметно плавает от секунды к
+// секунде, поэтому SetCells сравнивается с поячеечным циклом внутри каждой
+// пары и должен выиграть в большинстве пар. Способы по очереди идут в паре
+// первыми, чтобы ни одному не доставалась всегда прогретая память.
+constexpr int REPEATS = 5;
+
+// Возвращает false, если SetCells оказался медленнее поячеечного цикла.
+bool RunScenario(int rows, int cols, bool forward) {
+    auto cells = MakeCells(rows, cols, forward);
+    std::cout << "== " << rows << "x" << cols << (forward ? ", forward" : ", backward") << " references: "
+              << cells.size() << " cells" << std::endl;
+
+    double per_cell_seconds = 0;
+    double per_cell_read_seconds = 0;
+    double batch_seconds = 0;
+    double batch_read_seconds = 0;
+    auto keep_best = [](double& best, double seconds) {
+        if (best == 0 || seconds < best) {
+            best = seconds;
+        }
+    };
+    // Возвращают время загрузки.
+    auto run_per_cell = [&] {
+        Sheet sheet;
+        double seconds = MeasureSeconds([&] {
+            for (const auto& [pos, text] : cells) {
+                sheet.SetCell(pos, text);
+            }
+        });
+        keep_best(per_cell_read_seconds, MeasureSeconds([&] {
+            DoNotOptimize(ReadAllValues(sheet, cells));
+        }));
+        keep_best(per_cell_seconds, seconds);
+        return seconds;
+    };
+    auto run_batch = [&] {
+        Sheet sheet;
+        auto batch = cells;
+        double seconds = MeasureSeconds([&] {
+            sheet.SetCells(std::move(batch));
+        });
+        keep_best(batch_read_seconds, MeasureSeconds([&] {
+            DoNotOptimize(ReadAllValues(sheet, cells));
+        }));
+        keep_best(batch_seconds, seconds);
+        return seconds;
+    };
+    int batch_wins = 0;
+    for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        double pair_per_cell_seconds = 0;
+        double pair_batch_seconds = 0;
+        if (repeat % 2 == 0) {
+            pair_per_cell_seconds = run_per_cell();
+            pair_batch_seconds = run_batch();
+        }
+        else {
+            pair_batch_seconds = run_batch();
+            pair_per_cell_seconds = run_per_cell();
+        }
+        batch_wins += pair_batch_seconds < pair_per_cell_seconds;
+    }
+    Report("SetCell per cell", cells.size(), per_cell_seconds);
+    Report("SetCell per cell: read values", cells.size(), per_cell_read_seconds);
+    Report("SetCells", cells.size(), batch_seconds);
+    Report("SetCells: read values", cells.size(), batch_read_seconds);
+    std::cout << "SetCells speedup: " << per_cell_seconds / batch_seconds << "x, faster in " << batch_wins << " of "
+              << REPEATS << " pairs" << std::endl;
+    return 2 * batch_wins > REPEATS;
+}
+
+}  // namespace
+
+int main() {
+    bool faster = true;
+    for (bool forward : { false, true }) {
+        faster = RunScenario(100, 100, forward) && faster;
+        faster = RunScenario(1000, 100, forward) && faster;
+        faster = RunScenario(1000, 1000, forward) && faster;
+    }
+    if (!faster) {
+        std::cout << "SetCells is slower than SetCell per cell" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,99 @@
+// Замеряет поиск формул, зависящих от ячейки через диапазоны. 10 000 формул
+// вида SUM(A1:A5000) ссылаются на перекрывающиеся столбцы, так что суммарная
+// площадь диапазонов — 50 млн ячеек. Поиск по RangeIndex сравнивается с
+// перебором всех диапазонов, а изменение ячеек листа — с числом найденных
+// зависимых формул.
+
+#include "../range_index.h"
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int FORMULAS = 10'000;
+constexpr int DATA_COLS = 100;
+constexpr int RANGE_ROWS = 5'000;
+constexpr int FORMULA_COL = 200;
+constexpr std::size_t LOOKUPS = 20'000;
+constexpr std::size_t EDITS = 100'000;
+
+Range MakeRange(int index) {
+    int col = index % DATA_COLS;
+    int first_row = index / DATA_COLS * 50;
+    return { { first_row, col }, { first_row + RANGE_ROWS - 1, col } };
+}
+
+std::vector<Position> RandomPositions(std::size_t count) {
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> row(0, FORMULAS / DATA_COLS * 50 + RANGE_ROWS);
+    std::uniform_int_distribution<int> col(0, DATA_COLS - 1);
+    std::vector<Position> positions;
+    positions.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        positions.push_back({ row(random), col(random) });
+    }
+    return positions;
+}
+
+void RunLookup() {
+    std::cout << "== lookup among " << FORMULAS << " ranges" << std::endl;
+    RangeIndex<std::set<Position>> index;
+    std::map<Range, std::set<Position>> ranges;
+    for (int i = 0; i < FORMULAS; ++i) {
+        index[MakeRange(i)].insert({ i, FORMULA_COL });
+        ranges[MakeRange(i)].insert({ i, FORMULA_COL });
+    }
+
+    auto positions = RandomPositions(LOOKUPS);
+    std::size_t found = 0;
+    Report("linear scan", LOOKUPS, MeasureSeconds([&] {
+        for (const auto& pos : positions) {
+            for (const auto& [range, dependents] : ranges) {
+                if (range.Contains(pos)) {
+                    found += dependents.size();
+                }
+            }
+        }
+    }));
+    Report("RangeIndex::ForEachContaining", LOOKUPS, MeasureSeconds([&] {
+        for (const auto& pos : positions) {
+            index.ForEachContaining(pos, [&found](const Range&, const std::set<Position>& dependents) {
+                found += dependents.size();
+            });
+        }
+    }));
+    std::cout << "dependents per lookup: " << found / 2.0 / LOOKUPS << std::endl;
+}
+
+void RunSheet() {
+    std::cout << "== sheet with " << FORMULAS << " range formulas" << std::endl;
+    Sheet sheet;
+    Report("SetCell range formulas", FORMULAS, MeasureSeconds([&] {
+        for (int i = 0; i < FORMULAS; ++i) {
+            sheet.SetCell({ i, FORMULA_COL }, "=SUM(" + MakeRange(i).ToString() + ")");
+        }
+    }));
+
+    auto positions = RandomPositions(EDITS);
+    Report("SetCell inside ranges", EDITS, MeasureSeconds([&] {
+        for (std::size_t i = 0; i < EDITS; ++i) {
+            sheet.SetCell(positions[i], std::to_string(i));
+        }
+    }));
+    Report("Recalculate range formulas", FORMULAS, MeasureSeconds([&] {
+        sheet.Recalculate();
+    }));
+}
+
+}  // namespace
+
+int main() {
+    RunLookup();
+    RunSheet();
+}
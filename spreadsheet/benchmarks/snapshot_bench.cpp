@@ -0,0 +1,85 @@
+// Сравнивает холодный старт таблицы из двоичного снимка с повторной загрузкой
+// текстов ячеек через SetCells, после которой формулы разбираются заново и все
+// значения пересчитываются. Снимок записывается во временный файл в текущем
+// каталоге и читается через отображение в память.
+
+#include "../sheet.h"
+#include "../snapshot.h"
+#include "bench_util.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const char* SNAPSHOT_PATH = "snapshot_bench.bin";
+
+std::vector<std::pair<Position, std::string>> MakeCells(int rows, int cols) {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(static_cast<std::size_t>(rows) * cols);
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            Position pos{ row, col };
+            if (col % 4 == 0 || row == 0) {
+                cells.emplace_back(pos, std::to_string(row * 0.5 + col));
+            }
+            else {
+                cells.emplace_back(pos, "=" + Position{ row, col - 1 }.ToString() + "*2-"
+                                            + Position{ row - 1, col }.ToString() + "/3");
+            }
+        }
+    }
+    return cells;
+}
+
+double ReadAllValues(const Sheet& sheet, const std::vector<std::pair<Position, std::string>>& cells) {
+    double sum = 0;
+    for (const auto& [pos, text] : cells) {
+        auto value = sheet.GetCell(pos)->GetValue();
+        if (std::holds_alternative<double>(value)) {
+            sum += std::get<double>(value);
+        }
+    }
+    return sum;
+}
+
+void RunScenario(int rows, int cols) {
+    auto cells = MakeCells(rows, cols);
+    std::cout << "== " << rows << "x" << cols << ": " << cells.size() << " cells" << std::endl;
+
+    {
+        Sheet sheet;
+        auto batch = cells;
+        Report("replay: SetCells", cells.size(), MeasureSeconds([&] {
+            sheet.SetCells(std::move(batch));
+        }));
+        Report("replay: recalculate values", cells.size(), MeasureSeconds([&] {
+            DoNotOptimize(ReadAllValues(sheet, cells));
+        }));
+        Report("snapshot: save", cells.size(), MeasureSeconds([&] {
+            SheetSnapshot::SaveFile(sheet, SNAPSHOT_PATH);
+        }));
+    }
+    {
+        std::ifstream file(SNAPSHOT_PATH, std::ios::binary | std::ios::ate);
+        std::cout << "snapshot size: " << file.tellg() / (1 << 20) << " MiB" << std::endl;
+    }
+    std::unique_ptr<Sheet> sheet;
+    Report("snapshot: load", cells.size(), MeasureSeconds([&] {
+        sheet = SheetSnapshot::LoadFile(SNAPSHOT_PATH);
+    }));
+    Report("snapshot: read cached values", cells.size(), MeasureSeconds([&] {
+        DoNotOptimize(ReadAllValues(*sheet, cells));
+    }));
+    std::remove(SNAPSHOT_PATH);
+}
+
+}  // namespace
+
+int main() {
+    RunScenario(1000, 100);
+    RunScenario(1000, 1000);
+}
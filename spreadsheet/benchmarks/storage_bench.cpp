@@ -0,0 +1,196 @@
+// Сравнивает блочное хранилище ячеек TiledGrid с прежним хранением в
+// std::unordered_map<Position, std::unique_ptr<...>> на плотных и разреженных
+// таблицах: вставку, случайный поиск, построчный обход и память в куче на
+// ячейку.
+//
+// Прежний хеш row ^ (col << 1) на плотных таблицах даёт длинные цепочки
+// коллизий, и время работы словаря растёт квадратично, поэтому на плотных
+// таблицах крупнее LEGACY_MAP_LIMIT ячеек замеряется только TiledGrid.
+
+#include "../common.h"
+#include "../tiled_grid.h"
+#include "bench_util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Хеш, которым пользовалась таблица до перехода на TiledGrid.
+struct LegacyPositionHash {
+    std::size_t operator()(const Position& pos) const noexcept {
+        std::size_t h1 = std::hash<int>{}(pos.row);
+        std::size_t h2 = std::hash<int>{}(pos.col);
+        return h1 ^ (h2 << 1);
+    }
+};
+
+// Нагрузка размером с объект ячейки: указатель на таблицу виртуальных
+// функций, на реализацию и на таблицу.
+struct Payload {
+    explicit Payload(std::uintptr_t value) : value(value) {}
+
+    std::uintptr_t vtable = 0;
+    std::uintptr_t value;
+    std::uintptr_t sheet = 0;
+};
+
+using LegacyMap = std::unordered_map<Position, std::unique_ptr<Payload>, LegacyPositionHash>;
+
+constexpr std::size_t LOOKUPS = 2'000'000;
+constexpr std::size_t LEGACY_MAP_LIMIT = 300'000;
+
+std::vector<Position> DensePositions(int size) {
+    std::vector<Position> positions;
+    positions.reserve(static_cast<std::size_t>(size) * size);
+    for (int row = 0; row < size; ++row) {
+        for (int col = 0; col < size; ++col) {
+            positions.push_back({ row, col });
+        }
+    }
+    return positions;
+}
+
+std::vector<Position> SparsePositions(std::size_t count, int rows, int cols, std::mt19937& random) {
+    std::uniform_int_distribution<int> row_dist(0, rows - 1);
+    std::uniform_int_distribution<int> col_dist(0, cols - 1);
+    std::vector<Position> positions;
+    positions.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        positions.push_back({ row_dist(random), col_dist(random) });
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+    std::shuffle(positions.begin(), positions.end(), random);
+    return positions;
+}
+
+// Таблица из одного столбца во всю высоту листа.
+std::vector<Position> TallColumnPositions() {
+    std::vector<Position> positions;
+    positions.reserve(Position::MAX_ROWS);
+    for (int row = 0; row < Position::MAX_ROWS; ++row) {
+        positions.push_back({ row, 0 });
+    }
+    return positions;
+}
+
+std::vector<Position> DiagonalPositions() {
+    std::vector<Position> positions;
+    positions.reserve(Position::MAX_ROWS);
+    for (int i = 0; i < Position::MAX_ROWS; ++i) {
+        positions.push_back({ i, i });
+    }
+    return positions;
+}
+
+// Печатает память в куче, занятую контейнером после вставки всех ячеек.
+void ReportMemory(std::string_view name, std::size_t heap, std::size_t cell_count) {
+    std::cout << std::left << std::setw(48) << name << std::right << std::setw(10) << heap / 1024 << " KiB"
+              << std::setw(12) << std::setprecision(1) << static_cast<double>(heap) / cell_count << " B/cell"
+              << std::endl;
+}
+
+Size BoundingBox(const std::vector<Position>& positions) {
+    Size size;
+    for (const auto& pos : positions) {
+        size.rows = std::max(size.rows, pos.row + 1);
+        size.cols = std::max(size.cols, pos.col + 1);
+    }
+    return size;
+}
+
+void RunScenario(const std::string& name, const std::vector<Position>& positions, std::mt19937& random) {
+    std::cout << "== " << name << ": " << positions.size() << " cells" << std::endl;
+
+    std::vector<Position> lookups;
+    lookups.reserve(LOOKUPS);
+    std::uniform_int_distribution<std::size_t> index_dist(0, positions.size() - 1);
+    for (std::size_t i = 0; i < LOOKUPS; ++i) {
+        lookups.push_back(positions[index_dist(random)]);
+    }
+    Size box = BoundingBox(positions);
+    std::size_t box_area = static_cast<std::size_t>(box.rows) * box.cols;
+
+    if (positions.size() <= LEGACY_MAP_LIMIT) {
+        std::size_t heap_before = AllocatedBytes();
+        LegacyMap map;
+        Report("unordered_map: insert", positions.size(), MeasureSeconds([&] {
+            for (const auto& pos : positions) {
+                map[pos] = std::make_unique<Payload>(pos.row);
+            }
+        }));
+        ReportMemory("unordered_map: heap", AllocatedBytes() - heap_before, positions.size());
+
+        std::uintptr_t sum = 0;
+        Report("unordered_map: random lookup", LOOKUPS, MeasureSeconds([&] {
+            for (const auto& pos : lookups) {
+                auto it = map.find(pos);
+                sum += it != map.end() ? it->second->value : 0;
+            }
+        }));
+        Report("unordered_map: row-major scan of bounding box", box_area, MeasureSeconds([&] {
+            for (int row = 0; row < box.rows; ++row) {
+                for (int col = 0; col < box.cols; ++col) {
+                    auto it = map.find({ row, col });
+                    sum += it != map.end() ? it->second->value : 0;
+                }
+            }
+        }));
+        DoNotOptimize(sum);
+    }
+
+    {
+        std::size_t heap_before = AllocatedBytes();
+        TiledGrid<Payload> grid;
+        Report("TiledGrid: insert", positions.size(), MeasureSeconds([&] {
+            for (const auto& pos : positions) {
+                grid.Emplace(pos, pos.row);
+            }
+        }));
+        ReportMemory("TiledGrid: heap", AllocatedBytes() - heap_before, positions.size());
+
+        std::uintptr_t sum = 0;
+        Report("TiledGrid: random lookup", LOOKUPS, MeasureSeconds([&] {
+            for (const auto& pos : lookups) {
+                const Payload* payload = grid.Find(pos);
+                sum += payload ? payload->value : 0;
+            }
+        }));
+        Report("TiledGrid: row-major scan of bounding box", box_area, MeasureSeconds([&] {
+            for (int row = 0; row < box.rows; ++row) {
+                for (int col = 0; col < box.cols; ++col) {
+                    const Payload* payload = grid.Find({ row, col });
+                    sum += payload ? payload->value : 0;
+                }
+            }
+        }));
+        Report("TiledGrid: row-major scan of occupied cells", positions.size(), MeasureSeconds([&] {
+            grid.ForEach([&sum](Position, const Payload& payload) { sum += payload.value; });
+        }));
+        DoNotOptimize(sum);
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::mt19937 random(42);
+
+    for (int size : { 256, 512, 1024, 4096 }) {
+        auto positions = DensePositions(size);
+        RunScenario("dense " + std::to_string(size) + "x" + std::to_string(size), positions, random);
+    }
+
+    RunScenario("tall column of " + std::to_string(Position::MAX_ROWS), TallColumnPositions(), random);
+    RunScenario("diagonal of " + std::to_string(Position::MAX_ROWS), DiagonalPositions(), random);
+    RunScenario("sparse 1% of 4096x4096", SparsePositions(4096 * 4096 / 100, 4096, 4096, random), random);
+    RunScenario("sparse 100000 cells in 16384x16384",
+                SparsePositions(100'000, Position::MAX_ROWS, Position::MAX_COLS, random), random);
+}
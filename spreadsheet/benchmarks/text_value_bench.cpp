@@ -0,0 +1,45 @@
+// Замеряет формулы, читающие текстовые ячейки с числами: так выглядят данные,
+// импортированные из CSV. Столбец A содержит ROWS чисел, записанных текстом,
+// столбец B — формулы =An*2, а C1 — сумму всего столбца A. Пересчёт
+// замеряется после изменения каждой ячейки столбца A.
+
+#include "../sheet.h"
+#include "bench_util.h"
+
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+constexpr int ROWS = 10'000;
+constexpr int REPEATS = 50;
+
+}  // namespace
+
+int main() {
+    std::vector<std::pair<Position, std::string>> cells;
+    for (int row = 0; row < ROWS; ++row) {
+        Position pos{ row, 0 };
+        cells.emplace_back(pos, std::to_string(row) + ".25");
+        cells.emplace_back(Position{ row, 1 }, "=" + pos.ToString() + "*2");
+    }
+    cells.emplace_back(Position{ 0, 2 }, "=SUM(A1:A" + std::to_string(ROWS) + ")");
+
+    Sheet sheet;
+    sheet.SetCells(std::move(cells));
+    sheet.Recalculate();
+
+    double seconds = 0;
+    for (int i = 0; i < REPEATS; ++i) {
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({ row, 0 }, std::to_string(row + i) + ".5");
+        }
+        seconds += MeasureSeconds([&] {
+            sheet.Recalculate();
+        });
+    }
+    Report("recalculate formulas over text (formulas)", static_cast<std::size_t>(ROWS + 1) * REPEATS, seconds);
+    DoNotOptimize(std::get<double>(sheet.GetCell({ 0, 2 })->GetValue()));
+}
@@ -0,0 +1,139 @@
+// Замеряет публикацию версий таблицы и чтение опубликованных версий: полную
+// сборку первой версии, публикацию после изменения одной ячейки, печать
+// версии и пропускную способность читателей, работающих одновременно с
+// писателем.
+
+#include "../sheet.h"
+#include "../sheet_version.h"
+#include "bench_util.h"
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace {
+
+constexpr int ROWS = 10'000;
+constexpr int COLS = 20;
+constexpr int EDITS = 1'000;
+// Сколько раз каждый читатель просматривает все ячейки версии.
+constexpr int READ_PASSES = 10;
+
+void Fill(Sheet& sheet) {
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS / 2; ++col) {
+            sheet.SetCell({ row, col }, std::to_string(row + col));
+        }
+        for (int col = COLS / 2; col < COLS; ++col) {
+            sheet.SetCell({ row, col }, "=" + Position{ row, col - COLS / 2 }.ToString() + "*2");
+        }
+    }
+}
+
+double SumValues(const SheetVersion& version) {
+    double sum = 0;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = COLS / 2; col < COLS; ++col) {
+            CellInterface::ValueView value = version.GetValueView({ row, col });
+            if (const double* number = std::get_if<double>(&value)) {
+                sum += *number;
+            }
+        }
+    }
+    return sum;
+}
+
+// Читатели просматривают последнюю опубликованную версию, пока писатель
+// меняет ячейки и публикует новые версии.
+void MeasureReaders(Sheet& sheet, int reader_count) {
+    std::atomic<int> running = reader_count;
+    std::vector<double> sums(reader_count);
+    std::vector<std::thread> readers;
+    int edits = 0;
+    double seconds = MeasureSeconds([&] {
+        for (int reader = 0; reader < reader_count; ++reader) {
+            readers.emplace_back([&, reader] {
+                for (int pass = 0; pass < READ_PASSES; ++pass) {
+                    sums[reader] += SumValues(*sheet.GetPublishedVersion());
+                }
+                --running;
+            });
+        }
+        while (running > 0) {
+            sheet.SetCell({ edits % ROWS, 0 }, std::to_string(edits));
+            sheet.PublishVersion();
+            ++edits;
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    });
+    std::size_t reads = static_cast<std::size_t>(reader_count) * READ_PASSES * ROWS * (COLS / 2);
+    Report("GetValueView, " + std::to_string(reader_count) + " readers (cells)", reads, seconds);
+    std::cout << "writer published " << edits << " versions" << std::endl;
+    double total = 0;
+    for (double sum : sums) {
+        total += sum;
+    }
+    DoNotOptimize(total);
+}
+
+}  // namespace
+
+int main() {
+    Sheet sheet;
+    Fill(sheet);
+    sheet.Recalculate();
+
+    double seconds = MeasureSeconds([&] {
+        sheet.PublishVersion();
+    });
+    Report("PublishVersion, all cells (cells)", static_cast<std::size_t>(ROWS) * COLS, seconds);
+
+    seconds = MeasureSeconds([&] {
+        for (int edit = 0; edit < EDITS; ++edit) {
+            sheet.SetCell({ edit * 7 % ROWS, 0 }, std::to_string(edit));
+            sheet.Recalculate();
+        }
+    });
+    Report("SetCell + Recalculate, one cell (edits)", EDITS, seconds);
+
+    seconds = MeasureSeconds([&] {
+        for (int edit = 0; edit < EDITS; ++edit) {
+            sheet.SetCell({ edit * 7 % ROWS, 0 }, std::to_string(edit));
+            sheet.PublishVersion();
+        }
+    });
+    Report("SetCell + PublishVersion, one cell (edits)", EDITS, seconds);
+
+    std::ostringstream printed;
+    seconds = MeasureSeconds([&] {
+        sheet.GetPublishedVersion()->PrintValues(printed);
+    });
+    Report("SheetVersion PrintValues (cells)", static_cast<std::size_t>(ROWS) * COLS, seconds);
+    DoNotOptimize(printed.str().size());
+
+    double sum = 0;
+    seconds = MeasureSeconds([&] {
+        for (int pass = 0; pass < READ_PASSES; ++pass) {
+            for (int row = 0; row < ROWS; ++row) {
+                for (int col = COLS / 2; col < COLS; ++col) {
+                    CellInterface::ValueView value = sheet.GetCell({ row, col })->GetValueView();
+                    if (const double* number = std::get_if<double>(&value)) {
+                        sum += *number;
+                    }
+                }
+            }
+        }
+    });
+    Report("Sheet GetValueView, no writer (cells)", static_cast<std::size_t>(READ_PASSES) * ROWS * (COLS / 2),
+           seconds);
+    DoNotOptimize(sum);
+
+    for (int readers : { 1, 2, 4 }) {
+        MeasureReaders(sheet, readers);
+    }
+}
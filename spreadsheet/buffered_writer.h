@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Накапливает вывод в буфере и передаёт его потоку крупными блоками.
+class BufferedWriter {
+public:
+    static constexpr std::size_t BUFFER_SIZE = 1 << 16;
+
+    explicit BufferedWriter(std::ostream& output) : output_(output) {
+        buffer_.reserve(BUFFER_SIZE);
+    }
+
+    void Put(char c) {
+        buffer_ += c;
+        if (buffer_.size() >= BUFFER_SIZE) {
+            Flush();
+        }
+    }
+
+    void Write(std::string_view text) {
+        buffer_ += text;
+        if (buffer_.size() >= BUFFER_SIZE) {
+            Flush();
+        }
+    }
+
+    void Flush() {
+        output_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+
+private:
+    std::ostream& output_;
+    std::string buffer_;
+};
@@ -1,6 +1,8 @@
 
 #include "cell.h"
+#include "sheet.h"
 
+#include <array>
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -16,30 +18,55 @@ bool IsFormula(const std::string& text) {
 }
 
 
-Cell::Cell(SheetInterface& sheet) : impl_(std::make_unique<EmptyImpl>()), sheet_(sheet) {}
+Cell::Cell(Sheet& sheet, CellId id) : sheet_(sheet), id_(id)
+{
+    sheet_.GetValueStore().Add(id_);
+}
 
 Cell::~Cell() = default;
 
 
 void Cell::Set(const std::string& text)
 {
-    using namespace std::literals;
+    Set(text, ParseText(text));
+}
 
-    if (text.empty())
+void Cell::Set(std::string text, std::unique_ptr<FormulaInterface> formula)
+{
+    CellValueStore& values = sheet_.GetValueStore();
+    if (formula)
     {
-        impl_ = std::make_unique<EmptyImpl>();
+        content_.emplace<FormulaContent>(std::move(formula));
+        values.Set(id_, {}, true);
+        values.Invalidate(id_);
         return;
     }
 
-    if (!IsFormula(text) || IsInvalidFormula(text))
+    if (text.empty())
     {
-        impl_ = std::make_unique<TextImpl>(text);
+        content_.emplace<EmptyContent>();
+        values.Set(id_, {}, false);
         return;
     }
 
+    // Число из текста разбирается один раз при записи: формулы читают ячейку
+    // при каждом пересчёте.
+    values.Set(id_, ParseNumericText(std::string_view(text).substr(text[0] == '\'' ? 1 : 0)), false);
+    content_.emplace<TextContent>(sheet_.GetStringPool(), text);
+}
+
+std::unique_ptr<FormulaInterface> Cell::ParseText(const std::string& text)
+{
+    using namespace std::literals;
+
+    if (!::IsFormula(text) || IsInvalidFormula(text))
+    {
+        return nullptr;
+    }
+
     try
     {
-        impl_ = std::make_unique<FormulaImpl>(sheet_, std::string{ text.begin() + 1, text.end() });
+        return ParseFormula(std::string{ text.begin() + 1, text.end() });
     }
     catch (...)
     {
@@ -50,133 +77,272 @@ void Cell::Set(const std::string& text)
 
 void Cell::Clear()
 {
-    impl_ = std::make_unique<EmptyImpl>();
+    content_.emplace<EmptyContent>();
+    sheet_.GetValueStore().Set(id_, {}, false);
 }
 
-Cell::Value Cell::GetValue() const { return impl_->GetValue(); }
-std::string Cell::GetText() const { return impl_->GetText(); }
+Cell::Value Cell::GetValue() const
+{
+    switch (GetType())
+    {
+    case CellType::TEXT:
+        return std::string(GetTextView());
+    case CellType::FORMULA:
+        UpdateValue(std::get<FormulaContent>(content_));
+        return *GetCachedValue();
+    default:
+        return "";
+    }
+}
 
-std::vector<Position> Cell::GetReferencedCells() const
+NumericValue Cell::GetNumericValue() const
+{
+    if (const auto* formula = std::get_if<FormulaContent>(&content_))
+    {
+        UpdateValue(*formula);
+    }
+    return sheet_.GetValueStore().Get(id_);
+}
+
+std::string Cell::GetText() const
 {
-    if (!dynamic_cast<FormulaImpl*>(impl_.get())) {
-        return {};
+    switch (GetType())
+    {
+    case CellType::TEXT:
+    {
+        const auto& text = std::get<TextContent>(content_);
+        return std::string(text.pool->Get(text.id));
+    }
+    case CellType::FORMULA:
+        return "=" + std::get<FormulaContent>(content_).formula->GetExpression();
+    default:
+        return "";
     }
-    return static_cast<FormulaImpl*>(impl_.get())->GetReferencedCells();
 }
 
+std::vector<Position> Cell::GetReferencedCells() const
+{
+    const auto* formula = std::get_if<FormulaContent>(&content_);
+    return formula ? formula->formula->GetReferencedCells() : std::vector<Position>{};
+}
 
-bool IsDirectCycle(const Cell* ref_cell_ptr, const Position& referenced_cell_pos, const Cell* start_cell_ptr, const Position& end_pos) 
+std::vector<Range> Cell::GetReferencedRanges() const
 {
-    return referenced_cell_pos == end_pos || ref_cell_ptr == start_cell_ptr;
+    const auto* formula = std::get_if<FormulaContent>(&content_);
+    return formula ? formula->formula->GetReferencedRanges() : std::vector<Range>{};
 }
 
-bool Cell::IsCyclicDependent(const Cell* start_cell_ptr, const Position& end_pos) const {
-    for (const auto& referenced_cell_pos : GetReferencedCells()) 
-    {
-        const Cell* ref_cell_ptr = dynamic_cast<const Cell*>(sheet_.GetCell(referenced_cell_pos));
 
-        if (!ref_cell_ptr) 
+Cell::ValueView Cell::GetValueView() const
+{
+    switch (GetType())
+    {
+    case CellType::TEXT:
+        return GetTextView();
+    case CellType::FORMULA:
+    {
+        UpdateValue(std::get<FormulaContent>(content_));
+        NumericValue value = sheet_.GetValueStore().Get(id_);
+        if (value.kind == NumericValue::Kind::Error)
         {
-            sheet_.SetCell(referenced_cell_pos, "");
-            ref_cell_ptr = dynamic_cast<const Cell*>(sheet_.GetCell(referenced_cell_pos));
-            if (!ref_cell_ptr) {
-                continue;
-            }
-        }
-
-        if (IsDirectCycle(ref_cell_ptr, referenced_cell_pos, start_cell_ptr, end_pos) ||
-            ref_cell_ptr->IsCyclicDependent(start_cell_ptr, end_pos)) {
-            return true;
+            return FormulaError(value.error);
         }
+        return value.number;
+    }
+    default:
+        return std::string_view();
     }
-    return false;
 }
 
-void Cell::InvalidateCache()
+CellId Cell::GetId() const
+{
+    return id_;
+}
+
+bool Cell::IsEmpty() const
+{
+    return GetType() == CellType::EMPTY;
+}
+
+bool Cell::IsFormula() const
+{
+    return GetType() == CellType::FORMULA;
+}
+
+void Cell::Recalculate()
 {
-    if (auto* formula_impl = dynamic_cast<FormulaImpl*>(impl_.get()))
+    if (const auto* formula = std::get_if<FormulaContent>(&content_))
     {
-        return formula_impl->InvalidateCache();
+        RecalculateFormula(*formula);
     }
 }
 
-bool Cell::IsCacheValid() const
+void Cell::InvalidateCache()
 {
-    if (auto* formula_impl = dynamic_cast<FormulaImpl*>(impl_.get()))
+    CellValueStore& values = sheet_.GetValueStore();
+    if (IsFormula() && values.IsValid(id_))
     {
-        return formula_impl->IsCacheValid();
+        sheet_.GetCacheStats().invalidations.fetch_add(1, std::memory_order_relaxed);
+        values.Invalidate(id_);
     }
-    return false;
 }
 
-CellType Cell::EmptyImpl::GetType() const
+bool Cell::IsCacheValid() const
 {
-    return CellType::EMPTY;
+    return IsFormula() && sheet_.GetValueStore().IsValid(id_);
 }
 
-CellInterface::Value Cell::EmptyImpl::GetValue() const
+const FormulaInterface* Cell::GetFormula() const
 {
-    return "";
+    const auto* formula = std::get_if<FormulaContent>(&content_);
+    return formula ? formula->formula.get() : nullptr;
 }
 
-std::string Cell::EmptyImpl::GetText() const
+std::optional<Cell::Value> Cell::GetCachedValue() const
 {
-    return "";
+    if (!IsCacheValid())
+    {
+        return std::nullopt;
+    }
+    NumericValue value = sheet_.GetValueStore().Get(id_);
+    if (value.kind == NumericValue::Kind::Error)
+    {
+        return FormulaError(value.error);
+    }
+    return value.number;
 }
 
-CellType Cell::TextImpl::GetType() const
+void Cell::SetCachedValue(Value value)
 {
-    return CellType::TEXT;
+    if (!IsFormula())
+    {
+        return;
+    }
+    if (const auto* error = std::get_if<FormulaError>(&value))
+    {
+        StoreFormulaValue(*error);
+    }
+    else
+    {
+        StoreFormulaValue(std::get<double>(value));
+    }
 }
 
-CellInterface::Value Cell::TextImpl::GetValue() const
+// Порядок видов ячеек совпадает с порядком вариантов content_.
+CellType Cell::GetType() const
 {
-    if (text_[0] == '\'')
-        return text_.substr(1);
-    return text_;
+    return static_cast<CellType>(content_.index());
 }
 
-std::string Cell::TextImpl::GetText() const
+std::string_view Cell::GetTextView() const
 {
-    return text_;
+    const auto& content = std::get<TextContent>(content_);
+    std::string_view text = content.pool->Get(content.id);
+    if (text[0] == '\'')
+        text.remove_prefix(1);
+    return text;
 }
 
-CellType Cell::FormulaImpl::GetType() const
+void Cell::UpdateValue(const FormulaContent& content) const
 {
-    return CellType::FORMULA;
+    if (sheet_.GetValueStore().IsValid(id_))
+    {
+        sheet_.GetCacheStats().hits.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    sheet_.Recalculate();
+    if (!sheet_.GetValueStore().IsValid(id_))
+    {
+        RecalculateFormula(content);
+    }
 }
 
-CellInterface::Value Cell::FormulaImpl::GetValue() const
+// Значения привязанных ячеек читаются прямо из хранилища листа; к ячейке
+// приходится обращаться, только если её значение ещё не вычислено.
+void Cell::RecalculateFormula(const FormulaContent& content) const
 {
-    FormulaInterface::Value eval_result = formula_->Evaluate(sheet_);
-    if (std::holds_alternative<double>(eval_result))
+    sheet_.GetCacheStats().misses.fetch_add(1, std::memory_order_relaxed);
+
+    FormulaInterface::Value eval_result;
+    if (content.bound || Bind(content))
     {
-        double result = std::get<double>(eval_result);
-        if (std::isinf(result))
+        constexpr std::size_t INLINE_VALUES_SIZE = 16;
+        std::array<double, INLINE_VALUES_SIZE> inline_values;
+        std::vector<double> heap_values;
+        double* cell_values = inline_values.data();
+        if (content.bound_count > INLINE_VALUES_SIZE)
         {
-            return FormulaError(FormulaError::Category::Arithmetic);
+            heap_values.resize(content.bound_count);
+            cell_values = heap_values.data();
         }
-        return result;
-    }
-    return std::get<FormulaError>(eval_result);
-}
 
-std::string Cell::FormulaImpl::GetText() const
-{
-    return "=" + formula_->GetExpression();
-}
+        const CellValueStore& values = sheet_.GetValueStore();
+        for (std::size_t i = 0; i < content.bound_count; ++i)
+        {
+            CellId id = content.bound_cells[i];
+            if (id == Sheet::NO_CELL_ID)
+            {
+                cell_values[i] = 0.0;
+                continue;
+            }
+            if (!values.IsPlainValue(id))
+            {
+                sheet_.GetCellById(id).GetNumericValue();
+            }
+            cell_values[i] = values.GetOperand(id);
+        }
+        eval_result = content.formula->Evaluate(sheet_, cell_values);
+    }
+    else
+    {
+        eval_result = content.formula->Evaluate(sheet_);
+    }
 
-std::vector<Position> Cell::FormulaImpl::GetReferencedCells() const
-{
-    return formula_.get()->GetReferencedCells();
+    if (const double* result = std::get_if<double>(&eval_result); result && std::isinf(*result))
+    {
+        eval_result = FormulaError(FormulaError::Category::Arithmetic);
+    }
+    StoreFormulaValue(eval_result);
 }
 
-void Cell::FormulaImpl::InvalidateCache()
+// Пока ячейки формулы не созданы (например, формула ещё не добавлена на
+// лист), привязка не выполняется и формула читает ячейки через лист.
+bool Cell::Bind(const FormulaContent& content) const
 {
-    cached_value_.reset();
+    std::vector<Position> positions = content.formula->GetReferencedCells();
+    auto cells = std::make_unique<CellId[]>(positions.size());
+    for (std::size_t i = 0; i < positions.size(); ++i)
+    {
+        if (!positions[i].IsValid())
+        {
+            cells[i] = Sheet::NO_CELL_ID;
+            continue;
+        }
+        cells[i] = sheet_.FindCellId(positions[i]);
+        if (cells[i] == Sheet::NO_CELL_ID)
+        {
+            return false;
+        }
+    }
+    content.bound_cells = std::move(cells);
+    content.bound_count = static_cast<std::uint32_t>(positions.size());
+    content.bound = true;
+    return true;
 }
 
-bool Cell::FormulaImpl::IsCacheValid() const
+// Формула даёт только числа и ошибки, поэтому её значение хранится так же,
+// как числовое значение текста.
+void Cell::StoreFormulaValue(FormulaInterface::Value value) const
 {
-    return cached_value_.has_value();
+    NumericValue numeric{ NumericValue::Kind::Number };
+    if (const auto* error = std::get_if<FormulaError>(&value))
+    {
+        numeric = { NumericValue::Kind::Error, error->GetCategory() };
+    }
+    else
+    {
+        numeric.number = std::get<double>(value);
+    }
+    sheet_.GetValueStore().Set(id_, numeric, true);
 }
@@ -1,11 +1,27 @@
 #pragma once
 
 #include "common.h"
+#include "dependency_graph.h"
 #include "formula.h"
+#include "string_pool.h"
+#include <atomic>
 #include <optional>
 #include <functional>     
 #include <unordered_set> 
 #include <cmath> 
+#include <cstdint>
+#include <string_view>
+#include <variant>
+
+class Sheet;
+
+// Счётчики обращений к кэшированным значениям формульных ячеек таблицы.
+// Атомарные, так как формулы могут пересчитываться в нескольких потоках.
+struct CacheStats {
+    std::atomic<std::size_t> hits = 0;
+    std::atomic<std::size_t> misses = 0;
+    std::atomic<std::size_t> invalidations = 0;
+};
 
 enum class CellType
 {
@@ -15,68 +31,84 @@ enum class CellType
     ERROR
 };
 
+// Числовые значения ячеек и значения формул хранятся в CellValueStore листа
+// под идентификатором ячейки.
 class Cell : public CellInterface {
 public:
-    Cell(SheetInterface& sheet);
+    Cell(Sheet& sheet, CellId id);
     ~Cell();
 
     void Set(const std::string& text);
+    // То же, что Set, но формула из text уже разобрана функцией ParseText.
+    void Set(std::string text, std::unique_ptr<FormulaInterface> formula);
     void Clear();
 
+    // Разбирает формулу из текста ячейки. Возвращает nullptr, если текст не
+    // формула, и бросает FormulaException, если формула некорректна.
+    static std::unique_ptr<FormulaInterface> ParseText(const std::string& text);
+
     Value GetValue() const override;
     std::string GetText() const override;
+    NumericValue GetNumericValue() const override;
+    ValueView GetValueView() const override;
     std::vector<Position> GetReferencedCells() const;
+    std::vector<Range> GetReferencedRanges() const;
 
-    bool IsCyclicDependent(const Cell* start_cell_ptr, const Position& end_pos) const;
+    CellId GetId() const;
+    bool IsEmpty() const;
+    bool IsFormula() const;
     void InvalidateCache();
     bool IsCacheValid() const;
+    void Recalculate();
+
+    // Формула ячейки или nullptr, если ячейка не формульная.
+    const FormulaInterface* GetFormula() const;
+    // Значение формулы, если оно уже вычислено и не устарело.
+    std::optional<Value> GetCachedValue() const;
+    // Задаёт значение формулы, вычисленное ранее, например при загрузке снимка.
+    void SetCachedValue(Value value);
 
 private:
-    class Impl;
-    std::unique_ptr<Impl> impl_;
-    SheetInterface& sheet_;
-
-    class Impl {
-    public:
-        virtual ~Impl() = default;
-        virtual CellType GetType() const = 0;
-        virtual CellInterface::Value GetValue() const = 0;
-        virtual std::string GetText() const = 0;
-    };
+    // Содержимое ячейки хранится в ней самой, без отдельного объекта в куче:
+    // вид содержимого определяется индексом варианта, а не виртуальными
+    // вызовами.
+    struct EmptyContent {};
+
+    // Текст хранится в общем наборе строк листа: таблицы часто повторяют
+    // одни и те же подписи.
+    struct TextContent {
+        TextContent(StringPool& pool, std::string_view text) : pool(&pool), id(pool.Intern(text)) {}
+        TextContent(const TextContent&) = delete;
+        TextContent& operator=(const TextContent&) = delete;
+        ~TextContent() {
+            pool->Release(id);
+        }
 
-    class EmptyImpl : public Impl {
-    public:
-        EmptyImpl() = default;
-        CellType GetType() const override;
-        CellInterface::Value GetValue() const override;
-        std::string GetText() const override;
+        StringPool* pool;
+        StringPool::Id id;
     };
 
-    class TextImpl : public Impl {
-    public:
-        explicit TextImpl(std::string text) : text_(text) {}
-        CellType GetType() const override;
-        CellInterface::Value GetValue() const override;
-        std::string GetText() const override;
+    // Ячейки формулы на листе находятся при первом вычислении. Лист создаёт
+    // ячейки, на которые ссылается формула, и не удаляет их, пока она на них
+    // ссылается, поэтому найденные идентификаторы не устаревают.
+    struct FormulaContent {
+        explicit FormulaContent(std::unique_ptr<FormulaInterface> formula) : formula(std::move(formula)) {}
 
-    private:
-        std::string text_;
+        std::unique_ptr<FormulaInterface> formula;
+        mutable std::unique_ptr<CellId[]> bound_cells;
+        mutable std::uint32_t bound_count = 0;
+        mutable bool bound = false;
     };
 
-    class FormulaImpl : public Impl
-    {
-    public:
-        FormulaImpl(SheetInterface& sheet, std::string formula) : sheet_(sheet), formula_(ParseFormula(formula)) {}
-        CellType GetType() const override;
-        CellInterface::Value GetValue() const override;
-        std::string GetText() const override;
-        std::vector<Position> GetReferencedCells() const;
-        void InvalidateCache();
-        bool IsCacheValid() const;
-
-    private:
-        SheetInterface& sheet_;
-        std::unique_ptr<FormulaInterface> formula_;
-        std::optional<CellInterface::Value> cached_value_;
-    };
+    CellType GetType() const;
+    std::string_view GetTextView() const;
+    // Вычисляет значение формулы, если оно устарело.
+    void UpdateValue(const FormulaContent& content) const;
+    void RecalculateFormula(const FormulaContent& content) const;
+    bool Bind(const FormulaContent& content) const;
+    void StoreFormulaValue(FormulaInterface::Value value) const;
+
+    Sheet& sheet_;
+    CellId id_;
+    std::variant<EmptyContent, TextContent, FormulaContent> content_;
 };
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "dependency_graph.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Множество идентификаторов ячеек в виде битовой карты. Память
+// пропорциональна наибольшему идентификатору, поэтому карту стоит заводить
+// один раз и очищать поэлементно.
+class CellIdBitmap {
+public:
+    // Возвращает false, если идентификатор уже в множестве.
+    bool Insert(CellId id) {
+        std::size_t word = id / 64;
+        if (word >= words_.size()) {
+            words_.resize(word + 1);
+        }
+        std::uint64_t bit = std::uint64_t(1) << (id % 64);
+        if (words_[word] & bit) {
+            return false;
+        }
+        words_[word] |= bit;
+        return true;
+    }
+
+    bool Contains(CellId id) const {
+        std::size_t word = id / 64;
+        return word < words_.size() && (words_[word] >> (id % 64) & 1);
+    }
+
+    void Erase(CellId id) {
+        if (std::size_t word = id / 64; word < words_.size()) {
+            words_[word] &= ~(std::uint64_t(1) << (id % 64));
+        }
+    }
+
+private:
+    std::vector<std::uint64_t> words_;
+};
+
+// Множество идентификаторов ячеек с номерами элементов: элементы лежат
+// подряд, а номер элемента по идентификатору находится обращением к массиву.
+// Вставка и удаление — за O(1), очистка — за число элементов.
+class IndexedCellIdSet {
+public:
+    static constexpr std::uint32_t NO_INDEX = UINT32_MAX;
+
+    // Возвращает false, если идентификатор уже в множестве.
+    bool Insert(CellId id) {
+        if (id >= indices_.size()) {
+            indices_.resize(id + 1, NO_INDEX);
+        }
+        if (indices_[id] != NO_INDEX) {
+            return false;
+        }
+        indices_[id] = static_cast<std::uint32_t>(ids_.size());
+        ids_.push_back(id);
+        return true;
+    }
+
+    // Номер элемента или NO_INDEX, если идентификатора нет в множестве.
+    std::uint32_t IndexOf(CellId id) const {
+        return id < indices_.size() ? indices_[id] : NO_INDEX;
+    }
+
+    bool Contains(CellId id) const {
+        return IndexOf(id) != NO_INDEX;
+    }
+
+    // Последний элемент занимает место удалённого.
+    void Erase(CellId id) {
+        std::uint32_t index = IndexOf(id);
+        if (index == NO_INDEX) {
+            return;
+        }
+        indices_[ids_.back()] = index;
+        ids_[index] = ids_.back();
+        ids_.pop_back();
+        indices_[id] = NO_INDEX;
+    }
+
+    void Clear() {
+        for (CellId id : ids_) {
+            indices_[id] = NO_INDEX;
+        }
+        ids_.clear();
+    }
+
+    std::size_t Size() const {
+        return ids_.size();
+    }
+
+    bool Empty() const {
+        return ids_.empty();
+    }
+
+    void Reserve(std::size_t size) {
+        ids_.reserve(size);
+    }
+
+    std::vector<CellId>::const_iterator begin() const {
+        return ids_.begin();
+    }
+
+    std::vector<CellId>::const_iterator end() const {
+        return ids_.end();
+    }
+
+private:
+    std::vector<CellId> ids_;
+    std::vector<std::uint32_t> indices_;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "FormulaAST.h"
+#include "common.h"
+#include "dependency_graph.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Значения ячеек листа в роли чисел (см. NumericValue), хранимые столбцами и
+// индексируемые идентификатором ячейки: операнд формулы в массиве double и
+// байт признаков в отдельном массиве. На ячейку приходится девять байт, а
+// формулы читают значения ячеек из плотной памяти. Текст ячеек хранится в
+// самих ячейках.
+//
+// Разные ячейки можно записывать из разных потоков, если массивы при этом не
+// растут.
+class CellValueStore {
+public:
+    // Ячейка с идентификатором id получает пустое значение.
+    void Add(CellId id) {
+        if (id >= operands_.size()) {
+            operands_.resize(id + 1);
+            tags_.resize(id + 1);
+        }
+        Set(id, {}, false);
+    }
+
+    void Set(CellId id, const NumericValue& value, bool formula) {
+        operands_[id] = GetOperandValue(value);
+        tags_[id] = static_cast<std::uint8_t>(static_cast<std::uint8_t>(value.kind)
+                                              | static_cast<std::uint8_t>(value.error) << CATEGORY_SHIFT
+                                              | (formula ? FORMULA : 0));
+    }
+
+    // Значение формулы устарело.
+    void Invalidate(CellId id) {
+        tags_[id] |= STALE;
+    }
+
+    bool IsValid(CellId id) const {
+        return !(tags_[id] & STALE);
+    }
+
+    // Актуальное значение ячейки, не являющейся формулой: такие значения
+    // можно читать, не учитывая обращение к кэшу формул.
+    bool IsPlainValue(CellId id) const {
+        return !(tags_[id] & (STALE | FORMULA));
+    }
+
+    NumericValue Get(CellId id) const {
+        std::uint8_t tag = tags_[id];
+        auto kind = static_cast<NumericValue::Kind>(tag & KIND_MASK);
+        auto error = static_cast<FormulaError::Category>(tag >> CATEGORY_SHIFT);
+        return { kind, error, kind == NumericValue::Kind::Number ? operands_[id] : 0.0 };
+    }
+
+    // Значение в роли операнда формулы, см. GetOperandValue.
+    double GetOperand(CellId id) const {
+        return operands_[id];
+    }
+
+    std::size_t GetMemoryUsage() const {
+        return operands_.capacity() * sizeof(double) + tags_.capacity();
+    }
+
+private:
+    // Байт признаков: вид значения в младших битах, признаки формулы и
+    // устаревшего значения, в старших битах — категория ошибки.
+    static constexpr std::uint8_t KIND_MASK = 0x3;
+    static constexpr std::uint8_t FORMULA = 0x4;
+    static constexpr std::uint8_t STALE = 0x8;
+    static constexpr int CATEGORY_SHIFT = 4;
+
+    std::vector<double> operands_;
+    std::vector<std::uint8_t> tags_;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
@@ -36,6 +38,23 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Прямоугольный диапазон ячеек, например A1:B3. Включает обе угловые ячейки;
+// from — левый верхний угол, to — правый нижний.
+struct Range {
+    Position from;
+    Position to;
+
+    bool operator==(const Range& rhs) const;
+    bool operator<(const Range& rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    std::string ToString() const;
+
+    // Диапазон между двумя любыми противоположными углами.
+    static Range FromCorners(Position first, Position second);
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
 public:
@@ -84,6 +103,32 @@ private:
 
 std::ostream& operator<<(std::ostream& output, FormulaError fe);
 
+// Значение ячейки, прочитанное формулой как число. Формула, ссылающаяся на
+// ячейку, получает ноль для Blank, number для Number и ошибку error для Text и
+// Error; агрегатные функции учитывают в диапазоне только Number и
+// останавливаются на Error.
+struct NumericValue {
+    enum class Kind : std::uint8_t {
+        // Пустая ячейка или пустой текст.
+        Blank,
+        Number,
+        // Текст, не записывающий конечное число.
+        Text,
+        // Ошибка вычисления формулы.
+        Error,
+    };
+
+    Kind kind = Kind::Blank;
+    FormulaError::Category error = FormulaError::Category::Value;
+    double number = 0;
+};
+
+// Числовое значение текста ячейки (без экранирующего апострофа). Текст должен
+// целиком записывать число в формате std::strtod; бесконечность и NaN дают
+// ошибку #ARITHM!, прочий текст — #VALUE!. Обычная десятичная запись
+// разбирается std::from_chars без выделения памяти.
+NumericValue ParseNumericText(std::string_view text);
+
 // Исключение, выбрасываемое при попытке передать в метод некорректную позицию
 class InvalidPositionException : public std::out_of_range {
 public:
@@ -109,6 +154,8 @@ public:
     // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
     // формулы
     using Value = std::variant<std::string, double, FormulaError>;
+    // То же без копии текста.
+    using ValueView = std::variant<std::string_view, double, FormulaError>;
 
     virtual ~CellInterface() = default;
 
@@ -125,6 +172,18 @@ public:
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает значение ячейки в роли числа. Реализация по умолчанию
+    // разбирает GetValue(); ячейки листа хранят числовое значение текста и
+    // не выделяют память.
+    virtual NumericValue GetNumericValue() const;
+
+    // Возвращает видимое значение ячейки, как GetValue(), но не копирует
+    // текст: строка действительна, пока ячейка не изменена. Реализация по
+    // умолчанию сохраняет текст из GetValue() в буфере потока, и строка
+    // действительна до следующего вызова в том же потоке; ячейки листа
+    // возвращают текст, не выделяя память.
+    virtual ValueView GetValueView() const;
 };
 
 // Интерфейс таблицы
@@ -168,6 +227,12 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Вызывает func для каждой существующей ячейки диапазона в порядке строк,
+    // пока func возвращает true. Реализация по умолчанию проверяет все
+    // позиции диапазона через GetCell().
+    virtual void ForEachCellInRange(const Range& range,
+                                    const std::function<bool(Position, const CellInterface&)>& func) const;
 };
 
 // Создаёт готовую к работе пустую таблицу.
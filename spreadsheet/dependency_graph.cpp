@@ -0,0 +1,68 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+
+// Ячейки обычно добавляются по возрастанию, и тогда вставка сводится к
+// добавлению в конец.
+bool DependentList::Insert(CellId id) {
+    CellId* data = Data();
+    CellId* it = size_ > 0 && data[size_ - 1] < id ? data + size_ : std::lower_bound(data, data + size_, id);
+    if (it != data + size_ && *it == id) {
+        return false;
+    }
+
+    if (size_ == capacity_) {
+        std::uint32_t new_capacity = capacity_ * 2;
+        CellId* new_data = new CellId[new_capacity];
+        std::size_t index = it - data;
+        std::copy(data, data + index, new_data);
+        new_data[index] = id;
+        std::copy(data + index, data + size_, new_data + index + 1);
+        Release();
+        heap_ = new_data;
+        capacity_ = new_capacity;
+    }
+    else {
+        std::copy_backward(it, data + size_, data + size_ + 1);
+        *it = id;
+    }
+    ++size_;
+    return true;
+}
+
+bool DependentList::Erase(CellId id) {
+    CellId* data = Data();
+    CellId* it = std::lower_bound(data, data + size_, id);
+    if (it == data + size_ || *it != id) {
+        return false;
+    }
+    std::copy(it + 1, data + size_, it);
+    if (--size_ == 0) {
+        Release();
+    }
+    return true;
+}
+
+void DependencyGraph::AddEdge(CellId cell, CellId dependent) {
+    if (cell >= dependents_.size()) {
+        dependents_.resize(cell + 1);
+    }
+    DependentList& dependents = dependents_[cell];
+    std::size_t heap_size = dependents.GetHeapSize();
+    if (dependents.Insert(dependent)) {
+        ++edge_count_;
+        heap_size_ += dependents.GetHeapSize() - heap_size;
+    }
+}
+
+void DependencyGraph::RemoveEdge(CellId cell, CellId dependent) {
+    if (cell >= dependents_.size()) {
+        return;
+    }
+    DependentList& dependents = dependents_[cell];
+    std::size_t heap_size = dependents.GetHeapSize();
+    if (dependents.Erase(dependent)) {
+        --edge_count_;
+        heap_size_ -= heap_size - dependents.GetHeapSize();
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Плотный идентификатор ячейки листа — номер её слота в TiledGrid<Cell>.
+// Позиции нужны только на границе API, внутри лист адресует ячейки им.
+using CellId = std::uint32_t;
+
+// Ячейки, зависящие от одной ячейки, по возрастанию идентификаторов и без
+// повторов. Первые INLINE_CAPACITY ячеек хранятся в самом объекте: у
+// большинства ячеек всего один-два зависимых, и для них память не выделяется.
+class DependentList {
+public:
+    static constexpr std::uint32_t INLINE_CAPACITY = 2;
+
+    DependentList() : inline_{} {
+    }
+
+    DependentList(DependentList&& other) noexcept : size_(other.size_), capacity_(other.capacity_), inline_{} {
+        if (capacity_ > INLINE_CAPACITY) {
+            heap_ = other.heap_;
+        }
+        else {
+            inline_[0] = other.inline_[0];
+            inline_[1] = other.inline_[1];
+        }
+        other.size_ = 0;
+        other.capacity_ = INLINE_CAPACITY;
+    }
+
+    DependentList(const DependentList&) = delete;
+    DependentList& operator=(const DependentList&) = delete;
+    DependentList& operator=(DependentList&&) = delete;
+
+    ~DependentList() {
+        Release();
+    }
+
+    const CellId* begin() const {
+        return Data();
+    }
+
+    const CellId* end() const {
+        return Data() + size_;
+    }
+
+    std::uint32_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Память, выделенная под список вне объекта.
+    std::size_t GetHeapSize() const {
+        return capacity_ > INLINE_CAPACITY ? capacity_ * sizeof(CellId) : 0;
+    }
+
+    // Возвращают false, если ячейка уже есть (нет) в списке. Опустевший
+    // список освобождает выделенную память.
+    bool Insert(CellId id);
+    bool Erase(CellId id);
+
+private:
+    CellId* Data() {
+        return capacity_ > INLINE_CAPACITY ? heap_ : inline_;
+    }
+
+    const CellId* Data() const {
+        return capacity_ > INLINE_CAPACITY ? heap_ : inline_;
+    }
+
+    void Release() {
+        if (capacity_ > INLINE_CAPACITY) {
+            delete[] heap_;
+            capacity_ = INLINE_CAPACITY;
+        }
+    }
+
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = INLINE_CAPACITY;
+    union {
+        CellId inline_[INLINE_CAPACITY];
+        CellId* heap_;
+    };
+};
+
+// Обратные рёбра графа зависимостей: для каждой ячейки — формулы, которые на
+// неё ссылаются. Списки лежат в массиве, индексируемом идентификатором
+// ячейки, поэтому поиск — одно обращение по индексу, а обход зависимых читает
+// подряд лежащий массив.
+class DependencyGraph {
+public:
+    // Ячейка dependent ссылается на ячейку cell.
+    void AddEdge(CellId cell, CellId dependent);
+    void RemoveEdge(CellId cell, CellId dependent);
+
+    bool HasDependents(CellId cell) const {
+        return cell < dependents_.size() && !dependents_[cell].Empty();
+    }
+
+    // Вызывает func(CellId) для каждой ячейки, зависящей от cell, по
+    // возрастанию идентификаторов.
+    template <typename Func>
+    void ForEachDependent(CellId cell, Func&& func) const {
+        if (cell < dependents_.size()) {
+            for (CellId dependent : dependents_[cell]) {
+                func(dependent);
+            }
+        }
+    }
+
+    // Вызывает func(CellId cell, CellId dependent) для всех рёбер по
+    // возрастанию пар идентификаторов.
+    template <typename Func>
+    void ForEachEdge(Func&& func) const {
+        for (CellId cell = 0; cell < dependents_.size(); ++cell) {
+            for (CellId dependent : dependents_[cell]) {
+                func(cell, dependent);
+            }
+        }
+    }
+
+    std::size_t GetEdgeCount() const {
+        return edge_count_;
+    }
+
+    // Память графа в байтах: массив списков и списки, вынесенные из него.
+    std::size_t GetMemoryUsage() const {
+        return sizeof(DependencyGraph) + dependents_.capacity() * sizeof(DependentList) + heap_size_;
+    }
+
+private:
+    std::vector<DependentList> dependents_;
+    std::size_t edge_count_ = 0;
+    std::size_t heap_size_ = 0;
+};
@@ -5,8 +5,8 @@
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cstdlib>
 #include <sstream>
-#include <set>
 #include <cmath>
 
 using namespace std::literals;
@@ -16,67 +16,71 @@ std::ostream& operator<<(std::ostream& output, FormulaError fe)
     return output << fe.ToString();
 }
 
-double ParseStringToDouble(const std::string& str) {
-    try {
-        size_t pos;
-        double result = std::stod(str, &pos);
-        
-        if (pos != str.size()) {
-            throw FormulaError(FormulaError::Category::Value);
-        }
-        if (std::isinf(result) || std::isnan(result)) {
-            throw FormulaError(FormulaError::Category::Arithmetic);
-        }
-        
-        return result;
-    } catch (const std::invalid_argument&) {
-        throw FormulaError(FormulaError::Category::Value);
-    } catch (const std::out_of_range&) {
-        throw FormulaError(FormulaError::Category::Value);
-    }
-}
-
 double GetCellValueAsDouble(const CellInterface* cell) {
-    auto value = cell->GetValue();
+    return GetOperandValue(cell->GetNumericValue());
+}
 
-    if (std::holds_alternative<double>(value)) {
-        return std::get<double>(value);
+// Добавляет в values значение ячейки диапазона. В диапазоне учитываются только
+// числа: пустые ячейки и текст, не являющийся числом, пропускаются. Для ячейки
+// с ошибкой добавляет значение ошибки и возвращает false.
+bool AppendRangeValue(const CellInterface& cell, std::vector<double>& values) {
+    NumericValue value = cell.GetNumericValue();
+    if (value.kind == NumericValue::Kind::Number) {
+        values.push_back(value.number);
     }
-    if (std::holds_alternative<FormulaError>(value)) {
-        throw std::get<FormulaError>(value);
+    else if (value.kind == NumericValue::Kind::Error) {
+        values.push_back(MakeErrorValue(value.error));
+        return false;
     }
-    if (std::holds_alternative<std::string>(value)) {
-        return ParseStringToDouble(std::get<std::string>(value));
+    return true;
+}
+
+// Обход останавливается на первой ячейке с ошибкой: она последняя в values, а
+// остальные ячейки диапазона не читаются.
+void AppendRangeValues(const SheetInterface& sheet, const Range& range, std::vector<double>& values) {
+    sheet.ForEachCellInRange(range, [&values](Position, const CellInterface& cell) {
+        return AppendRangeValue(cell, values);
+    });
+}
+
+FormulaInterface::Value ToFormulaValue(double value) {
+    if (IsErrorValue(value)) {
+        return FormulaError(GetErrorCategory(value));
     }
-    
-    return 0.0;
+    return value;
 }
 
 namespace {
     class Formula : public FormulaInterface {
     public:
         explicit Formula(std::string expression)
-            : ast_(ParseFormulaAST(std::move(expression))),
-            referenced_cells_(ast_.GetCells().begin(), ast_.GetCells().end()){}
+            : ast_(ParseFormulaAST(std::move(expression))) {}
+
+        explicit Formula(FormulaAST ast)
+            : ast_(std::move(ast)) {}
 
         Value Evaluate(const SheetInterface& sheet) const override {
-            try {
-                return ast_.Execute([this, &sheet](const Position& pos) 
-                    {  
-                    const CellInterface* cell = sheet.GetCell(pos);
-
-                    if (!cell || (std::holds_alternative<std::string>(cell->GetValue()) &&
-                        std::get<std::string>(cell->GetValue()).empty())) {
-                        return 0.0;
-                    }
-
-                    return GetCellValueAsDouble(cell);
-                    });
-            }
-            catch (const FormulaError& ex_fe) {
-                return ex_fe;
-            }
+            return ToFormulaValue(ast_.Execute([this, &sheet](const Position& pos) 
+                {  
+                const CellInterface* cell = sheet.GetCell(pos);
+
+                if (!cell) {
+                    return 0.0;
+                }
+
+                return GetCellValueAsDouble(cell);
+                },
+                [&sheet](const Range& range, std::vector<double>& values) {
+                    AppendRangeValues(sheet, range, values);
+                }));
         }
+
+        Value Evaluate(const SheetInterface& sheet, const double* cell_values) const override {
+            return ToFormulaValue(ast_.Execute(cell_values, [&sheet](const Range& range, std::vector<double>& range_values) {
+                AppendRangeValues(sheet, range, range_values);
+            }));
+        }
+
         std::string GetExpression() const override
         {
             std::stringstream ss;
@@ -86,17 +90,25 @@ namespace {
 
         std::vector<Position> GetReferencedCells() const override
         {
-            std::vector<Position> result;
-            std::set<Position> unique_ref_cells(referenced_cells_.begin(), referenced_cells_.end());
-            for (const auto& cell : unique_ref_cells)
-            {
-                result.push_back(cell);
-            }
-            return result;
+            return { ast_.GetCells().begin(), ast_.GetCells().end() };
+        }
+
+        std::vector<Range> GetReferencedRanges() const override
+        {
+            return { ast_.GetRanges().begin(), ast_.GetRanges().end() };
+        }
+
+        std::size_t GetMemoryUsage() const override
+        {
+            return sizeof(Formula) - sizeof(FormulaAST) + ast_.GetMemoryUsage();
+        }
+
+        const FormulaAST& GetAST() const override
+        {
+            return ast_;
         }
     private:
         FormulaAST ast_;
-        std::vector<Position> referenced_cells_;
     };
 }  // namespace
 
@@ -110,3 +122,7 @@ std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
         throw FormulaException("Formula parse error");
     }
 }
+
+std::unique_ptr<FormulaInterface> MakeFormula(FormulaAST ast) {
+    return std::make_unique<Formula>(std::move(ast));
+}
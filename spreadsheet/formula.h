@@ -5,10 +5,14 @@
 #include <memory>
 #include <vector>
 
+class FormulaAST;
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Агрегатные функции от чисел и диапазонов: SUM(A1:B3,C1), MIN, MAX,
+//   AVERAGE, COUNT
 // Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
@@ -26,6 +30,12 @@ public:
     // любая.
     virtual Value Evaluate(const SheetInterface& sheet) const = 0;
 
+    // То же, но значения ячеек формулы уже прочитаны: cell_values[i] —
+    // значение ячейки GetReferencedCells()[i] в роли операнда (см.
+    // GetOperandValue), для некорректной позиции — любое число. Из sheet
+    // читаются только диапазоны.
+    virtual Value Evaluate(const SheetInterface& sheet, const double* cell_values) const = 0;
+
     // Возвращает выражение, которое описывает формулу.
     // Не содержит пробелов и лишних скобок.
     virtual std::string GetExpression() const = 0;
@@ -34,8 +44,22 @@ public:
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает диапазоны из аргументов функций по возрастанию, без повторов.
+    // Ячейки диапазонов в GetReferencedCells() не входят.
+    virtual std::vector<Range> GetReferencedRanges() const = 0;
+
+    // Возвращает объём памяти, занимаемой формулой, в байтах: сам объект,
+    // узлы дерева, байт-код и список ячеек.
+    virtual std::size_t GetMemoryUsage() const = 0;
+
+    // Разобранное выражение формулы вместе с байт-кодом.
+    virtual const FormulaAST& GetAST() const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Создаёт формулу из уже разобранного выражения.
+std::unique_ptr<FormulaInterface> MakeFormula(FormulaAST ast);
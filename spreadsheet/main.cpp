@@ -1,8 +1,54 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
 
+#include "FormulaAST.h"
+#include "cell_id_set.h"
+#include "cell_value_store.h"
 #include "common.h"
+#include "dependency_graph.h"
 #include "formula.h"
+#include "sheet.h"
+#include "sheet_io.h"
+#include "sheet_version.h"
+#include "snapshot.h"
+#include "string_pool.h"
+#include "range_index.h"
 #include "test_runner_p.h"
+#include "thread_pool.h"
+#include "tiled_grid.h"
+
+namespace {
+    // Пока флаг установлен, выделение памяти в этом потоке завершается
+    // std::bad_alloc.
+    thread_local bool fail_allocations = false;
+}  // namespace
+
+void* operator new(std::size_t size) {
+    if (!fail_allocations) {
+        if (void* memory = std::malloc(size > 0 ? size : 1)) {
+            return memory;
+        }
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -12,6 +58,10 @@ inline Position operator"" _pos(const char* str, std::size_t) {
     return Position::FromString(str);
 }
 
+inline std::ostream& operator<<(std::ostream& output, const Range& range) {
+    return output << range.ToString();
+}
+
 inline std::ostream& operator<<(std::ostream& output, Size size) {
     return output << "(" << size.rows << ", " << size.cols << ")";
 }
@@ -346,6 +396,1614 @@ void TestCellCircularReferences() {
     ASSERT(caught);
     ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
 }
+
+void TestFormulaValueCache() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "=A1+A1");
+    sheet.SetCell("A3"_pos, "=A2+A2");
+    sheet.ResetCacheStats();
+
+    // Формула читает каждую свою ячейку один раз, даже если ссылается на неё
+    // несколько раз.
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet.GetCacheStats().misses, 2u);
+    ASSERT_EQUAL(sheet.GetCacheStats().hits, 1u);
+
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet.GetCacheStats().misses, 2u);
+    ASSERT_EQUAL(sheet.GetCacheStats().hits, 2u);
+
+    sheet.SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(sheet.GetCacheStats().invalidations, 2u);
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(8.0));
+
+    sheet.SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(12.0));
+
+    sheet.ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value(0.0));
+}
+
+void TestFormulaBinding() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1*A1+C1");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+    // Привязанные ячейки меняют содержимое, очищаются и заполняются снова.
+    sheet.SetCell("C1"_pos, "=A1+1");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(7.0));
+    sheet.ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(1.0));
+    sheet.SetCell("A1"_pos, "'3");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(13.0));
+    sheet.SetCell("A1"_pos, "x");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    sheet.SetCell("C1"_pos, "=1/0");
+    sheet.SetCell("A1"_pos, "1");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // Формула с числом ячеек больше встроенного массива значений.
+    std::string expression = "=A1";
+    for (int row = 1; row < 40; ++row) {
+        sheet.SetCell(Position{ row, 0 }, std::to_string(row + 1));
+        expression += "+" + Position{ row, 0 }.ToString();
+    }
+    sheet.SetCell("D1"_pos, expression);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(820.0));
+    sheet.SetCell("A40"_pos, "=A39");
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(819.0));
+
+    // Значения по найденным ячейкам совпадают с вычислением через лист.
+    auto evaluate_bound = [&sheet](const FormulaInterface& formula) {
+        std::vector<double> values;
+        for (const auto& pos : formula.GetReferencedCells()) {
+            const CellInterface* cell = sheet.GetCell(pos);
+            values.push_back(cell ? GetOperandValue(cell->GetNumericValue()) : 0.0);
+        }
+        return formula.Evaluate(sheet, values.data());
+    };
+    auto formula = ParseFormula("A1+A2*C1");
+    ASSERT(evaluate_bound(*formula) == formula->Evaluate(sheet));
+    formula = ParseFormula("A2/A1+SUM(A1:A3)+Z9");
+    ASSERT(evaluate_bound(*formula) == FormulaInterface::Value(8.0));
+}
+
+void TestTextNumericValue() {
+    using Kind = NumericValue::Kind;
+    auto check = [](std::string_view text, Kind kind, double number = 0,
+                    FormulaError::Category error = FormulaError::Category::Value) {
+        NumericValue value = ParseNumericText(text);
+        ASSERT(value.kind == kind);
+        if (kind == Kind::Number) {
+            ASSERT_EQUAL(value.number, number);
+        }
+        else if (kind == Kind::Text) {
+            ASSERT(value.error == error);
+        }
+    };
+    check("", Kind::Blank);
+    check("12.5", Kind::Number, 12.5);
+    check("-1e5", Kind::Number, -1e5);
+    check(" 5", Kind::Number, 5);
+    check("+3", Kind::Number, 3);
+    check("0x10", Kind::Number, 16);
+    check("abc", Kind::Text);
+    check("5 ", Kind::Text);
+    check("1e400", Kind::Text);
+    check("inf", Kind::Text, 0, FormulaError::Category::Arithmetic);
+    check("nan", Kind::Text, 0, FormulaError::Category::Arithmetic);
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "'7");
+    sheet.SetCell("A2"_pos, "abc");
+    sheet.SetCell("A3"_pos, "-inf");
+    sheet.SetCell("A4"_pos, "=A1*2");
+    ASSERT(sheet.GetCell("A1"_pos)->GetNumericValue().number == 7.0);
+    ASSERT(sheet.GetCell("A4"_pos)->GetNumericValue().number == 14.0);
+    sheet.SetCell("B1"_pos, "=A2");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT(sheet.GetCell("B1"_pos)->GetNumericValue().kind == Kind::Error);
+    sheet.SetCell("B2"_pos, "=A3");
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // Диапазон пропускает текст, не записывающий конечное число.
+    sheet.SetCell("B3"_pos, "=SUM(A1:A4)");
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(21.0));
+    sheet.SetCell("A2"_pos, "1");
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(22.0));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(1.0));
+}
+
+void TestCellValueStore() {
+    using Kind = NumericValue::Kind;
+    CellValueStore store;
+    store.Add(2);
+    store.Add(0);
+    ASSERT(store.Get(2).kind == Kind::Blank);
+    ASSERT(store.IsPlainValue(2));
+    ASSERT_EQUAL(store.GetOperand(2), 0.0);
+
+    store.Set(0, { Kind::Number, FormulaError::Category::Value, 2.5 }, false);
+    ASSERT(store.Get(0).kind == Kind::Number);
+    ASSERT_EQUAL(store.Get(0).number, 2.5);
+    store.Set(2, { Kind::Text, FormulaError::Category::Arithmetic }, false);
+    ASSERT(store.Get(2).kind == Kind::Text);
+    ASSERT(store.Get(2).error == FormulaError::Category::Arithmetic);
+    ASSERT(GetErrorCategory(store.GetOperand(2)) == FormulaError::Category::Arithmetic);
+
+    // Значение формулы устаревает и вычисляется заново.
+    store.Set(1, { Kind::Error, FormulaError::Category::Ref }, true);
+    ASSERT(store.IsValid(1) && !store.IsPlainValue(1));
+    store.Invalidate(1);
+    ASSERT(!store.IsValid(1));
+    store.Set(1, { Kind::Number, FormulaError::Category::Value, -1 }, true);
+    ASSERT(store.IsValid(1));
+    ASSERT_EQUAL(store.GetOperand(1), -1.0);
+    ASSERT(store.GetMemoryUsage() >= 3 * (sizeof(double) + 1));
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1+1");
+    sheet.SetCell("B1"_pos, "'4");
+    const CellValueStore& values = sheet.GetValueStore();
+    CellId a1 = sheet.FindCellId("A1"_pos);
+    CellId b1 = sheet.FindCellId("B1"_pos);
+    ASSERT_EQUAL(sheet.FindCellId("C1"_pos), Sheet::NO_CELL_ID);
+    ASSERT(!values.IsValid(a1));
+    ASSERT_EQUAL(values.GetOperand(b1), 4.0);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(5.0));
+    ASSERT(values.IsValid(a1));
+    ASSERT_EQUAL(values.GetOperand(a1), 5.0);
+    sheet.ClearCell("B1"_pos);
+    ASSERT(values.Get(b1).kind == Kind::Blank);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(1.0));
+}
+
+void TestStringPool() {
+    StringPool pool;
+    StringPool::Id usd = pool.Intern("USD");
+    ASSERT_EQUAL(pool.Intern(std::string("US") + "D"), usd);
+    std::string long_label(100, 'x');
+    StringPool::Id label = pool.Intern(long_label);
+    const char* data = pool.Get(label).data();
+    ASSERT_EQUAL(pool.Size(), 2u);
+
+    // Строка удаляется, когда снята последняя ссылка; прочие строки остаются
+    // на месте.
+    pool.Release(usd);
+    ASSERT_EQUAL(pool.Get(usd), std::string_view("USD"));
+    pool.Release(usd);
+    ASSERT_EQUAL(pool.Size(), 1u);
+    ASSERT_EQUAL(pool.Intern("EUR"), usd);
+    for (int i = 0; i < 1000; ++i) {
+        pool.Intern(std::to_string(i));
+    }
+    ASSERT_EQUAL(pool.Get(label).data(), data);
+    ASSERT_EQUAL(pool.Get(label), std::string_view(long_label));
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "PENDING");
+    sheet.SetCell("A2"_pos, "'PENDING");
+    sheet.SetCell("A3"_pos, "PENDING");
+    ASSERT_EQUAL(sheet.GetStringPool().Size(), 2u);
+    const Cell* a2 = &sheet.GetCellById(sheet.FindCellId("A2"_pos));
+    ASSERT(a2->GetValueView() == CellInterface::ValueView(std::string_view("PENDING")));
+    ASSERT_EQUAL(a2->GetText(), "'PENDING");
+    ASSERT_EQUAL(a2->GetValue(), CellInterface::Value(std::string("PENDING")));
+    sheet.SetCell("A1"_pos, "=1");
+    sheet.ClearCell("A3"_pos);
+    ASSERT_EQUAL(sheet.GetStringPool().Size(), 1u);
+}
+
+void TestValueView() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "'=text");
+    sheet.SetCell("A2"_pos, "=B1/2");
+    sheet.SetCell("A3"_pos, "=1/0");
+    sheet.SetCell("B1"_pos, "5");
+    using View = CellInterface::ValueView;
+    std::string_view text = std::get<std::string_view>(sheet.GetCell("A1"_pos)->GetValueView());
+    ASSERT_EQUAL(text, std::string_view("=text"));
+    ASSERT(sheet.GetCell("A2"_pos)->GetValueView() == View(2.5));
+    ASSERT(sheet.GetCell("A3"_pos)->GetValueView() == View(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT(sheet.GetCell("A4"_pos) == nullptr);
+    sheet.SetCell("C1"_pos, "=A4");
+    ASSERT(sheet.GetCell("A4"_pos)->GetValueView() == View(std::string_view()));
+
+    // Текст не копируется: строка принадлежит листу.
+    ASSERT_EQUAL(std::get<std::string_view>(sheet.GetCell("A1"_pos)->GetValueView()).data(), text.data());
+
+    // Реализация по умолчанию для ячеек, определяющих только GetValue().
+    class ValueCell : public CellInterface {
+    public:
+        explicit ValueCell(Value value) : value_(std::move(value)) {}
+        Value GetValue() const override {
+            return value_;
+        }
+        std::string GetText() const override {
+            return {};
+        }
+        std::vector<Position> GetReferencedCells() const override {
+            return {};
+        }
+
+    private:
+        Value value_;
+    };
+    ASSERT(ValueCell(std::string(40, 'x')).GetValueView() == View(std::string_view(std::string(40, 'x'))));
+    ASSERT(ValueCell(1.5).GetValueView() == View(1.5));
+    ASSERT(ValueCell(FormulaError(FormulaError::Category::Ref)).GetValueView()
+           == View(FormulaError(FormulaError::Category::Ref)));
+}
+
+void TestRecalculationOrder() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    for (int row = 1; row < 20; ++row) {
+        sheet.SetCell(Position{ row, 0 }, "=" + Position{ row - 1, 0 }.ToString() + "+1");
+    }
+    sheet.SetCell("B1"_pos, "=A1+A20");
+    sheet.ResetCacheStats();
+
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(21.0));
+    ASSERT_EQUAL(sheet.GetCacheStats().misses, 20u);
+
+    sheet.SetCell("A10"_pos, "100");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCacheStats().misses, 31u);
+    ASSERT_EQUAL(sheet.GetCell("A20"_pos)->GetValue(), CellInterface::Value(110.0));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(111.0));
+    ASSERT_EQUAL(sheet.GetCacheStats().misses, 31u);
+}
+
+// Submit, который не смог поставить задачу, не оставляет её в счётчиках пула,
+// и Wait не ждёт её вечно.
+void TestThreadPoolSubmitFailure() {
+    ThreadPool pool(1);
+    std::atomic<bool> release = false;
+    std::atomic<int> done = 0;
+    pool.Submit([&release, &done] {
+        while (!release) {
+            std::this_thread::yield();
+        }
+        ++done;
+    });
+    int submitted = 1;
+    bool failed = false;
+    fail_allocations = true;
+    // Очередь растёт блоками, и рано или поздно вставке нужна память.
+    for (int i = 0; i < 10000 && !failed; ++i) {
+        try {
+            pool.Submit([&done] { ++done; });
+            ++submitted;
+        }
+        catch (const std::bad_alloc&) {
+            failed = true;
+        }
+    }
+    fail_allocations = false;
+    ASSERT(failed);
+
+    release = true;
+    pool.Wait();
+    ASSERT_EQUAL(done.load(), submitted);
+}
+
+void TestParallelRecalculation() {
+    auto fill = [](Sheet& sheet) {
+        for (int row = 0; row < 300; ++row) {
+            sheet.SetCell(Position{ row, 0 }, std::to_string(row % 7));
+            for (int col = 1; col < 6; ++col) {
+                std::string prev = Position{ row, col - 1 }.ToString();
+                sheet.SetCell(Position{ row, col }, "=" + prev + "*2+" + prev + "/" + std::to_string(col % 3));
+            }
+            sheet.SetCell(Position{ row, 6 }, "=A" + std::to_string(row + 1) + "+F" + std::to_string(row + 1));
+        }
+    };
+    auto print_values = [](const Sheet& sheet) {
+        std::ostringstream out;
+        sheet.PrintValues(out);
+        return out.str();
+    };
+
+    Sheet serial;
+    fill(serial);
+    Sheet parallel;
+    parallel.SetRecalcThreadCount(4);
+    ASSERT_EQUAL(parallel.GetRecalcThreadCount(), 4u);
+    fill(parallel);
+    ASSERT_EQUAL(print_values(parallel), print_values(serial));
+    ASSERT_EQUAL(parallel.GetCacheStats().misses, serial.GetCacheStats().misses);
+
+    for (int row = 0; row < 300; row += 3) {
+        serial.SetCell(Position{ row, 0 }, "=" + std::to_string(row) + "/2");
+        parallel.SetCell(Position{ row, 0 }, "=" + std::to_string(row) + "/2");
+    }
+    ASSERT_EQUAL(print_values(parallel), print_values(serial));
+}
+
+void TestCircularDependencyDetection() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "=B1");
+    try {
+        sheet->SetCell("B1"_pos, "=C5+A1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT(sheet->GetCell("C5"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "");
+
+    // Каждая строка ссылается на обе ячейки предыдущей: число путей растёт
+    // экспоненциально, а число ячеек — линейно.
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "1");
+    for (int row = 1; row < 60; ++row) {
+        std::string refs = "=A" + std::to_string(row) + "+B" + std::to_string(row);
+        sheet->SetCell(Position{ row, 0 }, refs);
+        sheet->SetCell(Position{ row, 1 }, refs);
+    }
+    try {
+        sheet->SetCell("A1"_pos, "=B60");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "1");
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(4.0));
+}
+
+void TestTiledGrid() {
+    TiledGrid<std::string> grid;
+    std::vector<Position> positions{ "B2"_pos, "A1"_pos, "XFD16384"_pos, "Q1"_pos, "A5"_pos, "P1"_pos };
+    for (const auto& pos : positions) {
+        grid.Emplace(pos, pos.ToString());
+    }
+    ASSERT_EQUAL(grid.Size(), positions.size());
+    ASSERT_EQUAL(*grid.Find("Q1"_pos), "Q1");
+    ASSERT(grid.Find("C3"_pos) == nullptr);
+
+    // Идентификатор удалённого значения достаётся следующему.
+    auto b2_id = grid.FindId("B2"_pos);
+    ASSERT(b2_id < grid.GetIdBound());
+    ASSERT_EQUAL(grid[b2_id], "B2");
+    ASSERT_EQUAL(grid.GetPosition(b2_id), "B2"_pos);
+    ASSERT(grid.Erase("B2"_pos));
+    ASSERT(!grid.Erase("B2"_pos));
+    ASSERT_EQUAL(grid.FindId("B2"_pos), TiledGrid<std::string>::NO_ID);
+    grid.Emplace("C1"_pos, "C1");
+    ASSERT_EQUAL(grid.FindId("C1"_pos), b2_id);
+    ASSERT_EQUAL(grid.GetPosition(b2_id), "C1"_pos);
+
+    // EmplaceWithId передаёт значению его идентификатор, в том числе
+    // освобождённый.
+    TiledGrid<std::pair<std::string, TiledGrid<std::string>::Id>> id_grid;
+    id_grid.EmplaceWithId("A1"_pos, "A1");
+    auto b1_id = id_grid.EmplaceWithId("B1"_pos, "B1").second;
+    ASSERT_EQUAL(b1_id, id_grid.FindId("B1"_pos));
+    id_grid.Erase("B1"_pos);
+    ASSERT_EQUAL(id_grid.EmplaceWithId("C7"_pos, "C7").second, b1_id);
+    ASSERT_EQUAL(id_grid.FindId("C7"_pos), b1_id);
+
+    std::vector<std::string> visited;
+    grid.ForEach([&](Position pos, const std::string& value) {
+        ASSERT_EQUAL(pos.ToString(), value);
+        visited.push_back(value);
+    });
+    ASSERT_EQUAL(visited, (std::vector<std::string>{ "A1", "C1", "P1", "Q1", "A5", "XFD16384" }));
+
+    visited.clear();
+    grid.ForEachInRange(Range::FromCorners("Q5"_pos, "B1"_pos), [&](Position, const std::string& value) {
+        visited.push_back(value);
+    });
+    ASSERT_EQUAL(visited, (std::vector<std::string>{ "C1", "P1", "Q1" }));
+
+    // Если значение не удалось создать, созданный под него блок удаляется.
+    grid.Emplace("D9"_pos, "D9");
+    grid.Erase("D9"_pos);
+    std::size_t usage = grid.GetMemoryUsage();
+    try {
+        grid.Emplace("Z6"_pos, std::string::npos, 'x');
+        ASSERT(false);
+    }
+    catch (const std::length_error&) {
+    }
+    ASSERT(grid.Find("Z6"_pos) == nullptr);
+    ASSERT_EQUAL(grid.GetMemoryUsage(), usage);
+
+    // Обход диапазона совпадает с отбором из полного обхода.
+    TiledGrid<int> random_grid;
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> coordinate(0, 150);
+    for (int i = 0; i < 3000; ++i) {
+        Position pos{ coordinate(random), coordinate(random) };
+        if (!random_grid.Find(pos)) {
+            random_grid.Emplace(pos, i);
+        }
+    }
+    for (int i = 0; i < 200; ++i) {
+        auto range = Range::FromCorners({ coordinate(random), coordinate(random) },
+                                        { coordinate(random), coordinate(random) });
+        std::vector<Position> expected, actual;
+        random_grid.ForEach([&](Position pos, int) {
+            if (range.Contains(pos)) {
+                expected.push_back(pos);
+            }
+        });
+        random_grid.ForEachInRange(range, [&](Position pos, int) {
+            actual.push_back(pos);
+        });
+        ASSERT(actual == expected);
+    }
+}
+
+void TestRangeIndex() {
+    RangeIndex<int> index;
+    index[Range::FromCorners("A1"_pos, "A100"_pos)] = 1;
+    index[Range::FromCorners("B2"_pos, "C3"_pos)] = 2;
+    index[Range::FromCorners("A1"_pos, "XFD16384"_pos)] = 3;
+    index[Range::FromCorners("A1"_pos, "A100"_pos)] += 10;
+    ASSERT_EQUAL(index.Size(), 3u);
+    ASSERT_EQUAL(*index.Find(Range::FromCorners("A1"_pos, "A100"_pos)), 11);
+
+    auto containing = [&index](Position pos) {
+        std::vector<int> values;
+        index.ForEachContaining(pos, [&values](const Range&, int value) { values.push_back(value); });
+        std::sort(values.begin(), values.end());
+        return values;
+    };
+    ASSERT_EQUAL(containing("A50"_pos), (std::vector{ 3, 11 }));
+    ASSERT_EQUAL(containing("C2"_pos), (std::vector{ 2, 3 }));
+    ASSERT(index.Erase(Range::FromCorners("A1"_pos, "XFD16384"_pos)));
+    ASSERT(!index.Erase(Range::FromCorners("A1"_pos, "XFD16384"_pos)));
+    ASSERT_EQUAL(containing("D4"_pos), std::vector<int>{});
+
+    // Поиск совпадает с перебором всех диапазонов при любых вставках и
+    // удалениях.
+    RangeIndex<int> random_index;
+    std::map<Range, int> expected_ranges;
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> coordinate(0, 200);
+    std::uniform_int_distribution<int> far_coordinate(0, Position::MAX_ROWS - 1);
+    for (int i = 0; i < 3000; ++i) {
+        Position corner{ coordinate(random), coordinate(random) };
+        Position other = i % 10 == 0 ? Position{ far_coordinate(random), coordinate(random) }
+                                     : Position{ coordinate(random), coordinate(random) };
+        auto range = Range::FromCorners(corner, other);
+        if (i % 3 == 2 && !expected_ranges.empty()) {
+            range = std::next(expected_ranges.begin(), i % expected_ranges.size())->first;
+            ASSERT(random_index.Erase(range));
+            expected_ranges.erase(range);
+        }
+        else {
+            random_index[range] = i;
+            expected_ranges[range] = i;
+        }
+    }
+    ASSERT_EQUAL(random_index.Size(), expected_ranges.size());
+    for (int i = 0; i < 500; ++i) {
+        Position pos{ coordinate(random), coordinate(random) };
+        std::vector<std::pair<Range, int>> expected, actual;
+        for (const auto& [range, value] : expected_ranges) {
+            if (range.Contains(pos)) {
+                expected.emplace_back(range, value);
+            }
+        }
+        random_index.ForEachContaining(pos, [&actual](const Range& range, int value) {
+            actual.emplace_back(range, value);
+        });
+        std::sort(actual.begin(), actual.end());
+        ASSERT(actual == expected);
+    }
+}
+
+void TestDependencyGraph() {
+    DependencyGraph graph;
+    auto dependents = [&graph](CellId cell) {
+        std::vector<CellId> result;
+        graph.ForEachDependent(cell, [&result](CellId dependent) { result.push_back(dependent); });
+        return result;
+    };
+
+    // Вставка в начало, середину и конец, в том числе с переходом из
+    // встроенного массива в выделенную память.
+    graph.AddEdge(0, 30);
+    graph.AddEdge(0, 2);
+    graph.AddEdge(0, 17);
+    graph.AddEdge(0, 99);
+    graph.AddEdge(0, 2);
+    graph.AddEdge(5, 2);
+    ASSERT_EQUAL(graph.GetEdgeCount(), 5u);
+    ASSERT_EQUAL(dependents(0), (std::vector<CellId>{ 2, 17, 30, 99 }));
+    ASSERT_EQUAL(dependents(3), std::vector<CellId>{});
+    ASSERT_EQUAL(dependents(1000), std::vector<CellId>{});
+    ASSERT(graph.HasDependents(5));
+    ASSERT(!graph.HasDependents(3));
+
+    graph.RemoveEdge(0, 30);
+    graph.RemoveEdge(0, 30);
+    graph.RemoveEdge(30, 0);
+    graph.RemoveEdge(1000, 0);
+    ASSERT_EQUAL(graph.GetEdgeCount(), 4u);
+    ASSERT_EQUAL(dependents(0), (std::vector<CellId>{ 2, 17, 99 }));
+
+    std::vector<std::pair<CellId, CellId>> edges;
+    graph.ForEachEdge([&edges](CellId cell, CellId dependent) { edges.emplace_back(cell, dependent); });
+    ASSERT(std::is_sorted(edges.begin(), edges.end()));
+    ASSERT_EQUAL(edges.size(), 4u);
+
+    graph.RemoveEdge(5, 2);
+    ASSERT(!graph.HasDependents(5));
+    ASSERT_EQUAL(graph.GetEdgeCount(), 3u);
+
+    // Опустевший список освобождает выделенную память.
+    std::size_t usage = graph.GetMemoryUsage();
+    for (CellId id : { 2, 17, 99 }) {
+        graph.RemoveEdge(0, id);
+    }
+    ASSERT(graph.GetMemoryUsage() < usage);
+    ASSERT(!graph.HasDependents(0));
+}
+
+void TestCellIdSets() {
+    IndexedCellIdSet set;
+    ASSERT(set.Insert(7));
+    ASSERT(set.Insert(100));
+    ASSERT(set.Insert(3));
+    ASSERT(!set.Insert(100));
+    ASSERT_EQUAL(set.Size(), 3u);
+    ASSERT_EQUAL(set.IndexOf(100), 1u);
+    set.Erase(7);
+    set.Erase(8);
+    ASSERT(!set.Contains(7));
+    ASSERT_EQUAL(std::vector<CellId>(set.begin(), set.end()), (std::vector<CellId>{ 3, 100 }));
+    ASSERT_EQUAL(set.IndexOf(3), 0u);
+    ASSERT_EQUAL(set.IndexOf(100000), IndexedCellIdSet::NO_INDEX);
+    set.Clear();
+    ASSERT(set.Empty());
+    ASSERT(set.Insert(100));
+    ASSERT_EQUAL(set.IndexOf(100), 0u);
+
+    CellIdBitmap bitmap;
+    ASSERT(!bitmap.Contains(1000));
+    ASSERT(bitmap.Insert(1000));
+    ASSERT(!bitmap.Insert(1000));
+    ASSERT(bitmap.Insert(63));
+    ASSERT(bitmap.Contains(63) && bitmap.Contains(1000) && !bitmap.Contains(64));
+    bitmap.Erase(1000);
+    ASSERT(!bitmap.Contains(1000));
+}
+
+void TestPrintSparse() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("C1"_pos, "c");
+    sheet->SetCell("A3"_pos, "a");
+    sheet->SetCell("R4"_pos, "=1+2");
+    sheet->ClearCell("R4"_pos);
+    sheet->SetCell("D4"_pos, "=1+2");
+
+    std::ostringstream values;
+    sheet->PrintValues(values);
+    ASSERT_EQUAL(values.str(), "\t\tc\t\n\t\t\t\na\t\t\t\n\t\t\t3\n");
+}
+
+void TestPrintableSizeTracking() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("B2"_pos, "b");
+    sheet->SetCell("D5"_pos, "d");
+    sheet->SetCell("D1"_pos, "d");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5, 4 }));
+
+    // Пустые ячейки, созданные ради ссылки, область не расширяют.
+    sheet->SetCell("A1"_pos, "=Z100");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 5, 4 }));
+
+    sheet->ClearCell("D5"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 4 }));
+    sheet->SetCell("D1"_pos, "");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 2, 2 }));
+    sheet->SetCell("Z100"_pos, "z");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 100, 26 }));
+    sheet->ClearCell("Z100"_pos);
+    sheet->ClearCell("B2"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 1, 1 }));
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{ 0, 0 }));
+}
+
+void TestBytecodeMatchesTree() {
+    // Ячейка Z1 содержит ошибку.
+    auto cell_value = [](Position pos) {
+        if (pos == "Z1"_pos) {
+            return MakeErrorValue(FormulaError::Category::Ref);
+        }
+        return pos.row * 10.0 - pos.col * 0.5;
+    };
+    // Диапазоны в строках ниже десятой содержат ошибку.
+    auto range_values = [&cell_value](const Range& range, std::vector<double>& values) {
+        if (range.to.row >= 10) {
+            values.push_back(MakeErrorValue(FormulaError::Category::Value));
+            return;
+        }
+        for (int row = range.from.row; row <= range.to.row; ++row) {
+            for (int col = range.from.col; col <= range.to.col; ++col) {
+                values.push_back(cell_value({ row, col }));
+            }
+        }
+    };
+    // Результат вычисления либо категория ошибки.
+    auto run = [](auto&& execute) -> std::variant<double, FormulaError::Category> {
+        double value = execute();
+        if (IsErrorValue(value)) {
+            return GetErrorCategory(value);
+        }
+        return value;
+    };
+
+    for (const char* expr : { "1", "-A1", "+-+B3", "1+2*3-4/5", "(1+2)*(3-4)/5", "A1-B2-C3-D4",
+                              "A1/(B2-B2)", "0/0", "1/A1", "-(-(-(A2*2)))", "((((((((1+A1))))))))",
+                              "1e300*1e300/1e-300", "A2/B1*C3+D4-E5/F6*G7", "SUM(A1:C3)",
+                              "-MIN(B2:E5,A1)*MAX(1,2,A1:A9)", "AVERAGE(A1,B1:B1,SUM(A1:J9,3))/COUNT(A1:Z3)",
+                              "SUM(A1:A20)", "1+SUM(1/0)", "AVERAGE(A1:A20,1/0)", "-(1/0)", "-Z1",
+                              "+-Z1*2" }) {
+        FormulaAST ast = ParseFormulaAST(expr);
+        auto expected = run([&] { return ast.ExecuteTree(cell_value, range_values); });
+        auto actual = run([&] { return ast.Execute(cell_value, range_values); });
+        ASSERT_EQUAL(actual.index(), expected.index());
+        if (std::holds_alternative<double>(expected)) {
+            ASSERT_EQUAL(std::get<double>(actual), std::get<double>(expected));
+        }
+        else {
+            ASSERT(std::get<FormulaError::Category>(actual) == std::get<FormulaError::Category>(expected));
+        }
+    }
+
+    // Выражение глубже встроенного стека интерпретатора.
+    std::string deep = "1";
+    for (int i = 0; i < 100; ++i) {
+        deep = "A1+(" + deep + ")";
+    }
+    FormulaAST ast = ParseFormulaAST(deep);
+    ASSERT_EQUAL(ast.Execute(cell_value), ast.ExecuteTree(cell_value));
+
+    // Вложенных вызовов функций больше, чем встроенных накопителей.
+    std::string nested = "A1:B2";
+    for (int i = 0; i < 20; ++i) {
+        nested = "SUM(" + nested + ",MAX(A1:A3," + std::to_string(i) + "))";
+    }
+    FormulaAST nested_ast = ParseFormulaAST(nested);
+    ASSERT_EQUAL(nested_ast.Execute(cell_value, range_values), nested_ast.ExecuteTree(cell_value, range_values));
+}
+
+void TestErrorValues() {
+    for (auto category : { FormulaError::Category::Ref, FormulaError::Category::Value,
+                           FormulaError::Category::Arithmetic }) {
+        double value = MakeErrorValue(category);
+        ASSERT(std::isnan(value));
+        ASSERT(IsErrorValue(value));
+        ASSERT(GetErrorCategory(value) == category);
+    }
+    double zero = 0;
+    for (double number : { 0.0, -1.5, std::numeric_limits<double>::infinity(), zero / zero,
+                           std::numeric_limits<double>::quiet_NaN() }) {
+        ASSERT(!IsErrorValue(number));
+    }
+
+    // Из нескольких ошибок возвращается первая по ходу вычисления, читает ли
+    // формула ячейки через лист или по привязанным ячейкам.
+    auto cell_value = [](Position pos) {
+        return pos.col == 0 ? MakeErrorValue(FormulaError::Category::Value)
+                            : MakeErrorValue(FormulaError::Category::Arithmetic);
+    };
+    FormulaAST ast = ParseFormulaAST("B1+A1");
+    ASSERT(GetErrorCategory(ast.Execute(cell_value)) == FormulaError::Category::Arithmetic);
+    ASSERT(GetErrorCategory(ast.ExecuteTree(cell_value)) == FormulaError::Category::Arithmetic);
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "x");
+    sheet.SetCell("B1"_pos, "=1/0");
+    auto formula = ParseFormula("B1+A1");
+    ASSERT(formula->Evaluate(sheet) == FormulaInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    sheet.SetCell("C1"_pos, "=B1+A1");
+    sheet.SetCell("C2"_pos, "=SUM(A1:B1)+A1");
+    sheet.SetCell("C3"_pos, "=A1+SUM(A1:B1)");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(sheet.GetCell("C3"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+}
+
+// Дерево разобранной формулы вместе со списком ячеек либо "error", если
+// формула отвергнута.
+std::string DescribeParse(std::string_view expr, FormulaParserBackend backend) {
+    try {
+        FormulaAST ast = ParseFormulaAST(expr, backend);
+        std::ostringstream out;
+        ast.Print(out);
+        out << " | ";
+        ast.PrintCells(out);
+        return out.str();
+    }
+    catch (const std::exception&) {
+        return "error";
+    }
+}
+
+void TestNativeFormulaParser() {
+    auto parse = [](std::string_view expr) {
+        return DescribeParse(expr, FormulaParserBackend::Native);
+    };
+
+    ASSERT_EQUAL(parse("1+2*3"), "(+ 1 (* 2 3)) | ");
+    ASSERT_EQUAL(parse("1-2-3"), "(- (- 1 2) 3) | ");
+    ASSERT_EQUAL(parse("-A1+B1*C1"), "(+ (- A1) (* B1 C1)) | A1 B1 C1 ");
+    ASSERT_EQUAL(parse("-(1+2)"), "(- (+ 1 2)) | ");
+    ASSERT_EQUAL(parse(" 1.5e3 / .5 "), "(/ 1500 0.5) | ");
+    ASSERT_EQUAL(parse("1e-400"), "0 | ");
+    ASSERT_EQUAL(parse("SUM(B2:A1, 2*C1)"), "(SUM A1:B2 (* 2 C1)) | C1 ");
+    ASSERT_EQUAL(parse("-COUNT(A1:A1)"), "(- (COUNT A1:A1)) | ");
+    for (const char* rejected : { "1.", "1e", "1EA5", "a1", "A1B2", "XFE1", "1 2", "()", "1+", "1**2",
+                                  "", "1e400", "1\f", "SUM()", "SUM(1,)", "SUM 1", "FOO(1)", "A1:B2",
+                                  "SUM((A1:B2))", "SUM(A1:B2+1)", "SUM(A1:XFE1)", "SUM(A1:)" }) {
+        ASSERT_EQUAL(parse(rejected), "error");
+    }
+
+    // Разбор не зависит от выбранной по умолчанию реализации.
+    FormulaParserBackend backend = GetFormulaParserBackend();
+    SetFormulaParserBackend(FormulaParserBackend::Native);
+    ASSERT_EQUAL(ParseFormula("(1+2)*A1")->GetExpression(), "(1+2)*A1");
+    SetFormulaParserBackend(backend);
+}
+
+// Выражения на границах грамматики Formula.g4 и ожидаемый результат разбора.
+// Таблицу должна проходить каждая собранная реализация разбора, поэтому
+// расхождение с ANTLR видно и там, где она не собрана.
+const std::pair<std::string_view, std::string_view> FORMULA_PARSER_CORPUS[] = {
+    { "1", "1 | " },
+    { "  1  ", "1 | " },
+    { "\t1\r\n", "1 | " },
+    { "1.5", "1.5 | " },
+    { ".5", "0.5 | " },
+    { "1.", "error" },
+    { "1..5", "error" },
+    { "1.5.3", "error" },
+    { "1e5", "100000 | " },
+    { "1E+5", "100000 | " },
+    { "1e-5", "1e-05 | " },
+    { "1.5e3", "1500 | " },
+    { ".5e-3", "0.0005 | " },
+    { "1e", "error" },
+    { "1e+", "error" },
+    { "1E", "error" },
+    { "1EA5", "error" },
+    { "1E+A5", "error" },
+    { "1e400", "error" },
+    { "1e-400", "0 | " },
+    { "00012", "12 | " },
+    { "A1", "A1 | A1 " },
+    { "ZZ99", "ZZ99 | ZZ99 " },
+    { "a1", "error" },
+    { "A", "error" },
+    { "1A", "error" },
+    { "A1B2", "error" },
+    { "AAAAAAAAAA1", "error" },
+    { "XFD16384", "XFD16384 | XFD16384 " },
+    { "XFE1", "error" },
+    { "A16385", "error" },
+    { "1+2*3", "(+ 1 (* 2 3)) | " },
+    { "1-2-3", "(- (- 1 2) 3) | " },
+    { "8/4/2", "(/ (/ 8 4) 2) | " },
+    { "-1*2", "(* (- 1) 2) | " },
+    { "-A1+B1", "(+ (- A1) B1) | A1 B1 " },
+    { "--1", "(- (- 1)) | " },
+    { "+-+1", "(+ (- (+ 1))) | " },
+    { "-(1+2)", "(- (+ 1 2)) | " },
+    { "1+-2", "(+ 1 (- 2)) | " },
+    { "1*-2", "(* 1 (- 2)) | " },
+    { "1--2", "(- 1 (- 2)) | " },
+    { "(1)", "1 | " },
+    { "((1))", "1 | " },
+    { "()", "error" },
+    { "(1", "error" },
+    { "1)", "error" },
+    { "1 2", "error" },
+    { "1+", "error" },
+    { "*1", "error" },
+    { "1**2", "error" },
+    { "", "error" },
+    { " ", "error" },
+    { "1+(2*(3-A1))/B2", "(+ 1 (/ (* 2 (- 3 A1)) B2)) | A1 B2 " },
+    { "1 + 2\f", "error" },
+    { "1;2", "error" },
+    { "=1", "error" },
+    // Функции и диапазоны.
+    { "SUM(1)", "(SUM 1) | " },
+    { "SUM(A1:B2)", "(SUM A1:B2) | " },
+    { "SUM(B2:A1)", "(SUM A1:B2) | " },
+    { "SUM(A2:B1)", "(SUM A1:B2) | " },
+    { "SUM(A1:A1)", "(SUM A1:A1) | " },
+    { "MIN(A1, 2)", "(MIN A1 2) | A1 " },
+    { "MAX(1,2,3)", "(MAX 1 2 3) | " },
+    { "AVERAGE(A1:C3, B2)", "(AVERAGE A1:C3 B2) | B2 " },
+    { "COUNT(A1:B2,C3:D4)", "(COUNT A1:B2 C3:D4) | " },
+    { "SUM ( A1 : B2 )", "(SUM A1:B2) | " },
+    { "SUM()", "error" },
+    { "SUM(,)", "error" },
+    { "SUM(1,)", "error" },
+    { "SUM(,1)", "error" },
+    { "SUM(1,,2)", "error" },
+    { "SUM(A1:)", "error" },
+    { "SUM(:B2)", "error" },
+    { "SUM(A1:B2:C3)", "error" },
+    { "SUM(A1:1)", "error" },
+    { "SUM(1:A1)", "error" },
+    { "SUM((A1:B2))", "error" },
+    { "SUM(A1:B2+1)", "error" },
+    { "SUM(-A1:B2)", "error" },
+    { "A1:B2", "error" },
+    { "A1:B2+1", "error" },
+    { "1,2", "error" },
+    { "(1,2)", "error" },
+    { "SUM(SUM(A1:B2), MAX(1, MIN(C3, 2)))", "(SUM (SUM A1:B2) (MAX 1 (MIN C3 2))) | C3 " },
+    { "SUM(SUM(SUM(1)))", "(SUM (SUM (SUM 1))) | " },
+    { "-SUM(1)", "(- (SUM 1)) | " },
+    { "SUM(1)*2", "(* (SUM 1) 2) | " },
+    { "2*SUM (1)", "(* 2 (SUM 1)) | " },
+    { "SUM 1", "error" },
+    { "SUM", "error" },
+    { "SUM(", "error" },
+    { "SUM(1", "error" },
+    { "SUM(1)(2)", "error" },
+    { "sum(1)", "error" },
+    { "Sum(1)", "error" },
+    { "SUMA(1)", "error" },
+    { "SU(1)", "error" },
+    { "SUM1", "SUM1 | SUM1 " },
+    { "SUM1(2)", "error" },
+    { "SUMA1", "error" },
+    { "MAXX(1)", "error" },
+    { "AVERAGE(A1:XFD16384)", "(AVERAGE A1:XFD16384) | " },
+    { "SUM(A1:XFE1)", "error" },
+    { "COUNT(A16385:A1)", "error" },
+    { "MAX(1e5, .5)", "(MAX 100000 0.5) | " },
+    { "MIN(A1:B2, C1:D2, 3)", "(MIN A1:B2 C1:D2 3) | " },
+};
+
+void TestFormulaParserCorpus() {
+    for (auto backend : { FormulaParserBackend::Native, FormulaParserBackend::Antlr }) {
+        if (!IsFormulaParserBackendAvailable(backend)) {
+            continue;
+        }
+        for (const auto& [expr, expected] : FORMULA_PARSER_CORPUS) {
+            ASSERT_EQUAL(DescribeParse(expr, backend), expected);
+        }
+    }
+}
+
+void TestAggregateFunctions() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("A2"_pos, "=A1*3");
+    sheet->SetCell("B1"_pos, "text");
+    sheet->SetCell("B2"_pos, "'5");
+    sheet->SetCell("C1"_pos, "");
+    auto value = [&sheet](std::string expression) {
+        sheet->SetCell("Z1"_pos, "=" + expression);
+        return sheet->GetCell("Z1"_pos)->GetValue();
+    };
+
+    // Текст и пустые ячейки диапазона пропускаются, текст-число учитывается.
+    ASSERT_EQUAL(value("SUM(A1:C2)"), CellInterface::Value(9.0));
+    ASSERT_EQUAL(value("MIN(A1:C2)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("MAX(A1:C2,10)"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("AVERAGE(A1:C2)"), CellInterface::Value(3.0));
+    ASSERT_EQUAL(value("COUNT(A1:C2,7,A1)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("SUM(A1:A2)*-MIN(A2,B2:B2)+1"), CellInterface::Value(-11.0));
+
+    // Функции от пустого набора чисел.
+    ASSERT_EQUAL(value("SUM(D1:E100)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("MAX(D1:E100)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("COUNT(B1:B1)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("AVERAGE(D1:E100)"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // Ошибка в ячейке диапазона становится значением функции.
+    sheet->SetCell("C2"_pos, "=1/0");
+    ASSERT_EQUAL(value("COUNT(A1:C2)"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // Диапазон нормализуется и печатается без пробелов; его ячейки не
+    // попадают в список ячеек формулы и не создаются.
+    sheet->SetCell("Z1"_pos, "=SUM( B9:A7 , A1 ) + MAX(1)");
+    ASSERT_EQUAL(sheet->GetCell("Z1"_pos)->GetText(), "=SUM(A7:B9,A1)+MAX(1)");
+    auto formula = ParseFormula("SUM(B9:A7,A1,A7:B9,C1:C1)");
+    ASSERT_EQUAL(formula->GetReferencedCells(), (std::vector{ "A1"_pos }));
+    ASSERT_EQUAL(formula->GetReferencedRanges(),
+                 (std::vector{ Range{ "C1"_pos, "C1"_pos }, Range{ "A7"_pos, "B9"_pos } }));
+    ASSERT(sheet->GetCell("B9"_pos) == nullptr);
+
+    for (const char* incorrect : { "=SUM()", "=MEDIAN(A1)", "=sum(A1)", "=SUM(A1:B2*2)", "=A1:B2" }) {
+        try {
+            sheet->SetCell("Z2"_pos, incorrect);
+            ASSERT(false);
+        } catch (const FormulaException&) {
+        }
+    }
+}
+
+void TestDependencyMaintenance() {
+    Sheet sheet;
+    auto stats = [&sheet]() {
+        sheet.ValidateDependencies();
+        return sheet.GetDependencyStats();
+    };
+
+    sheet.SetCell("A1"_pos, "=B1+C1");
+    ASSERT_EQUAL(stats().cell_edges, 2u);
+    ASSERT(sheet.GetCell("C1"_pos) != nullptr);
+
+    // Замена формулы удаляет старые рёбра и пустые ячейки, созданные ради них.
+    sheet.SetCell("A1"_pos, "=B1+SUM(D1:D5)");
+    ASSERT_EQUAL(stats().cell_edges, 1u);
+    ASSERT_EQUAL(stats().range_edges, 1u);
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+
+    // Очищенная ячейка, на которую ссылаются, остаётся пустой.
+    sheet.SetCell("B1"_pos, "2");
+    sheet.ClearCell("B1"_pos);
+    ASSERT(sheet.GetCell("B1"_pos) != nullptr);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "");
+    ASSERT_EQUAL(stats().cell_edges, 1u);
+
+    sheet.SetCells({ { "A1"_pos, "=E1" }, { "A2"_pos, "=E1+B1" } });
+    ASSERT_EQUAL(stats().cell_edges, 3u);
+    ASSERT_EQUAL(stats().range_edges, 0u);
+    sheet.ClearCell("A2"_pos);
+    ASSERT_EQUAL(stats().cell_edges, 1u);
+    ASSERT(sheet.GetCell("B1"_pos) == nullptr);
+    sheet.SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(stats().cell_edges, 0u);
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+
+    // Долгие правки не накапливают рёбер и памяти.
+    std::size_t memory = 0;
+    for (int i = 0; i < 1000; ++i) {
+        sheet.SetCell("A1"_pos, "=" + Position{ i % 50, 5 }.ToString() + "+SUM(A2:A" + std::to_string(i % 7 + 2) + ")");
+        if (i == 99) {
+            memory = stats().cell_edges_memory;
+        }
+    }
+    ASSERT_EQUAL(stats().cell_edges, 1u);
+    ASSERT_EQUAL(stats().range_edges, 1u);
+    ASSERT_EQUAL(stats().cell_edges_memory, memory);
+
+    // Рёбра из очищенных ячеек не мешают загрузке снимка.
+    sheet.SetCell("F50"_pos, "1");
+    sheet.ClearCell("F50"_pos);
+    std::ostringstream output;
+    SheetSnapshot::Save(sheet, output);
+    auto loaded = SheetSnapshot::Load(output.str());
+    loaded->ValidateDependencies();
+    ASSERT_EQUAL(loaded->GetDependencyStats().cell_edges, 1u);
+}
+
+void TestRangeDependencies() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("C1"_pos, "=SUM(A1:B3)");
+    sheet->SetCell("D1"_pos, "=C1*2");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    // Значения пересчитываются при появлении, изменении и удалении ячеек
+    // диапазона, в том числе через другие формулы.
+    sheet->SetCell("B3"_pos, "4");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(8.0));
+    sheet->SetCell("A1"_pos, "=B3+1");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(18.0));
+    sheet->SetCell("B3"_pos, "1");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(2.0));
+    sheet->SetCell("C1"_pos, "=SUM(A2:B2)");
+    sheet->SetCell("B3"_pos, "100");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    // Циклы через диапазоны обнаруживаются и не меняют таблицу.
+    for (const auto& [pos, text] : std::vector<std::pair<Position, std::string>>{
+             { "E1"_pos, "=MAX(D1:E1)" }, { "A2"_pos, "=D1" }, { "B2"_pos, "=COUNT(C1:C1)" } }) {
+        try {
+            sheet->SetCell(pos, text);
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+    }
+    ASSERT(sheet->GetCell("E1"_pos) == nullptr);
+
+    Sheet batch_sheet;
+    batch_sheet.SetCell("A1"_pos, "=SUM(B1:B10)");
+    try {
+        batch_sheet.SetCells({ { "B5"_pos, "=C1" }, { "C1"_pos, "=A1" }, { "D1"_pos, "=SUM(A1:C1)" } });
+        ASSERT(false);
+    } catch (const BulkCircularDependencyException& ex) {
+        ASSERT_EQUAL(ex.GetCells(), (std::vector{ "A1"_pos, "C1"_pos, "B5"_pos }));
+    }
+    batch_sheet.SetCells({ { "B5"_pos, "=C1" }, { "C1"_pos, "3" }, { "D1"_pos, "=SUM(A1:C1)" } });
+    ASSERT_EQUAL(batch_sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    // Обход диапазона останавливается, когда func возвращает false; так
+    // значения диапазона перестают читаться после первой ошибки.
+    Sheet error_sheet;
+    error_sheet.SetCells({ { "A1"_pos, "1" }, { "A2"_pos, "=1/0" }, { "A3"_pos, "3" }, { "B1"_pos, "=SUM(A1:A3)" } });
+    std::vector<Position> visited;
+    error_sheet.ForEachCellInRange(Range::FromCorners("A1"_pos, "A3"_pos), [&](Position pos, const CellInterface&) {
+        visited.push_back(pos);
+        return !(pos == "A2"_pos);
+    });
+    ASSERT_EQUAL(visited, (std::vector{ "A1"_pos, "A2"_pos }));
+    ASSERT_EQUAL(error_sheet.GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+}
+
+void TestArena() {
+    Arena arena(64);
+    std::size_t initial_usage = arena.GetMemoryUsage();
+    ASSERT(initial_usage >= 64);
+
+    char* c = arena.New<char>('x');
+    double* d = arena.New<double>(2.5);
+    ASSERT_EQUAL(reinterpret_cast<std::uintptr_t>(d) % alignof(double), 0u);
+    ASSERT_EQUAL(static_cast<void*>(d), static_cast<void*>(c + alignof(double)));
+    int* numbers = arena.NewArray<int>(4);
+    ASSERT_EQUAL(numbers[3], 0);
+    ASSERT_EQUAL(arena.GetMemoryUsage(), initial_usage);
+
+    // Не поместившееся в блок размещается в новом, а прежние объекты остаются на месте.
+    int* large = arena.NewArray<int>(1000);
+    large[999] = 7;
+    ASSERT(arena.GetMemoryUsage() >= initial_usage + 1000 * sizeof(int));
+    ASSERT_EQUAL(*c, 'x');
+    ASSERT_EQUAL(*d, 2.5);
+
+    Arena moved = std::move(arena);
+    ASSERT_EQUAL(arena.GetMemoryUsage(), 0u);
+    ASSERT_EQUAL(large[999], 7);
+    ASSERT_EQUAL(arena.NewArray<int>(0), nullptr);
+}
+
+void TestFormulaMemoryUsage() {
+    auto small = ParseFormula("A1+1");
+    std::string sum = "A1";
+    for (int row = 2; row <= 200; ++row) {
+        sum += "+A" + std::to_string(row);
+    }
+    auto large = ParseFormula(sum);
+    ASSERT(small->GetMemoryUsage() > 0);
+    ASSERT(large->GetMemoryUsage() > small->GetMemoryUsage() + 199 * 3 * sizeof(Position));
+
+    // Список ячеек и байт-код размещаются вместе с деревом.
+    FormulaAST ast = ParseFormulaAST(sum, FormulaParserBackend::Native);
+    ASSERT_EQUAL(ast.GetCells().size(), 200u);
+    ASSERT_EQUAL(*ast.GetCells().begin(), "A1"_pos);
+    ASSERT_EQUAL(*(ast.GetCells().end() - 1), "A200"_pos);
+    ASSERT_EQUAL(ParseFormula("B2+A1*B2")->GetReferencedCells(), (std::vector{ "A1"_pos, "B2"_pos }));
+}
+
+void TestSetCells() {
+    Sheet sheet;
+    sheet.SetCell("C1"_pos, "=A1*2");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    sheet.SetCells({ { "A1"_pos, "=B1+B2" },
+                     { "B1"_pos, "1" },
+                     { "B2"_pos, "=B1*10" },
+                     { "B1"_pos, "2" },
+                     { "D4"_pos, "=Z9" },
+                     { "A2"_pos, "text" } });
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "2");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(22.0));
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(44.0));
+    ASSERT_EQUAL(sheet.GetCell("D4"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT(sheet.GetCell("Z9"_pos) != nullptr);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 4, 4 }));
+
+    // Перезапись существующих ячеек обновляет и зависимости, и область печати.
+    sheet.SetCells({ { "A1"_pos, "=B1" }, { "D4"_pos, "" } });
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 2, 3 }));
+    sheet.SetCell("B2"_pos, "=100");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(2.0));
+    sheet.SetCell("B1"_pos, "5");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(10.0));
+}
+
+void TestSetCellsIntoEmptySheet() {
+    // Ссылки вперёд на числа и на формулы без цикла.
+    Sheet sheet;
+    sheet.SetCells({ { "A1"_pos, "=B1+A2" }, { "B1"_pos, "=C1*2" }, { "C1"_pos, "3" }, { "A2"_pos, "4" } });
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(10.0));
+    sheet.SetCell("C1"_pos, "5");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(14.0));
+
+    // Цикл через ссылку вперёд и ссылка формулы на саму себя.
+    for (auto cells : { std::vector<std::pair<Position, std::string>>{ { "A1"_pos, "=A2" }, { "A2"_pos, "=A1+1" } },
+                        std::vector<std::pair<Position, std::string>>{ { "B2"_pos, "=B2" } } }) {
+        Sheet empty_sheet;
+        try {
+            empty_sheet.SetCells(std::move(cells));
+            ASSERT(false);
+        } catch (const BulkCircularDependencyException&) {
+        }
+        ASSERT_EQUAL(empty_sheet.GetPrintableSize(), (Size{ 0, 0 }));
+    }
+}
+
+void TestSetCellsRejectsWholeBatch() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1");
+    sheet.SetCell("F1"_pos, "=G1+1");
+
+    try {
+        sheet.SetCells({ { "B1"_pos, "=C1" },
+                         { "C1"_pos, "=A1+F1" },
+                         { "D1"_pos, "=D1" },
+                         { "G1"_pos, "=E1" },
+                         { "E1"_pos, "1" } });
+        ASSERT(false);
+    } catch (const BulkCircularDependencyException& ex) {
+        ASSERT_EQUAL(ex.GetCells(), (std::vector{ "A1"_pos, "B1"_pos, "C1"_pos, "D1"_pos }));
+    }
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "");
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 1, 6 }));
+
+    try {
+        sheet.SetCells({ { "E1"_pos, "1" }, { "E2"_pos, "=1+" } });
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    try {
+        sheet.SetCells({ { "E1"_pos, "1" }, { Position{ -1, 0 }, "1" } });
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+
+    // Цикл, замыкающийся через ячейку вне набора, тоже обнаруживается.
+    try {
+        sheet.SetCells({ { "G1"_pos, "=F1" } });
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet.GetCell("F1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    // Формулы набора ссылаются только назад, но цикл замыкает диапазон
+    // формулы, уже стоящей на листе.
+    sheet.SetCell("A3"_pos, "=SUM(B3:C3)");
+    sheet.SetCells({ { "B3"_pos, "1" }, { "C3"_pos, "=A2+B3" }, { "D3"_pos, "=A3" } });
+    try {
+        sheet.SetCells({ { "C3"_pos, "=A3" } });
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet.GetCell("D3"_pos)->GetValue(), CellInterface::Value(2.0));
+}
+
+void TestSetCellsParallelParse() {
+    Sheet sheet;
+    sheet.SetRecalcThreadCount(4);
+    std::vector<std::pair<Position, std::string>> cells;
+    for (int row = 0; row < 5000; ++row) {
+        cells.emplace_back(Position{ row, 0 }, std::to_string(row));
+        cells.emplace_back(Position{ row, 1 }, "=A" + std::to_string(row + 1) + "*2");
+    }
+    auto broken = cells;
+    broken[7777].second = "=A1+";
+    try {
+        sheet.SetCells(std::move(broken));
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 0, 0 }));
+
+    auto antlr_cells = cells;
+    sheet.SetCells(std::move(cells));
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 5000, 2 }));
+    ASSERT_EQUAL(sheet.GetCell("B4321"_pos)->GetValue(), CellInterface::Value(8640.0));
+
+    // С ANTLR формулы разбираются последовательно и при настроенном пуле.
+    if (IsFormulaParserBackendAvailable(FormulaParserBackend::Antlr)) {
+        FormulaParserBackend backend = GetFormulaParserBackend();
+        SetFormulaParserBackend(FormulaParserBackend::Antlr);
+        Sheet antlr_sheet;
+        antlr_sheet.SetRecalcThreadCount(4);
+        antlr_sheet.SetCells(std::move(antlr_cells));
+        SetFormulaParserBackend(backend);
+        ASSERT_EQUAL(antlr_sheet.GetCell("B4321"_pos)->GetValue(), CellInterface::Value(8640.0));
+    }
+}
+
+void TestDelimitedImportExport() {
+    Sheet sheet;
+    std::istringstream tsv("1\t=A1*2\r\n\n\t'=text\t\t=B1/0\nlast");
+    ImportDelimited(tsv, sheet);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ 4, 4 }));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value("=text"));
+    ASSERT_EQUAL(sheet.GetCell("A4"_pos)->GetText(), "last");
+
+    std::ostringstream texts;
+    ExportTexts(sheet, texts);
+    ASSERT_EQUAL(texts.str(), "1\t=A1*2\n\n\t'=text\t\t=B1/0\nlast\n");
+    std::ostringstream values;
+    ExportValues(sheet, values);
+    ASSERT_EQUAL(values.str(), "1\t2\n\n\t=text\t\t#ARITHM!\nlast\n");
+
+    Sheet copy;
+    std::istringstream input(texts.str());
+    ImportDelimited(input, copy);
+    std::ostringstream copy_texts;
+    copy.PrintTexts(copy_texts);
+    std::ostringstream sheet_texts;
+    sheet.PrintTexts(sheet_texts);
+    ASSERT_EQUAL(copy_texts.str(), sheet_texts.str());
+
+    // Ячейки предыдущих строк остаются, если строка с ошибкой отвергнута.
+    std::istringstream broken("=B2\n=A1+");
+    try {
+        ImportDelimited(broken, copy);
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    ASSERT_EQUAL(copy.GetCell("A1"_pos)->GetText(), "1");
+}
+
+void TestCsvQuoting() {
+    Sheet sheet;
+    std::istringstream csv("\"a,b\",\"say \"\"hi\"\"\"\r\n\"two\r\nlines\",,=1+2\n\"\",x\"y");
+    ImportDelimited(csv, sheet, DelimitedFormat::Csv());
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "a,b");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "say \"hi\"");
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "two\r\nlines");
+    ASSERT_EQUAL(sheet.GetCell("C2"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT(sheet.GetCell("A3"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetText(), "x\"y");
+
+    std::ostringstream output;
+    ExportTexts(sheet, output, DelimitedFormat::Csv());
+    ASSERT_EQUAL(output.str(), "\"a,b\",\"say \"\"hi\"\"\"\n\"two\r\nlines\",,=1+2\n,\"x\"\"y\"\n");
+
+    Sheet copy;
+    std::istringstream input(output.str());
+    ImportDelimited(input, copy, DelimitedFormat::Csv());
+    for (auto pos : { "A1"_pos, "B1"_pos, "A2"_pos, "C2"_pos, "B3"_pos }) {
+        ASSERT_EQUAL(copy.GetCell(pos)->GetText(), sheet.GetCell(pos)->GetText());
+    }
+    ASSERT_EQUAL(copy.GetPrintableSize(), sheet.GetPrintableSize());
+}
+
+void TestSnapshotRoundTrip() {
+    Sheet sheet;
+    sheet.SetCells({ { "A1"_pos, "2" },
+                     { "B1"_pos, "=+A1*-(A1+C3)" },
+                     { "C1"_pos, "'=escaped" },
+                     { "A2"_pos, "=B1/0" },
+                     { "B2"_pos, "=1.234567891/(A1-Z20)" },
+                     { "C2"_pos, "=" },
+                     { "D2"_pos, "=A2+1" },
+                     { "E1"_pos, "=SUM(A1:B1,C5:C3)" } });
+    // Значения части формул вычислены до сохранения, остальные — нет.
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(-4.0));
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    std::ostringstream output;
+    SheetSnapshot::Save(sheet, output);
+    std::string data = output.str();
+    auto loaded = SheetSnapshot::Load(data);
+
+    std::ostringstream expected_texts, loaded_texts;
+    sheet.PrintTexts(expected_texts);
+    loaded->PrintTexts(loaded_texts);
+    ASSERT_EQUAL(loaded_texts.str(), expected_texts.str());
+    ASSERT_EQUAL(loaded->GetPrintableSize(), sheet.GetPrintableSize());
+    ASSERT(loaded->GetCell("C3"_pos) != nullptr);
+    ASSERT_EQUAL(loaded->GetCell("B2"_pos)->GetReferencedCells(), (std::vector{ "A1"_pos, "Z20"_pos }));
+
+    // Сохранённые значения читаются из кэша без пересчёта.
+    loaded->ResetCacheStats();
+    ASSERT_EQUAL(loaded->GetCell("B1"_pos)->GetValue(), CellInterface::Value(-4.0));
+    ASSERT_EQUAL(loaded->GetCacheStats().misses.load(), 0u);
+    std::ostringstream expected_values, loaded_values;
+    sheet.PrintValues(expected_values);
+    loaded->PrintValues(loaded_values);
+    ASSERT_EQUAL(loaded_values.str(), expected_values.str());
+
+    // Граф зависимостей восстановлен: изменения распространяются, а циклы
+    // обнаруживаются.
+    loaded->SetCell("C3"_pos, "1");
+    ASSERT_EQUAL(loaded->GetCell("B1"_pos)->GetValue(), CellInterface::Value(-6.0));
+    ASSERT_EQUAL(loaded->GetCell("E1"_pos)->GetValue(), CellInterface::Value(-3.0));
+    try {
+        loaded->SetCell("A1"_pos, "=D2");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+
+    // Снимок в невыровненном буфере и из файла читается так же.
+    std::string shifted = " " + data;
+    auto from_unaligned = SheetSnapshot::Load(std::string_view(shifted).substr(1));
+    ASSERT_EQUAL(from_unaligned->GetCell("B2"_pos)->GetText(), "=1.23457/(A1-Z20)");
+    const std::string path = "snapshot_test.bin";
+    SheetSnapshot::SaveFile(*loaded, path);
+    auto from_file = SheetSnapshot::LoadFile(path);
+    std::remove(path.c_str());
+    ASSERT_EQUAL(from_file->GetCell("B1"_pos)->GetValue(), CellInterface::Value(-6.0));
+}
+
+void TestSnapshotRejectsCorruptData() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1+1");
+    std::ostringstream output;
+    SheetSnapshot::Save(sheet, output);
+    const std::string data = output.str();
+
+    std::vector<std::string> corrupt = { "", data.substr(0, data.size() - 8), data + std::string(8, '\0'),
+                                         "X" + data.substr(1) };
+    // Версия формата и код первой инструкции формулы: он идёт после
+    // заголовков файла и ячейки, числа 1 и позиции B1.
+    corrupt.push_back(data);
+    corrupt.back()[8] = static_cast<char>(SheetSnapshot::VERSION + 1);
+    corrupt.push_back(data);
+    corrupt.back()[32 + 40 + 8 + 8] = 100;
+    for (const auto& bytes : corrupt) {
+        try {
+            SheetSnapshot::Load(bytes);
+            ASSERT(false);
+        } catch (const SnapshotException&) {
+        }
+    }
+    try {
+        SheetSnapshot::LoadFile("no_such_snapshot.bin");
+        ASSERT(false);
+    } catch (const SnapshotException&) {
+    }
+}
+
+// Рёбра графа в снимке сверяются со ссылками формул, а ссылки проверяются на
+// циклы.
+void TestSnapshotRejectsTamperedEdges() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1+1");
+    sheet.SetCell("B1"_pos, "=C1");
+    std::ostringstream output;
+    SheetSnapshot::Save(sheet, output);
+    const std::string data = output.str();
+
+    // Рёбра B1 -> A1 и C1 -> B1 занимают последние 32 байта; их число
+    // записано в заголовке по смещению 24.
+    constexpr std::size_t EDGE_COUNT_OFFSET = 24;
+    constexpr std::size_t EDGE_SIZE = 16;
+    auto edge = [](Position from, Position to) {
+        std::int32_t fields[] = { from.row, from.col, to.row, to.col };
+        return std::string(reinterpret_cast<const char*>(fields), sizeof(fields));
+    };
+    auto with_edges = [&](std::string bytes, const std::vector<std::string>& edges) {
+        bytes.resize(bytes.size() - 2 * EDGE_SIZE);
+        for (const auto& record : edges) {
+            bytes += record;
+        }
+        std::uint64_t count = edges.size();
+        std::memcpy(bytes.data() + EDGE_COUNT_OFFSET, &count, sizeof(count));
+        return bytes;
+    };
+    ASSERT_EQUAL(data.substr(data.size() - 2 * EDGE_SIZE), edge("B1"_pos, "A1"_pos) + edge("C1"_pos, "B1"_pos));
+    ASSERT(SheetSnapshot::Load(with_edges(data, { edge("B1"_pos, "A1"_pos), edge("C1"_pos, "B1"_pos) })) != nullptr);
+
+    // B1 ссылается на A1 вместо C1: позиция ссылки идёт после заголовков
+    // файла и A1, данных A1 (число, позиция, три кода) и заголовка B1.
+    constexpr std::size_t B1_REFERENCE_OFFSET = 32 + 40 + 24 + 40;
+    std::string cyclic = data;
+    Position a1 = "A1"_pos;
+    ASSERT_EQUAL(cyclic.substr(B1_REFERENCE_OFFSET, sizeof(Position)), edge("C1"_pos, a1).substr(0, sizeof(Position)));
+    std::memcpy(cyclic.data() + B1_REFERENCE_OFFSET, &a1, sizeof(a1));
+
+    std::vector<std::string> tampered = {
+        // Пропущенное ребро.
+        with_edges(data, { edge("C1"_pos, "B1"_pos) }),
+        // Лишнее ребро.
+        with_edges(data, { edge("B1"_pos, "A1"_pos), edge("C1"_pos, "B1"_pos), edge("C1"_pos, "C1"_pos) }),
+        // Подменённое ребро при верном числе рёбер.
+        with_edges(data, { edge("C1"_pos, "A1"_pos), edge("C1"_pos, "B1"_pos) }),
+        // Рёбра не в том порядке.
+        with_edges(data, { edge("C1"_pos, "B1"_pos), edge("B1"_pos, "A1"_pos) }),
+        // Цикл A1 -> B1 -> A1 с согласованными рёбрами.
+        with_edges(cyclic, { edge("A1"_pos, "B1"_pos), edge("B1"_pos, "A1"_pos) }),
+    };
+    for (const auto& bytes : tampered) {
+        try {
+            SheetSnapshot::Load(bytes);
+            ASSERT(false);
+        } catch (const SnapshotException&) {
+        }
+    }
+}
+
+void TestPublishedVersions() {
+    Sheet sheet;
+    ASSERT(sheet.GetPublishedVersion() == nullptr);
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("C1"_pos, "'text");
+    sheet.SetCell("Z100"_pos, "=1/0");
+    auto first = sheet.PublishVersion();
+    ASSERT(sheet.GetPublishedVersion() == first);
+    ASSERT_EQUAL(first->GetNumber(), 1u);
+    ASSERT_EQUAL(first->GetValue("B1"_pos), CellInterface::Value(2.0));
+    ASSERT_EQUAL(first->GetValue("C1"_pos), CellInterface::Value("text"));
+    ASSERT_EQUAL(first->GetText("C1"_pos), "'text");
+    ASSERT_EQUAL(first->GetValue("Z100"_pos),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(first->GetValue("D5"_pos), CellInterface::Value(""));
+    ASSERT_EQUAL(first->GetPrintableSize(), (Size{ 100, 26 }));
+    {
+        std::ostringstream sheet_values, sheet_texts, version_values, version_texts;
+        sheet.PrintValues(sheet_values);
+        sheet.PrintTexts(sheet_texts);
+        first->PrintValues(version_values);
+        first->PrintTexts(version_texts);
+        ASSERT_EQUAL(version_values.str(), sheet_values.str());
+        ASSERT_EQUAL(version_texts.str(), sheet_texts.str());
+    }
+
+    // Опубликованная версия не меняется вместе с таблицей.
+    sheet.SetCell("A1"_pos, "5");
+    sheet.ClearCell("Z100"_pos);
+    sheet.SetCell("D2"_pos, "=B1+A1");
+    ASSERT(sheet.GetPublishedVersion() == first);
+    ASSERT_EQUAL(first->GetValue("B1"_pos), CellInterface::Value(2.0));
+    ASSERT_EQUAL(first->GetText("D2"_pos), "");
+
+    auto second = sheet.PublishVersion();
+    ASSERT_EQUAL(second->GetNumber(), 2u);
+    ASSERT_EQUAL(second->GetValue("B1"_pos), CellInterface::Value(10.0));
+    ASSERT_EQUAL(second->GetValue("D2"_pos), CellInterface::Value(15.0));
+    ASSERT_EQUAL(second->GetText("Z100"_pos), "");
+    ASSERT_EQUAL(second->GetPrintableSize(), (Size{ 2, 4 }));
+    ASSERT_EQUAL(first->GetValue("Z100"_pos),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    // Версии, собранные по изменённым блокам, совпадают с таблицей.
+    std::mt19937 random(7);
+    auto random_position = [&random] {
+        return Position{ static_cast<int>(random() % 40), static_cast<int>(random() % 40) };
+    };
+    for (int round = 0; round < 50; ++round) {
+        for (int edit = 0; edit < 20; ++edit) {
+            Position pos = random_position();
+            switch (random() % 4) {
+            case 0:
+                sheet.ClearCell(pos);
+                break;
+            case 1:
+                sheet.SetCell(pos, std::to_string(random() % 100));
+                break;
+            default:
+                try {
+                    sheet.SetCell(pos, "=" + random_position().ToString() + "+SUM("
+                                           + random_position().ToString() + ":" + random_position().ToString()
+                                           + ")");
+                } catch (const CircularDependencyException&) {
+                }
+            }
+        }
+        auto version = sheet.PublishVersion();
+        std::ostringstream sheet_values, sheet_texts, version_values, version_texts;
+        sheet.PrintValues(sheet_values);
+        sheet.PrintTexts(sheet_texts);
+        version->PrintValues(version_values);
+        version->PrintTexts(version_texts);
+        ASSERT_EQUAL(version_values.str(), sheet_values.str());
+        ASSERT_EQUAL(version_texts.str(), sheet_texts.str());
+    }
+}
+
+// Писатель меняет группу ячеек из разных блоков и публикует версию после
+// каждого изменения; читатели в других потоках должны видеть все ячейки
+// группы и их сумму из одной и той же версии.
+void TestPublishedVersionsConcurrentReaders() {
+    constexpr int CELLS = 20;
+    constexpr int ROUNDS = 500;
+    constexpr int READERS = 3;
+    auto cell_position = [](int i) {
+        return Position{ i * 9, i * 5 };
+    };
+    const Position total_position{ 3, 120 };
+
+    Sheet sheet;
+    std::string total_formula = "=0";
+    for (int i = 0; i < CELLS; ++i) {
+        sheet.SetCell(cell_position(i), "0");
+        total_formula += "+" + cell_position(i).ToString();
+    }
+    sheet.SetCell(total_position, total_formula);
+    sheet.PublishVersion();
+
+    std::atomic<bool> done = false;
+    std::atomic<int> failures = 0;
+    std::atomic<std::size_t> reads = 0;
+    std::vector<std::thread> readers;
+    for (int reader = 0; reader < READERS; ++reader) {
+        readers.emplace_back([&] {
+            std::uint64_t last_number = 0;
+            while (!done.load()) {
+                auto version = sheet.GetPublishedVersion();
+                if (version->GetNumber() < last_number) {
+                    ++failures;
+                }
+                last_number = version->GetNumber();
+                std::string round = version->GetText(cell_position(0));
+                for (int i = 1; i < CELLS; ++i) {
+                    if (!(version->GetValue(cell_position(i)) == CellInterface::Value(round))) {
+                        ++failures;
+                    }
+                }
+                if (!(version->GetValue(total_position) == CellInterface::Value(std::stod(round) * CELLS))) {
+                    ++failures;
+                }
+                ++reads;
+            }
+        });
+    }
+
+    for (int round = 1; round <= ROUNDS; ++round) {
+        for (int i = 0; i < CELLS; ++i) {
+            sheet.SetCell(cell_position(i), std::to_string(round));
+        }
+        sheet.PublishVersion();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(failures.load(), 0);
+    ASSERT(reads.load() > 0);
+    ASSERT_EQUAL(sheet.GetPublishedVersion()->GetNumber(), static_cast<std::uint64_t>(ROUNDS + 1));
+}
+
+#ifdef SPREADSHEET_WITH_ANTLR
+void TestFormulaParsersAgree() {
+    // Случайные цепочки из символов, встречающихся в формулах.
+    const std::string alphabet = "0123456789.eE+-*/()AZ \t,:SUMX";
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<std::size_t> symbol(0, alphabet.size() - 1);
+    std::uniform_int_distribution<int> length(1, 10);
+    for (int i = 0; i < 20000; ++i) {
+        std::string expr;
+        for (int j = length(random); j > 0; --j) {
+            expr += alphabet[symbol(random)];
+        }
+        ASSERT_EQUAL(DescribeParse(expr, FormulaParserBackend::Native),
+                     DescribeParse(expr, FormulaParserBackend::Antlr));
+    }
+
+    // Случайные цепочки лексем: посимвольно имена функций почти не
+    // складываются.
+    const std::vector<std::string> tokens = { "SUM(", "MIN(", "MAX(", "AVERAGE(", "COUNT(", "A1", "B2", "ZZ9",
+                                              ":", ",", "(", ")", "1", ".5", "+", "-", "*", "/", " " };
+    std::uniform_int_distribution<std::size_t> token(0, tokens.size() - 1);
+    for (int i = 0; i < 20000; ++i) {
+        std::string expr;
+        for (int j = length(random); j > 0; --j) {
+            expr += tokens[token(random)];
+        }
+        ASSERT_EQUAL(DescribeParse(expr, FormulaParserBackend::Native),
+                     DescribeParse(expr, FormulaParserBackend::Antlr));
+    }
+}
+#endif
 }  // namespace
 
 int main() {
@@ -369,4 +2027,43 @@ int main() {
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestFormulaValueCache);
+    RUN_TEST(tr, TestFormulaBinding);
+    RUN_TEST(tr, TestTextNumericValue);
+    RUN_TEST(tr, TestCellValueStore);
+    RUN_TEST(tr, TestStringPool);
+    RUN_TEST(tr, TestValueView);
+    RUN_TEST(tr, TestRecalculationOrder);
+    RUN_TEST(tr, TestThreadPoolSubmitFailure);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestCircularDependencyDetection);
+    RUN_TEST(tr, TestTiledGrid);
+    RUN_TEST(tr, TestRangeIndex);
+    RUN_TEST(tr, TestDependencyGraph);
+    RUN_TEST(tr, TestCellIdSets);
+    RUN_TEST(tr, TestPrintSparse);
+    RUN_TEST(tr, TestPrintableSizeTracking);
+    RUN_TEST(tr, TestBytecodeMatchesTree);
+    RUN_TEST(tr, TestErrorValues);
+    RUN_TEST(tr, TestNativeFormulaParser);
+    RUN_TEST(tr, TestFormulaParserCorpus);
+    RUN_TEST(tr, TestAggregateFunctions);
+    RUN_TEST(tr, TestRangeDependencies);
+    RUN_TEST(tr, TestDependencyMaintenance);
+    RUN_TEST(tr, TestArena);
+    RUN_TEST(tr, TestFormulaMemoryUsage);
+    RUN_TEST(tr, TestSetCells);
+    RUN_TEST(tr, TestSetCellsIntoEmptySheet);
+    RUN_TEST(tr, TestSetCellsRejectsWholeBatch);
+    RUN_TEST(tr, TestSetCellsParallelParse);
+    RUN_TEST(tr, TestDelimitedImportExport);
+    RUN_TEST(tr, TestCsvQuoting);
+    RUN_TEST(tr, TestSnapshotRoundTrip);
+    RUN_TEST(tr, TestSnapshotRejectsCorruptData);
+    RUN_TEST(tr, TestSnapshotRejectsTamperedEdges);
+    RUN_TEST(tr, TestPublishedVersions);
+    RUN_TEST(tr, TestPublishedVersionsConcurrentReaders);
+#ifdef SPREADSHEET_WITH_ANTLR
+    RUN_TEST(tr, TestFormulaParsersAgree);
+#endif
 }
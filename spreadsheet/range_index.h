@@ -0,0 +1,205 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Словарь диапазон -> значение с поиском всех диапазонов, содержащих ячейку.
+//
+// Диапазоны разложены по двухуровневому дереву интервалов с неизменными
+// центрами: строки 0..MAX_ROWS-1 делятся пополам, и диапазон попадает в первый
+// узел, центр которого лежит между его строками, а внутри узла так же
+// выбирается узел по столбцам. Поэтому каждый диапазон хранится ровно в одной
+// корзине, и память пропорциональна числу диапазонов, а не их площади.
+//
+// Все диапазоны корзины содержат ячейку (центр строк, центр столбцов). Поиск
+// проходит не больше log(MAX_ROWS) узлов строк и в каждом не больше
+// log(MAX_COLS) узлов столбцов; в корзине просматриваются только диапазоны,
+// подходящие по строкам, — они упорядочены по верхней и по нижней строке.
+template <typename T>
+class RangeIndex {
+public:
+    using Item = std::pair<const Range, T>;
+
+    RangeIndex() = default;
+    RangeIndex(const RangeIndex&) = delete;
+    RangeIndex& operator=(const RangeIndex&) = delete;
+
+    // Значение диапазона; если диапазона нет, он добавляется.
+    T& operator[](const Range& range) {
+        auto [it, inserted] = items_.try_emplace(range);
+        if (inserted) {
+            Bucket& bucket = rows_[FindCenter(range.from.row, range.to.row, Position::MAX_ROWS)]
+                                 .columns[FindCenter(range.from.col, range.to.col, Position::MAX_COLS)];
+            Item* item = &*it;
+            bucket.by_top.insert(std::upper_bound(bucket.by_top.begin(), bucket.by_top.end(), item, TopLess), item);
+            bucket.by_bottom.insert(
+                std::upper_bound(bucket.by_bottom.begin(), bucket.by_bottom.end(), item, BottomGreater), item);
+        }
+        return it->second;
+    }
+
+    T* Find(const Range& range) {
+        auto it = items_.find(range);
+        return it != items_.end() ? &it->second : nullptr;
+    }
+
+    const T* Find(const Range& range) const {
+        auto it = items_.find(range);
+        return it != items_.end() ? &it->second : nullptr;
+    }
+
+    bool Erase(const Range& range) {
+        auto it = items_.find(range);
+        if (it == items_.end()) {
+            return false;
+        }
+
+        auto row_node = rows_.find(FindCenter(range.from.row, range.to.row, Position::MAX_ROWS));
+        auto bucket = row_node->second.columns.find(FindCenter(range.from.col, range.to.col, Position::MAX_COLS));
+        Item* item = &*it;
+        auto& by_top = bucket->second.by_top;
+        by_top.erase(std::find(by_top.begin(), by_top.end(), item));
+        auto& by_bottom = bucket->second.by_bottom;
+        by_bottom.erase(std::find(by_bottom.begin(), by_bottom.end(), item));
+        if (by_top.empty()) {
+            row_node->second.columns.erase(bucket);
+            if (row_node->second.columns.empty()) {
+                rows_.erase(row_node);
+            }
+        }
+        items_.erase(it);
+        return true;
+    }
+
+    std::size_t Size() const {
+        return items_.size();
+    }
+
+    bool Empty() const {
+        return items_.empty();
+    }
+
+    // Вызывает func(const Range&, T&) для всех диапазонов, содержащих pos.
+    template <typename Func>
+    void ForEachContaining(Position pos, Func&& func) {
+        DoForEachContaining(pos, [&func](Item& item) { func(item.first, item.second); });
+    }
+
+    template <typename Func>
+    void ForEachContaining(Position pos, Func&& func) const {
+        DoForEachContaining(pos, [&func](const Item& item) { func(item.first, item.second); });
+    }
+
+    // Вызывает func(const Range&, const T&) для всех диапазонов по возрастанию.
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        for (const auto& [range, value] : items_) {
+            func(range, value);
+        }
+    }
+
+private:
+    struct Bucket {
+        // Диапазоны по возрастанию верхней строки и по убыванию нижней.
+        std::vector<Item*> by_top;
+        std::vector<Item*> by_bottom;
+    };
+
+    struct RowNode {
+        std::unordered_map<int, Bucket> columns;
+    };
+
+    static bool TopLess(const Item* lhs, const Item* rhs) {
+        return lhs->first.from.row < rhs->first.from.row;
+    }
+
+    static bool BottomGreater(const Item* lhs, const Item* rhs) {
+        return lhs->first.to.row > rhs->first.to.row;
+    }
+
+    // Центр первого узла на пути от корня, попадающего в [from, to]. Центр
+    // однозначно задаёт узел, поэтому служит ключом.
+    static int FindCenter(int from, int to, int size) {
+        int low = 0;
+        int high = size - 1;
+        while (true) {
+            int center = low + (high - low) / 2;
+            if (to < center) {
+                high = center - 1;
+            }
+            else if (from > center) {
+                low = center + 1;
+            }
+            else {
+                return center;
+            }
+        }
+    }
+
+    // Вызывает visit(center) для каждого узла на пути от корня к value.
+    template <typename Visit>
+    static void ForEachCenterOnPath(int value, int size, Visit&& visit) {
+        int low = 0;
+        int high = size - 1;
+        while (low <= high) {
+            int center = low + (high - low) / 2;
+            visit(center);
+            if (value < center) {
+                high = center - 1;
+            }
+            else if (value > center) {
+                low = center + 1;
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+    template <typename Func>
+    void DoForEachContaining(Position pos, Func&& func) const {
+        if (rows_.empty() || !pos.IsValid()) {
+            return;
+        }
+        ForEachCenterOnPath(pos.row, Position::MAX_ROWS, [&](int row_center) {
+            auto row_node = rows_.find(row_center);
+            if (row_node == rows_.end()) {
+                return;
+            }
+            const auto& columns = row_node->second.columns;
+            ForEachCenterOnPath(pos.col, Position::MAX_COLS, [&](int col_center) {
+                auto bucket = columns.find(col_center);
+                if (bucket == columns.end()) {
+                    return;
+                }
+                // Все диапазоны корзины содержат строку row_center, поэтому
+                // по строкам проверяется только одна граница.
+                auto visit = [&](const auto& items, auto row_fits) {
+                    for (Item* item : items) {
+                        if (!row_fits(item->first)) {
+                            break;
+                        }
+                        if (item->first.from.col <= pos.col && pos.col <= item->first.to.col) {
+                            func(*item);
+                        }
+                    }
+                };
+                if (pos.row < row_center) {
+                    visit(bucket->second.by_top, [&pos](const Range& range) { return range.from.row <= pos.row; });
+                }
+                else {
+                    visit(bucket->second.by_bottom, [&pos](const Range& range) { return range.to.row >= pos.row; });
+                }
+            });
+        });
+    }
+
+    std::map<Range, T> items_;
+    std::unordered_map<int, RowNode> rows_;
+};
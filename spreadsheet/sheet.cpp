@@ -1,11 +1,20 @@
 #include "sheet.h"
 
 #include "cell.h"
+#include "FormulaAST.h"
 #include "common.h"
+#include "sheet_version.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
 #include <iostream>
 #include <optional>
+#include <stdexcept>
 
 using namespace std::literals;
 
@@ -22,49 +31,297 @@ void Sheet::SetCell(Position pos, std::string text) {
         throw InvalidPositionException("Invalid position for SetCell()");
     }
 
-    auto cell = GetCell(pos);
-    if (cell) {
+    CellId id = cells_.FindId(pos);
+    if (id != NO_CELL_ID) {
+        Cell* cell = &cells_[id];
+        bool was_empty = cell->IsEmpty();
         std::string old_text = cell->GetText();
-        InvalidateCell(pos);
-        DeleteDependencies(pos);
-        dynamic_cast<Cell*>(cell)->Clear();
-        dynamic_cast<Cell*>(cell)->Set(text);
-        if (dynamic_cast<Cell*>(cell)->IsCyclicDependent(dynamic_cast<Cell*>(cell), pos)) {
-            dynamic_cast<Cell*>(cell)->Set(std::move(old_text));
+        std::vector<Position> old_referenced_cells = cell->GetReferencedCells();
+        std::vector<Range> old_referenced_ranges = cell->GetReferencedRanges();
+        cell->Set(text);
+        std::vector<Position> referenced_cells = cell->GetReferencedCells();
+        std::vector<Range> referenced_ranges = cell->GetReferencedRanges();
+        if (HasCircularDependency(id, referenced_cells, referenced_ranges)) {
+            cell->Set(std::move(old_text));
+            if (cell->IsFormula()) {
+                dirty_cells_.Insert(id);
+            }
             throw CircularDependencyException("Circular dependency detected!");
         }
-        for (const auto& ref_cell : dynamic_cast<Cell*>(cell)->GetReferencedCells()) {
-            AddDependentCell(ref_cell, pos);
+        DeleteDependencies(id, old_referenced_cells);
+        DeleteRangeDependencies(id, old_referenced_ranges);
+        AddDependencies(id, referenced_cells);
+        AddRangeDependencies(id, referenced_ranges);
+        DeleteUnreferencedEmptyCells(old_referenced_cells);
+        if (was_empty && !cell->IsEmpty()) {
+            AddToPrintableArea(pos);
         }
+        else if (!was_empty && cell->IsEmpty()) {
+            RemoveFromPrintableArea(pos);
+        }
+        dirty_cells_.Erase(id);
+        InvalidateCell(pos);
     }
     else {
-        auto new_cell = std::make_unique<Cell>(*this);
-        new_cell->Set(text);
-        if (new_cell->IsCyclicDependent(new_cell.get(), pos)) {
+        Cell& new_cell = cells_.EmplaceWithId(pos, *this);
+        try {
+            new_cell.Set(text);
+        }
+        catch (...) {
+            cells_.Erase(pos);
+            throw;
+        }
+        std::vector<Position> referenced_cells = new_cell.GetReferencedCells();
+        std::vector<Range> referenced_ranges = new_cell.GetReferencedRanges();
+        id = cells_.FindId(pos);
+        if (HasCircularDependency(id, referenced_cells, referenced_ranges)) {
+            cells_.Erase(pos);
             throw CircularDependencyException("Circular dependency detected!");
         }
-        for (const auto& ref_cell : new_cell->GetReferencedCells()) {
-            AddDependentCell(ref_cell, pos);
+        AddDependencies(id, referenced_cells);
+        AddRangeDependencies(id, referenced_ranges);
+        if (!new_cell.IsEmpty()) {
+            AddToPrintableArea(pos);
+        }
+        InvalidateCell(pos);
+    }
+#ifdef SPREADSHEET_VALIDATE_DEPENDENCIES
+    ValidateDependencies();
+#endif
+}
+
+BulkCircularDependencyException::BulkCircularDependencyException(std::vector<Position> cells)
+    : CircularDependencyException("Circular dependency detected in " + std::to_string(cells.size()) + " cells")
+    , cells_(std::move(cells)) {
+}
+
+const std::vector<Position>& BulkCircularDependencyException::GetCells() const {
+    return cells_;
+}
+
+namespace {
+    constexpr std::size_t PARSE_CHUNK_SIZE = 1024;
+
+    // Все ссылки формулы из ячейки pos ведут в ячейки, стоящие раньше неё
+    // при построчном обходе: выше или левее в той же строке.
+    bool RefersOnlyBackward(Position pos, const FormulaInterface& formula) {
+        const FormulaAST& ast = formula.GetAST();
+        return std::all_of(ast.GetCells().begin(), ast.GetCells().end(),
+                           [&pos](const Position& cell) { return cell < pos; })
+            && std::all_of(ast.GetRanges().begin(), ast.GetRanges().end(),
+                           [&pos](const Range& range) { return range.to < pos; });
+    }
+
+    // Разбирает тексты ячеек набора и, пока дерево формулы в кэше, отмечает
+    // формулы со ссылками вперёд.
+    void ParseCells(const std::vector<std::pair<Position, std::string>>& cells, const std::vector<std::size_t>& order,
+                    std::vector<std::unique_ptr<FormulaInterface>>& formulas,
+                    std::vector<std::uint8_t>& refers_forward, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto& [pos, text] = cells[order[i]];
+            formulas[i] = Cell::ParseText(text);
+            refers_forward[i] = formulas[i] && !RefersOnlyBackward(pos, *formulas[i]);
+        }
+    }
+
+    bool HasReferences(const FormulaInterface* formula) {
+        return formula && (!formula->GetAST().GetCells().empty() || !formula->GetAST().GetRanges().empty());
+    }
+
+    // Индекс позиции pos среди cells[order[from]], cells[order[from + 1]], ...
+    // или order.size(), если её там нет. Ссылки обычно ведут в соседние
+    // ячейки, поэтому поиск идёт от from скачками удваивающейся длины.
+    std::size_t FindOrderedCell(const std::vector<std::pair<Position, std::string>>& cells,
+                                const std::vector<std::size_t>& order, std::size_t from, Position pos) {
+        std::size_t bound = 1;
+        while (from + bound < order.size() && cells[order[from + bound]].first < pos) {
+            bound *= 2;
+        }
+        auto begin = order.begin() + from + bound / 2;
+        auto end = order.begin() + std::min(from + bound + 1, order.size());
+        auto it = std::lower_bound(begin, end, pos, [&cells](std::size_t index, Position pos) {
+            return cells[index].first < pos;
+        });
+        return it != end && cells[*it].first == pos ? it - order.begin() : order.size();
+    }
+}  // namespace
+
+void Sheet::SetCells(std::vector<std::pair<Position, std::string>> cells) {
+    for (const auto& [pos, text] : cells) {
+        if (!pos.IsValid()) {
+            throw InvalidPositionException("Invalid position for SetCells()");
+        }
+    }
+
+    // Построчный порядок ускоряет вставку в сетку; из повторов остаётся
+    // последний. Выгрузки обычно уже упорядочены, и тогда сортировка не нужна.
+    std::vector<std::size_t> order(cells.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto position_less = [&cells](std::size_t lhs, std::size_t rhs) {
+        return cells[lhs].first < cells[rhs].first;
+    };
+    if (!std::is_sorted(order.begin(), order.end(), position_less)) {
+        std::stable_sort(order.begin(), order.end(), position_less);
+    }
+    std::size_t unique_count = 0;
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        if (i + 1 == order.size() || !(cells[order[i + 1]].first == cells[order[i]].first)) {
+            order[unique_count++] = order[i];
+        }
+    }
+    order.resize(unique_count);
+
+    // Формулы не зависят друг от друга и при наличии пула пересчёта
+    // разбираются его потоками. Разбор ANTLR идёт последовательно: его
+    // лексер и парсер делят между потоками кэши DFA среды выполнения.
+    std::vector<std::unique_ptr<FormulaInterface>> formulas(order.size());
+    std::vector<std::uint8_t> refers_forward(order.size());
+    if (recalc_pool_ && order.size() > PARSE_CHUNK_SIZE
+        && GetFormulaParserBackend() == FormulaParserBackend::Native) {
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        for (std::size_t begin = 0; begin < order.size(); begin += PARSE_CHUNK_SIZE) {
+            std::size_t end = std::min(begin + PARSE_CHUNK_SIZE, order.size());
+            recalc_pool_->Submit([&cells, &order, &formulas, &refers_forward, &error_mutex, &error, begin, end] {
+                try {
+                    ParseCells(cells, order, formulas, refers_forward, begin, end);
+                }
+                catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    error = std::current_exception();
+                }
+            });
+        }
+        recalc_pool_->Wait();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    else {
+        ParseCells(cells, order, formulas, refers_forward, 0, order.size());
+    }
+
+    // Вдоль любого цикла позиция при построчном обходе хотя бы раз не
+    // убывает, то есть цикл содержит ссылку на ту же или более позднюю ячейку
+    // (ниже или правее в той же строке), причём на формулу со ссылками. Если
+    // на листе ссылок нет, такой формулой может быть только формула набора, и
+    // когда ни одна ссылка вперёд в неё не ведёт, полный поиск циклов не
+    // нужен. Так выглядит загрузка выгрузки в пустой лист.
+    bool may_have_cycles = cells_dependencies_.GetEdgeCount() > 0 || range_edge_count_ > 0;
+    for (std::size_t i = 0; i < order.size() && !may_have_cycles; ++i) {
+        if (!refers_forward[i]) {
+            continue;
+        }
+        Position pos = cells[order[i]].first;
+        const FormulaAST& ast = formulas[i]->GetAST();
+        may_have_cycles = std::any_of(ast.GetCells().begin(), ast.GetCells().end(),
+                                      [&](const Position& ref_cell) {
+                                          if (ref_cell < pos) {
+                                              return false;
+                                          }
+                                          std::size_t ref = FindOrderedCell(cells, order, i, ref_cell);
+                                          return ref < order.size() && HasReferences(formulas[ref].get());
+                                      })
+            || std::any_of(ast.GetRanges().begin(), ast.GetRanges().end(),
+                           [&pos](const Range& range) { return !(range.to < pos); });
+    }
+    if (may_have_cycles) {
+        TiledGrid<const FormulaInterface*> new_formulas;
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            new_formulas.Emplace(cells[order[i]].first, formulas[i].get());
+        }
+        if (auto cyclic_cells = FindCyclicCells(new_formulas); !cyclic_cells.empty()) {
+            throw BulkCircularDependencyException(std::move(cyclic_cells));
+        }
+    }
+
+    // Проверки пройдены, дальше таблица только изменяется. Ячейки
+    // обрабатываются по возрастанию позиций, поэтому новые зависимые обычно
+    // дописываются в конец списков графа. В пустом листе все зависимые новых
+    // ячеек — формулы набора, и их достаточно пометить устаревшими по ходу
+    // записи, не обходя граф.
+    bool sheet_was_empty = cells_.Empty();
+    std::vector<Position> old_referenced_cells;
+    std::vector<Position> changed;
+    if (!sheet_was_empty) {
+        changed.reserve(order.size());
+    }
+    dirty_cells_.Reserve(dirty_cells_.Size() + order.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        auto& [pos, text] = cells[order[i]];
+        CellId id = cells_.FindId(pos);
+        bool was_empty = true;
+        if (id != NO_CELL_ID) {
+            const Cell& cell = cells_[id];
+            was_empty = cell.IsEmpty();
+            std::vector<Position> referenced_cells = cell.GetReferencedCells();
+            DeleteDependencies(id, referenced_cells);
+            old_referenced_cells.insert(old_referenced_cells.end(), referenced_cells.begin(),
+                                        referenced_cells.end());
+            DeleteRangeDependencies(id, cell.GetReferencedRanges());
+        }
+        else {
+            id = cells_.EmplaceWithId(pos, *this).GetId();
+        }
+        Cell* cell = &cells_[id];
+        const FormulaInterface* formula = formulas[i].get();
+        cell->Set(std::move(text), std::move(formulas[i]));
+
+        if (was_empty && !cell->IsEmpty()) {
+            AddToPrintableArea(pos);
+        }
+        else if (!was_empty && cell->IsEmpty()) {
+            RemoveFromPrintableArea(pos);
+        }
+        // Ссылки читаются из дерева формулы без копирования в списки.
+        if (formula) {
+            const FormulaAST& ast = formula->GetAST();
+            for (const Position& ref_cell : ast.GetCells()) {
+                cells_dependencies_.AddEdge(EnsureCell(ref_cell), id);
+            }
+            for (const Range& range : ast.GetRanges()) {
+                range_edge_count_ += range_dependencies_[range].Insert(id);
+            }
+        }
+        if (sheet_was_empty) {
+            MarkUnpublished(pos, true);
+            if (formula) {
+                dirty_cells_.Insert(id);
+            }
+        }
+        else {
+            changed.push_back(pos);
         }
-        sheet_[pos] = std::move(new_cell);
-        UpdatePrintableSize();
     }
+    DeleteUnreferencedEmptyCells(old_referenced_cells);
+
+    if (!sheet_was_empty) {
+        InvalidateCells(std::move(changed));
+    }
+#ifdef SPREADSHEET_VALIDATE_DEPENDENCIES
+    ValidateDependencies();
+#endif
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid position for GetCell()");
     }
-    auto it = sheet_.find(pos);
-    return (it != sheet_.end()) ? it->second.get() : nullptr;
+    return cells_.Find(pos);
 }
 
 CellInterface* Sheet::GetCell(Position pos) {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid position for GetCell()");
     }
-    auto it = sheet_.find(pos);
-    return (it != sheet_.end()) ? it->second.get() : nullptr;
+    return cells_.Find(pos);
+}
+
+void Sheet::ForEachCellInRange(const Range& range,
+                               const std::function<bool(Position, const CellInterface&)>& func) const {
+    cells_.ForEachInRangeWhile(range, [&func](Position pos, const Cell& cell) {
+        return func(pos, cell);
+    });
 }
 
 void Sheet::ClearCell(Position pos) {
@@ -72,18 +329,34 @@ void Sheet::ClearCell(Position pos) {
         throw InvalidPositionException("Invalid position for ClearCell()");
     }
 
-    if (CellExists(pos)) {
-        sheet_.erase(pos);
-        area_is_valid_ = false;
-        UpdatePrintableSize();
+    if (CellId id = cells_.FindId(pos); id != NO_CELL_ID) {
+        Cell* cell = &cells_[id];
+        std::vector<Position> referenced_cells = cell->GetReferencedCells();
+        DeleteDependencies(id, referenced_cells);
+        DeleteRangeDependencies(id, cell->GetReferencedRanges());
+        if (!cell->IsEmpty()) {
+            RemoveFromPrintableArea(pos);
+        }
+        dirty_cells_.Erase(id);
+        // Ячейка, на которую ссылаются формулы, остаётся пустой: рёбра графа
+        // всегда ведут из существующих ячеек. Кэши сбрасываются после
+        // очистки, иначе формула из ячейки снова попала бы во фронт пересчёта.
+        if (cells_dependencies_.HasDependents(id)) {
+            cell->Clear();
+        }
+        else {
+            cells_.Erase(pos);
+        }
+        InvalidateCell(pos);
+        DeleteUnreferencedEmptyCells(referenced_cells);
     }
+#ifdef SPREADSHEET_VALIDATE_DEPENDENCIES
+    ValidateDependencies();
+#endif
 }
 
 Size Sheet::GetPrintableSize() const {
-    if (area_is_valid_) {
-        return Size{ max_row_, max_col_ };
-    }
-    throw InvalidPositionException("The size of printable area has not been updated");
+    return Size{ occupied_rows_.GetBound(), occupied_cols_.GetBound() };
 }
 
 std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) 
@@ -92,12 +365,18 @@ std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value
     return output;
 }
 
+std::ostream& operator<<(std::ostream& output, const CellInterface::ValueView& value)
+{
+    std::visit([&](const auto& val) {output << val;}, value);
+    return output;
+}
+
 void Sheet::PrintValues(std::ostream& output) const {
     Print(output, [](std::ostream& out, const CellInterface* cell) {
         if (!cell)
             out << "";
         else
-            out << cell->GetValue();
+            out << cell->GetValueView();
     });
 }
 
@@ -110,60 +389,647 @@ void Sheet::PrintTexts(std::ostream& output) const {
     });
 }
 
+// Обходит только существующие ячейки в порядке строк; пропуски между ними
+// заполняются разделителями.
 void Sheet::Print(std::ostream& output,
                   std::function<void(std::ostream&, const CellInterface*)> print_func) const {
-    if (sheet_.empty()) {
+    if (cells_.Empty()) {
         return;
     }
     Size printable_area = GetPrintableSize();
-    for (int row = 0; row < printable_area.rows; ++row) {
-        for (int col = 0; col < printable_area.cols; ++col) {
-            const CellInterface* cell = GetCell({ row, col });
-            print_func(output, cell);
-            if (col < printable_area.cols - 1) {
-                output << "\t";
-            }
+
+    int row = 0;
+    int separators = 0;
+    auto finish_row = [&]() {
+        for (; separators < printable_area.cols - 1; ++separators) {
+            output << "\t";
         }
         output << "\n";
+        ++row;
+        separators = 0;
+    };
+
+    cells_.ForEach([&](Position pos, const Cell& cell) {
+        if (pos.row >= printable_area.rows || pos.col >= printable_area.cols) {
+            return;
+        }
+        while (row < pos.row) {
+            finish_row();
+        }
+        for (; separators < pos.col; ++separators) {
+            output << "\t";
+        }
+        print_func(output, &cell);
+    });
+    while (row < printable_area.rows) {
+        finish_row();
+    }
+}
+
+template <typename Func>
+void Sheet::ForEachDependentCell(Position pos, CellId id, Func&& func) const {
+    if (id != NO_CELL_ID) {
+        cells_dependencies_.ForEachDependent(id, func);
     }
+    range_dependencies_.ForEachContaining(pos, [&func](const Range&, const DependentList& dependent_cells) {
+        for (CellId dependent_id : dependent_cells) {
+            func(dependent_id);
+        }
+    });
 }
 
+// Добавляет изменённую ячейку и все зависящие от неё формулы во фронт
+// пересчёта. Значение формулы кэшируется только после вычисления всех ячеек,
+// от которых она зависит, поэтому если зависимая ячейка уже во фронте и её кэш
+// сброшен, то там же и все ячейки, зависящие от неё, и обход можно не
+// продолжать.
 void Sheet::InvalidateCell(const Position& pos) {
-    for (const auto& dependent_cell : GetDependentCells(pos)) {
-        auto cell = GetCell(dependent_cell);
-        dynamic_cast<Cell*>(cell)->InvalidateCache();
-        InvalidateCell(dependent_cell);
+    InvalidateCells({ pos });
+}
+
+// Изменённой ячейки уже может не быть на листе, но от неё по-прежнему могут
+// зависеть формулы с диапазонами.
+void Sheet::InvalidateCells(const std::vector<Position>& changed) {
+    std::vector<CellId> frontier;
+    auto visit_dependent = [this, &frontier](CellId dependent_id) {
+        Cell& cell = cells_[dependent_id];
+        if (!dirty_cells_.Insert(dependent_id) && !cell.IsCacheValid()) {
+            return;
+        }
+        cell.InvalidateCache();
+        MarkUnpublished(cells_.GetPosition(dependent_id), false);
+        frontier.push_back(dependent_id);
+    };
+
+    for (const auto& pos : changed) {
+        MarkUnpublished(pos, true);
+        CellId id = cells_.FindId(pos);
+        if (id != NO_CELL_ID && cells_[id].IsFormula()) {
+            dirty_cells_.Insert(id);
+        }
+        ForEachDependentCell(pos, id, visit_dependent);
+    }
+
+    while (!frontier.empty()) {
+        CellId current = frontier.back();
+        frontier.pop_back();
+        ForEachDependentCell(cells_.GetPosition(current), current, visit_dependent);
     }
 }
 
-void Sheet::AddDependentCell(const Position& main_cell, const Position& dependent_cell) {
-    cells_dependencies_[main_cell].insert(dependent_cell);
+void Sheet::MarkUnpublished(Position pos, bool text_changed) {
+    if (published_version_) {
+        unpublished_changes_.Add(pos, text_changed);
+    }
 }
 
-const std::set<Position> Sheet::GetDependentCells(const Position& pos)
-{
-    auto it = cells_dependencies_.find(pos);
-    return (it != cells_dependencies_.end()) ? it->second : std::set<Position>{};
+// Подграф формул фронта пересчёта. Рёбра ведут от ячейки к зависящим от неё
+// ячейкам фронта, in_degree — число ячеек фронта, от которых зависит ячейка.
+struct Sheet::DirtyGraph {
+    std::vector<Cell*> cells;
+    std::vector<std::vector<std::size_t>> dependents;
+    std::vector<int> in_degree;
+};
+
+namespace {
+    // Меньшие фронты пересчитываются в вызывающем потоке: накладные расходы
+    // на планирование задач превысили бы выигрыш.
+    constexpr std::size_t MIN_PARALLEL_RECALC_CELLS = 64;
+
+    // Поднимает флаг на время жизни объекта и сбрасывает его при выходе, в
+    // том числе по исключению.
+    class FlagGuard {
+    public:
+        explicit FlagGuard(bool& flag) : flag_(flag) {
+            flag_ = true;
+        }
+        FlagGuard(const FlagGuard&) = delete;
+        FlagGuard& operator=(const FlagGuard&) = delete;
+        ~FlagGuard() {
+            flag_ = false;
+        }
+
+    private:
+        bool& flag_;
+    };
+
+    // Вычисляет формулы фронта задачами пула. Задача ячейки ставится в очередь,
+    // когда вычислены все ячейки фронта, от которых она зависит, поэтому каждая
+    // формула вычисляется ровно один раз и читает только готовые значения.
+    class ParallelRecalculation {
+    public:
+        ParallelRecalculation(const std::vector<Cell*>& cells,
+                              const std::vector<std::vector<std::size_t>>& dependents,
+                              const std::vector<int>& in_degree,
+                              ThreadPool& pool)
+            : cells_(cells)
+            , dependents_(dependents)
+            , in_degree_(std::make_unique<std::atomic<int>[]>(cells.size()))
+            , pool_(pool)
+        {
+            for (std::size_t i = 0; i < cells.size(); ++i) {
+                in_degree_[i].store(in_degree[i], std::memory_order_relaxed);
+            }
+        }
+
+        // Начальные ячейки собираются до запуска первой задачи: иначе ячейку,
+        // счётчик которой уже обнулила выполняющаяся задача, запланировали бы
+        // дважды.
+        //
+        // Задачи пула не должны выбрасывать исключений, поэтому первое
+        // исключение запоминается и выбрасывается после завершения всех задач.
+        // Зависимые от ячейки, на которой оно произошло, не вычисляются.
+        void Run() {
+            try {
+                std::vector<std::size_t> roots;
+                for (std::size_t i = 0; i < cells_.size(); ++i) {
+                    if (in_degree_[i].load(std::memory_order_relaxed) == 0) {
+                        roots.push_back(i);
+                    }
+                }
+                for (std::size_t root : roots) {
+                    Schedule(root);
+                }
+            }
+            catch (...) {
+                SetError(std::current_exception());
+            }
+            pool_.Wait();
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
+
+    private:
+        void Schedule(std::size_t index) {
+            pool_.Submit([this, index] { Evaluate(index); });
+        }
+
+        void Evaluate(std::size_t index) {
+            try {
+                cells_[index]->Recalculate();
+                for (std::size_t dependent : dependents_[index]) {
+                    if (in_degree_[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        Schedule(dependent);
+                    }
+                }
+            }
+            catch (...) {
+                SetError(std::current_exception());
+            }
+        }
+
+        void SetError(std::exception_ptr error) {
+            std::lock_guard lock(error_mutex_);
+            if (!error_) {
+                error_ = std::move(error);
+            }
+        }
+
+        const std::vector<Cell*>& cells_;
+        const std::vector<std::vector<std::size_t>>& dependents_;
+        std::unique_ptr<std::atomic<int>[]> in_degree_;
+        ThreadPool& pool_;
+        std::mutex error_mutex_;
+        std::exception_ptr error_;
+    };
+}  // namespace
+
+void Sheet::Recalculate() {
+    if (recalculating_ || dirty_cells_.Empty()) {
+        return;
+    }
+
+    // Если пересчёт прервётся исключением, устаревшие формулы останутся во
+    // фронте и будут вычислены при следующем вызове.
+    FlagGuard guard(recalculating_);
+    DirtyGraph graph = BuildDirtyGraph();
+    if (recalc_pool_ && graph.cells.size() >= MIN_PARALLEL_RECALC_CELLS) {
+        RecalculateParallel(graph);
+    }
+    else {
+        RecalculateSerial(graph);
+    }
+    dirty_cells_.Clear();
+}
+
+// Учитываются лишь рёбра внутри фронта, поэтому стоимость построения
+// пропорциональна размеру затронутого подграфа. Номер ячейки в подграфе —
+// номер её элемента в dirty_cells_.
+Sheet::DirtyGraph Sheet::BuildDirtyGraph() {
+    DirtyGraph graph;
+    graph.cells.reserve(dirty_cells_.Size());
+    for (CellId id : dirty_cells_) {
+        graph.cells.push_back(&cells_[id]);
+    }
+
+    graph.dependents.resize(graph.cells.size());
+    graph.in_degree.assign(graph.cells.size(), 0);
+    std::size_t i = 0;
+    for (CellId id : dirty_cells_) {
+        ForEachDependentCell(cells_.GetPosition(id), id, [this, &graph, i](CellId dependent_id) {
+            if (std::uint32_t index = dirty_cells_.IndexOf(dependent_id); index != IndexedCellIdSet::NO_INDEX) {
+                graph.dependents[i].push_back(index);
+                ++graph.in_degree[index];
+            }
+        });
+        ++i;
+    }
+    return graph;
+}
+
+// Алгоритм Кана: ячейка вычисляется только после всех ячеек фронта, от
+// которых она зависит.
+void Sheet::RecalculateSerial(DirtyGraph& graph) {
+    std::vector<std::size_t> ready;
+    ready.reserve(graph.cells.size());
+    for (std::size_t i = 0; i < graph.cells.size(); ++i) {
+        if (graph.in_degree[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+    for (std::size_t i = 0; i < ready.size(); ++i) {
+        std::size_t current = ready[i];
+        graph.cells[current]->Recalculate();
+        for (std::size_t dependent : graph.dependents[current]) {
+            if (--graph.in_degree[dependent] == 0) {
+                ready.push_back(dependent);
+            }
+        }
+    }
+}
+
+void Sheet::RecalculateParallel(DirtyGraph& graph) {
+    ParallelRecalculation(graph.cells, graph.dependents, graph.in_degree, *recalc_pool_).Run();
+}
+
+// Значение формулы меняется только после сброса её кэша в InvalidateCells,
+// поэтому ячейки, отмеченные там, — все ячейки, которые изменились с прошлой
+// публикации. Читатели получают версию атомарной заменой указателя.
+std::shared_ptr<const SheetVersion> Sheet::PublishVersion() {
+    Recalculate();
+    std::shared_ptr<const SheetVersion> version;
+    if (published_version_) {
+        version = SheetVersion::Update(*published_version_, *this, unpublished_changes_);
+        unpublished_changes_.Clear();
+    }
+    else {
+        version = SheetVersion::Build(*this, 1);
+    }
+    std::atomic_store(&published_version_, version);
+    return version;
+}
+
+std::shared_ptr<const SheetVersion> Sheet::GetPublishedVersion() const {
+    return std::atomic_load(&published_version_);
+}
+
+void Sheet::SetRecalcThreadCount(std::size_t thread_count) {
+    if (thread_count == GetRecalcThreadCount()) {
+        return;
+    }
+    recalc_pool_ = thread_count > 1 ? std::make_unique<ThreadPool>(thread_count) : nullptr;
+}
+
+std::size_t Sheet::GetRecalcThreadCount() const {
+    return recalc_pool_ ? recalc_pool_->GetThreadCount() : 1;
+}
+
+// Ячейки, на которые ссылается формула, создаются пустыми, если их ещё нет.
+// Пустые ячейки не входят в печатаемую область.
+CellId Sheet::EnsureCell(Position pos) {
+    if (CellId id = cells_.FindId(pos); id != NO_CELL_ID) {
+        return id;
+    }
+    cells_.EmplaceWithId(pos, *this);
+    return cells_.FindId(pos);
 }
 
-void Sheet::DeleteDependencies(const Position& pos) {
-    cells_dependencies_.erase(pos);
+void Sheet::AddDependencies(CellId id, const std::vector<Position>& referenced_cells) {
+    for (const auto& ref_cell : referenced_cells) {
+        cells_dependencies_.AddEdge(EnsureCell(ref_cell), id);
+    }
+}
+
+void Sheet::AddRangeDependencies(CellId id, const std::vector<Range>& referenced_ranges) {
+    for (const auto& range : referenced_ranges) {
+        range_edge_count_ += range_dependencies_[range].Insert(id);
+    }
 }
 
-void Sheet::UpdatePrintableSize() {
-    max_row_ = 0;
-    max_col_ = 0;
-    for (const auto& [pos, cell] : sheet_) {
-        if (cell) {
-            max_row_ = std::max(max_row_, pos.row + 1);
-            max_col_ = std::max(max_col_, pos.col + 1);
+void Sheet::DeleteRangeDependencies(CellId id, const std::vector<Range>& referenced_ranges) {
+    for (const auto& range : referenced_ranges) {
+        auto dependent_cells = range_dependencies_.Find(range);
+        if (!dependent_cells) {
+            continue;
         }
+        range_edge_count_ -= dependent_cells->Erase(id);
+        if (dependent_cells->Empty()) {
+            range_dependencies_.Erase(range);
+        }
+    }
+}
+
+// Формула в ячейке pos образует цикл, если хотя бы одна из ячеек, на которые
+// она ссылается напрямую или через диапазон, совпадает с pos или уже зависит
+// от неё. Поэтому обход идёт по обратным рёбрам от pos и затрагивает только
+// ячейки, зависящие от неё; таблица при этом не изменяется. Список ссылок
+// отсортирован.
+bool Sheet::HasCircularDependency(CellId id, const std::vector<Position>& referenced_cells,
+                                  const std::vector<Range>& referenced_ranges) const {
+    if (referenced_cells.empty() && referenced_ranges.empty()) {
+        return false;
+    }
+    auto is_referenced = [&referenced_cells, &referenced_ranges](const Position& cell) {
+        return std::binary_search(referenced_cells.begin(), referenced_cells.end(), cell)
+            || std::any_of(referenced_ranges.begin(), referenced_ranges.end(),
+                           [&cell](const Range& range) { return range.Contains(cell); });
+    };
+    if (is_referenced(cells_.GetPosition(id))) {
+        return true;
+    }
+
+    // Карта посещённых ячеек общая для всех проверок и после обхода
+    // очищается по списку visited.
+    circular_check_visited_.Insert(id);
+    std::vector<CellId> visited{ id };
+    std::vector<CellId> stack{ id };
+    bool found = false;
+    while (!stack.empty() && !found) {
+        CellId current = stack.back();
+        stack.pop_back();
+        ForEachDependentCell(cells_.GetPosition(current), current, [&](CellId dependent_id) {
+            if (found || is_referenced(cells_.GetPosition(dependent_id))) {
+                found = true;
+            }
+            else if (circular_check_visited_.Insert(dependent_id)) {
+                visited.push_back(dependent_id);
+                stack.push_back(dependent_id);
+            }
+        });
     }
-    area_is_valid_ = true;
+    for (CellId visited_id : visited) {
+        circular_check_visited_.Erase(visited_id);
+    }
+    return found;
+}
+
+// Ищет циклы в графе ссылок, где ячейки из new_formulas ссылаются на ячейки
+// новых формул, а остальные — на прежние. До изменения граф был ацикличен,
+// поэтому обход начинается только с новых ячеек. Компоненты сильной связности
+// выделяются алгоритмом Тарьяна без рекурсии; номер ячейки равен порядку её
+// обнаружения, поэтому отдельный массив индексов не нужен. Возвращает ячейки
+// всех циклов по возрастанию.
+//
+// Ячейки без ссылок не могут входить в цикл и в обход не попадают. Диапазон
+// по той же причине заменяется формулами внутри него.
+std::vector<Position> Sheet::FindCyclicCells(const TiledGrid<const FormulaInterface*>& new_formulas) const {
+    TiledGrid<std::size_t> ids;
+    std::vector<Position> positions;
+    std::vector<PositionRange> references;
+    std::deque<std::vector<Position>> expanded_references;
+    std::vector<std::size_t> lowlink;
+    std::vector<bool> on_stack;
+    std::vector<std::size_t> component_stack;
+
+    struct Frame {
+        std::size_t id;
+        std::size_t next = 0;
+    };
+    std::vector<Frame> call_stack;
+    std::vector<Position> cyclic_cells;
+
+    // Ссылки формулы; диапазоны заменяются формулами внутри них.
+    auto get_references = [&](const FormulaInterface* formula) -> PositionRange {
+        const FormulaAST& ast = formula->GetAST();
+        if (ast.GetRanges().empty()) {
+            return ast.GetCells();
+        }
+        std::vector<Position> cells(ast.GetCells().begin(), ast.GetCells().end());
+        for (const auto& range : ast.GetRanges()) {
+            new_formulas.ForEachInRange(range, [&cells](Position pos, const FormulaInterface* new_formula) {
+                if (HasReferences(new_formula)) {
+                    cells.push_back(pos);
+                }
+            });
+            cells_.ForEachInRange(range, [&](Position pos, const Cell& cell) {
+                if (cell.IsFormula() && !new_formulas.Find(pos)) {
+                    cells.push_back(pos);
+                }
+            });
+        }
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+        expanded_references.push_back(std::move(cells));
+        return { expanded_references.back().data(), expanded_references.back().size() };
+    };
+
+    auto find_formula = [&](const Position& pos) -> const FormulaInterface* {
+        if (auto new_formula = new_formulas.Find(pos)) {
+            return *new_formula;
+        }
+        const Cell* cell = cells_.Find(pos);
+        return cell ? cell->GetFormula() : nullptr;
+    };
+
+    auto discover = [&](const Position& pos, const FormulaInterface* formula) {
+        std::size_t id = positions.size();
+        ids.Emplace(pos, id);
+        positions.push_back(pos);
+        references.push_back(get_references(formula));
+        lowlink.push_back(id);
+        on_stack.push_back(true);
+        component_stack.push_back(id);
+        call_stack.push_back({ id });
+    };
+
+    new_formulas.ForEach([&](Position root, const FormulaInterface* root_formula) {
+        if (!HasReferences(root_formula) || ids.Find(root)) {
+            return;
+        }
+        discover(root, root_formula);
+        while (!call_stack.empty()) {
+            Frame& frame = call_stack.back();
+            std::size_t id = frame.id;
+            PositionRange refs = references[id];
+            if (frame.next < refs.size()) {
+                const Position& ref_cell = refs.begin()[frame.next++];
+                if (const std::size_t* ref_id = ids.Find(ref_cell); !ref_id) {
+                    if (const FormulaInterface* formula = find_formula(ref_cell); HasReferences(formula)) {
+                        discover(ref_cell, formula);
+                    }
+                }
+                else if (on_stack[*ref_id]) {
+                    lowlink[id] = std::min(lowlink[id], *ref_id);
+                }
+                continue;
+            }
+
+            call_stack.pop_back();
+            if (!call_stack.empty()) {
+                std::size_t parent = call_stack.back().id;
+                lowlink[parent] = std::min(lowlink[parent], lowlink[id]);
+            }
+            if (lowlink[id] != id) {
+                continue;
+            }
+
+            // id — корень компоненты; она образует цикл, если в ней больше
+            // одной ячейки или ячейка ссылается сама на себя.
+            auto component_begin = std::find(component_stack.rbegin(), component_stack.rend(), id).base() - 1;
+            bool is_cycle = component_stack.end() - component_begin > 1
+                || std::binary_search(refs.begin(), refs.end(), positions[id]);
+            for (auto it = component_begin; it != component_stack.end(); ++it) {
+                on_stack[*it] = false;
+                if (is_cycle) {
+                    cyclic_cells.push_back(positions[*it]);
+                }
+            }
+            component_stack.erase(component_begin, component_stack.end());
+        }
+    });
+
+    std::sort(cyclic_cells.begin(), cyclic_cells.end());
+    return cyclic_cells;
+}
+
+void Sheet::DeleteDependencies(CellId id, const std::vector<Position>& referenced_cells) {
+    for (const auto& ref_cell : referenced_cells) {
+        if (CellId ref_id = cells_.FindId(ref_cell); ref_id != NO_CELL_ID) {
+            cells_dependencies_.RemoveEdge(ref_id, id);
+        }
+    }
+}
+
+// Пустые ячейки, созданные ради ссылок, удаляются вместе с последней ссылкой,
+// иначе они копились бы на листе при каждой правке формул.
+void Sheet::DeleteUnreferencedEmptyCells(const std::vector<Position>& cells) {
+    for (const auto& pos : cells) {
+        CellId id = cells_.FindId(pos);
+        if (id != NO_CELL_ID && cells_[id].IsEmpty() && !cells_dependencies_.HasDependents(id)) {
+            cells_.Erase(pos);
+        }
+    }
+}
+
+void Sheet::ValidateDependencies() const {
+    auto fail = [](const std::string& message) {
+        throw std::logic_error("Dependency graph is inconsistent: " + message);
+    };
+
+    std::size_t cell_edges = 0;
+    std::size_t range_edges = 0;
+    cells_.ForEach([&](Position pos, const Cell& cell) {
+        CellId id = cells_.FindId(pos);
+        for (const auto& ref_cell : cell.GetReferencedCells()) {
+            CellId ref_id = cells_.FindId(ref_cell);
+            if (ref_id == NO_CELL_ID) {
+                fail(pos.ToString() + " refers to missing cell " + ref_cell.ToString());
+            }
+            bool found = false;
+            cells_dependencies_.ForEachDependent(ref_id, [&](CellId dependent_id) {
+                found = found || dependent_id == id;
+            });
+            if (!found) {
+                fail("no edge " + ref_cell.ToString() + " -> " + pos.ToString());
+            }
+            ++cell_edges;
+        }
+        for (const auto& range : cell.GetReferencedRanges()) {
+            const auto* dependent_cells = range_dependencies_.Find(range);
+            if (!dependent_cells
+                || !std::binary_search(dependent_cells->begin(), dependent_cells->end(), id)) {
+                fail("no edge " + range.ToString() + " -> " + pos.ToString());
+            }
+            ++range_edges;
+        }
+    });
+
+    // Каждой ссылке соответствует своё ребро, поэтому при совпадении числа
+    // рёбер лишних рёбер нет.
+    if (cell_edges != cells_dependencies_.GetEdgeCount()) {
+        fail(std::to_string(cells_dependencies_.GetEdgeCount() - cell_edges) + " stale cell edges");
+    }
+    std::size_t stored_range_edges = 0;
+    range_dependencies_.ForEach([&stored_range_edges](const Range&, const DependentList& dependent_cells) {
+        stored_range_edges += dependent_cells.Size();
+    });
+    if (range_edges != stored_range_edges || range_edges != range_edge_count_) {
+        fail(std::to_string(stored_range_edges - range_edges) + " stale range edges");
+    }
+}
+
+DependencyStats Sheet::GetDependencyStats() const {
+    return { cells_dependencies_.GetEdgeCount(), range_edge_count_, cells_dependencies_.GetMemoryUsage() };
+}
+
+void OccupancyCounter::Add(int index) {
+    if (static_cast<std::size_t>(index) >= counts_.size()) {
+        counts_.resize(index + 1);
+    }
+    ++counts_[index];
+    bound_ = std::max(bound_, index + 1);
+}
+
+// Граница сдвигается только через опустевшие строки (столбцы), поэтому в
+// сумме по всем удалениям сдвиг не превышает числа добавлений.
+void OccupancyCounter::Remove(int index) {
+    --counts_[index];
+    while (bound_ > 0 && counts_[bound_ - 1] == 0) {
+        --bound_;
+    }
+}
+
+int OccupancyCounter::GetBound() const {
+    return bound_;
+}
+
+void Sheet::AddToPrintableArea(Position pos) {
+    occupied_rows_.Add(pos.row);
+    occupied_cols_.Add(pos.col);
+}
+
+void Sheet::RemoveFromPrintableArea(Position pos) {
+    occupied_rows_.Remove(pos.row);
+    occupied_cols_.Remove(pos.col);
+}
+
+CacheStats& Sheet::GetCacheStats() {
+    return cache_stats_;
+}
+
+const CacheStats& Sheet::GetCacheStats() const {
+    return cache_stats_;
+}
+
+CellId Sheet::FindCellId(Position pos) const {
+    return cells_.FindId(pos);
+}
+
+const Cell& Sheet::GetCellById(CellId id) const {
+    return cells_[id];
+}
+
+StringPool& Sheet::GetStringPool() {
+    return strings_;
+}
+
+const StringPool& Sheet::GetStringPool() const {
+    return strings_;
+}
+
+CellValueStore& Sheet::GetValueStore() {
+    return values_;
+}
+
+const CellValueStore& Sheet::GetValueStore() const {
+    return values_;
 }
 
-bool Sheet::CellExists(Position pos) const {
-    return sheet_.count(pos) > 0;
+void Sheet::ResetCacheStats() {
+    cache_stats_.hits = 0;
+    cache_stats_.misses = 0;
+    cache_stats_.invalidations = 0;
 }
 
 std::unique_ptr<SheetInterface> CreateSheet() {
@@ -1,57 +1,214 @@
 #pragma once
 
 #include "cell.h"
+#include "cell_id_set.h"
+#include "cell_value_store.h"
 #include "common.h"
+#include "dependency_graph.h"
+#include "range_index.h"
+#include "sheet_version.h"
+#include "thread_pool.h"
+#include "tiled_grid.h"
 
 #include <functional>
-#include <map>
-#include <set>
-
-template<>
-struct std::hash<Position> {
-    std::size_t operator()(const Position& pos) const noexcept {
-        std::size_t h1 = std::hash<int>{}(pos.row);
-        std::size_t h2 = std::hash<int>{}(pos.col);
-        return h1 ^ (h2 << 1);
-    }
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Бросается SetCells, если ячейки образуют циклы; перечисляет все ячейки,
+// входящие в них, по возрастанию.
+class BulkCircularDependencyException : public CircularDependencyException {
+public:
+    explicit BulkCircularDependencyException(std::vector<Position> cells);
+
+    const std::vector<Position>& GetCells() const;
+
+private:
+    std::vector<Position> cells_;
+};
+
+// Число непустых ячеек в каждой строке (или столбце) таблицы и граница
+// области, в которой они находятся.
+class OccupancyCounter {
+public:
+    void Add(int index);
+    void Remove(int index);
+
+    // Номер последней занятой строки (столбца) плюс один.
+    int GetBound() const;
+
+private:
+    std::vector<int> counts_;
+    int bound_ = 0;
+};
+
+// Размер графа зависимостей листа. Память учитывает только рёбра между
+// ячейками: рёбра диапазонов хранятся вместе с индексом диапазонов.
+struct DependencyStats {
+    std::size_t cell_edges = 0;
+    std::size_t range_edges = 0;
+    std::size_t cell_edges_memory = 0;
 };
 
 class Sheet : public SheetInterface
 {
 public:
+    static constexpr CellId NO_CELL_ID = TiledGrid<Cell>::NO_ID;
+
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
 
+    // Записывает набор ячеек за один проход: формулы разбираются заранее,
+    // граф зависимостей дополняется целиком и проверяется на циклы один раз,
+    // а значения вычисляются при первом чтении. Если позиция встречается
+    // несколько раз, записывается последний текст. Если какая-то формула
+    // некорректна или ячейки образуют циклы, таблица не меняется.
+    void SetCells(std::vector<std::pair<Position, std::string>> cells);
+
     const CellInterface* GetCell(Position pos) const override;
     CellInterface* GetCell(Position pos) override;
 
     void ClearCell(Position pos) override;
 
+    void ForEachCellInRange(const Range& range,
+                            const std::function<bool(Position, const CellInterface&)>& func) const override;
+
     Size GetPrintableSize() const override;
 
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
+    // Пересчитывает все формулы, значения которых устарели после изменений
+    // таблицы. Каждая формула вычисляется ровно один раз, после всех ячеек,
+    // от которых она зависит. Вызывается автоматически при первом чтении
+    // устаревшего значения.
+    void Recalculate();
+
+    // Задаёт число потоков для пересчёта формул. При значении больше единицы
+    // независимые друг от друга формулы вычисляются параллельно; результат
+    // совпадает с однопоточным пересчётом.
+    void SetRecalcThreadCount(std::size_t thread_count);
+    std::size_t GetRecalcThreadCount() const;
+
+    // Вызывает func(Position, const Cell&) для всех непустых ячеек в порядке
+    // строк, а внутри строки — в порядке столбцов.
+    template <typename Func>
+    void ForEachCell(Func&& func) const {
+        cells_.ForEach([&func](Position pos, const Cell& cell) {
+            if (!cell.IsEmpty()) {
+                func(pos, cell);
+            }
+        });
+    }
+
+    // То же для непустых ячеек диапазона.
+    template <typename Func>
+    void ForEachCell(const Range& range, Func&& func) const {
+        cells_.ForEachInRange(range, [&func](Position pos, const Cell& cell) {
+            if (!cell.IsEmpty()) {
+                func(pos, cell);
+            }
+        });
+    }
+
+    // Пересчитывает таблицу и публикует её неизменяемую версию, которую
+    // читатели из других потоков получают через GetPublishedVersion. Все
+    // остальные методы листа вызываются только из одного потока-писателя.
+    std::shared_ptr<const SheetVersion> PublishVersion();
+    // Последняя опубликованная версия или nullptr, если версий ещё не было.
+    // Можно вызывать из любого потока одновременно с писателем.
+    std::shared_ptr<const SheetVersion> GetPublishedVersion() const;
+
+    // Статистика попаданий в кэш значений формул.
+    CacheStats& GetCacheStats();
+    const CacheStats& GetCacheStats() const;
+    void ResetCacheStats();
+
+    DependencyStats GetDependencyStats() const;
+
+    // Идентификатор ячейки в позиции или NO_CELL_ID, если ячейки нет.
+    CellId FindCellId(Position pos) const;
+
+    // Ячейка по идентификатору; идентификатор должен принадлежать ячейке листа.
+    const Cell& GetCellById(CellId id) const;
+
+    // Тексты ячеек листа.
+    StringPool& GetStringPool();
+    const StringPool& GetStringPool() const;
+
+    // Числовые значения всех ячеек листа, включая значения формул.
+    CellValueStore& GetValueStore();
+    const CellValueStore& GetValueStore() const;
+
+    // Сверяет граф зависимостей со ссылками всех формул и бросает
+    // std::logic_error при расхождении. При сборке с
+    // SPREADSHEET_VALIDATE_DEPENDENCIES вызывается после каждого изменения.
+    void ValidateDependencies() const;
+
 private:
-    
-    std::map<Position, std::set<Position>> cells_dependencies_;
+    friend class SheetSnapshot;
+
+    DependencyGraph cells_dependencies_;
+    // Формулы, ссылающиеся на диапазон. Ячейки диапазонов не создаются
+    // заранее, в отличие от ячеек, на которые формулы ссылаются напрямую.
+    RangeIndex<DependentList> range_dependencies_;
+    std::size_t range_edge_count_ = 0;
 
-    std::unordered_map<Position, std::unique_ptr<Cell>, std::hash<Position>> sheet_;
+    // Объявлен до cells_: ячейки освобождают свои строки при удалении.
+    StringPool strings_;
+    TiledGrid<Cell> cells_;
+    CellValueStore values_;
 
     //enum class PrintType;
     void Print(std::ostream& output,  std::function<void(std::ostream&, const CellInterface*)> print_func) const;
     CellInterface* GetCellImpl(Position pos);
 
-    void UpdatePrintableSize();
-    bool CellExists(Position pos) const;
+    void AddToPrintableArea(Position pos);
+    void RemoveFromPrintableArea(Position pos);
+    // Идентификатор ячейки; если её нет, создаётся пустая.
+    CellId EnsureCell(Position pos);
     void InvalidateCell(const Position& pos);
-    void AddDependentCell(const Position& main_cell, const Position& dependent_cell);
-    const std::set<Position> GetDependentCells(const Position& pos);
-    void DeleteDependencies(const Position& pos);
+    void InvalidateCells(const std::vector<Position>& changed);
+    // Запоминает изменение ячейки для следующей публикации версии.
+    void MarkUnpublished(Position pos, bool text_changed);
+    void AddDependencies(CellId id, const std::vector<Position>& referenced_cells);
+    void AddRangeDependencies(CellId id, const std::vector<Range>& referenced_ranges);
+    void DeleteRangeDependencies(CellId id, const std::vector<Range>& referenced_ranges);
+    bool HasCircularDependency(CellId id, const std::vector<Position>& referenced_cells,
+                               const std::vector<Range>& referenced_ranges) const;
+
+    // new_formulas — ячейки набора SetCells и их формулы (nullptr для текста).
+    std::vector<Position> FindCyclicCells(const TiledGrid<const FormulaInterface*>& new_formulas) const;
+    // Вызывает func(CellId) для формул, ссылающихся на ячейку pos с
+    // идентификатором id напрямую или через диапазон. Если ячейки нет на
+    // листе, id равен NO_CELL_ID. Формула может встретиться дважды.
+    template <typename Func>
+    void ForEachDependentCell(Position pos, CellId id, Func&& func) const;
+
+    struct DirtyGraph;
+    DirtyGraph BuildDirtyGraph();
+    void RecalculateSerial(DirtyGraph& graph);
+    void RecalculateParallel(DirtyGraph& graph);
+    void DeleteDependencies(CellId id, const std::vector<Position>& referenced_cells);
+    void DeleteUnreferencedEmptyCells(const std::vector<Position>& cells);
+
+
+    OccupancyCounter occupied_rows_;
+    OccupancyCounter occupied_cols_;
+
+    CacheStats cache_stats_;
+
+    // Формулы, значения которых нужно пересчитать.
+    IndexedCellIdSet dirty_cells_;
+    mutable CellIdBitmap circular_check_visited_;
+    bool recalculating_ = false;
 
+    std::unique_ptr<ThreadPool> recalc_pool_;
 
-    int max_row_ = 0;    
-    int max_col_ = 0;    
-    bool area_is_valid_ = true; 
+    // Пока версий нет, изменения не отслеживаются: первая версия собирается
+    // из всех ячеек.
+    std::shared_ptr<const SheetVersion> published_version_;
+    SheetVersion::Changes unpublished_changes_;
 };
@@ -0,0 +1,212 @@
+#include "sheet_io.h"
+
+#include "buffered_writer.h"
+
+#include <charconv>
+#include <iterator>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t READ_BUFFER_SIZE = 1 << 16;
+constexpr std::size_t IMPORT_BATCH_SIZE = 1 << 16;
+
+// Разбирает поток на поля, читая его блоками. Текст поля накапливается в
+// строке, которая затем целиком передаётся ячейке.
+class DelimitedReader {
+public:
+    DelimitedReader(std::istream& input, Sheet& sheet, DelimitedFormat format)
+        : input_(input), sheet_(sheet), format_(format), buffer_(READ_BUFFER_SIZE) {
+        batch_.reserve(IMPORT_BATCH_SIZE);
+    }
+
+    void Run() {
+        std::streambuf* source = input_.rdbuf();
+        while (true) {
+            std::streamsize count = source->sgetn(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+            if (count <= 0) {
+                break;
+            }
+            for (std::streamsize i = 0; i < count; ++i) {
+                Consume(buffer_[i]);
+            }
+        }
+        if (pending_cr_) {
+            pending_cr_ = false;
+            field_ += '\r';
+        }
+        // Незакрытая кавычка в конце файла считается закрытой.
+        EndField();
+        Flush();
+    }
+
+private:
+    void Consume(char c) {
+        if (in_quotes_) {
+            if (c == '"') {
+                in_quotes_ = false;
+                quote_closed_ = true;
+            }
+            else {
+                field_ += c;
+            }
+            return;
+        }
+        if (quote_closed_) {
+            quote_closed_ = false;
+            // Удвоенная кавычка внутри поля в кавычках.
+            if (c == '"') {
+                field_ += '"';
+                in_quotes_ = true;
+                return;
+            }
+        }
+        if (pending_cr_) {
+            pending_cr_ = false;
+            if (c == '\n') {
+                EndRow();
+                return;
+            }
+            field_ += '\r';
+        }
+
+        if (c == format_.delimiter) {
+            EndField();
+            ++pos_.col;
+        }
+        else if (c == '\n') {
+            EndRow();
+        }
+        else if (c == '\r') {
+            pending_cr_ = true;
+        }
+        else if (c == '"' && format_.quoted && field_.empty()) {
+            in_quotes_ = true;
+        }
+        else {
+            field_ += c;
+        }
+    }
+
+    void EndField() {
+        if (!field_.empty()) {
+            batch_.emplace_back(pos_, std::move(field_));
+            field_.clear();
+            if (batch_.size() >= IMPORT_BATCH_SIZE) {
+                Flush();
+            }
+        }
+    }
+
+    void EndRow() {
+        EndField();
+        ++pos_.row;
+        pos_.col = 0;
+    }
+
+    void Flush() {
+        if (!batch_.empty()) {
+            sheet_.SetCells(std::move(batch_));
+            batch_.clear();
+            batch_.reserve(IMPORT_BATCH_SIZE);
+        }
+    }
+
+    std::istream& input_;
+    Sheet& sheet_;
+    DelimitedFormat format_;
+    std::vector<char> buffer_;
+    std::vector<std::pair<Position, std::string>> batch_;
+
+    Position pos_;
+    std::string field_;
+    bool in_quotes_ = false;
+    bool quote_closed_ = false;
+    bool pending_cr_ = false;
+};
+
+bool NeedsQuotes(std::string_view text, DelimitedFormat format) {
+    const char special[] = { format.delimiter, '"', '\n', '\r' };
+    return format.quoted && text.find_first_of(special, 0, std::size(special)) != std::string_view::npos;
+}
+
+void WriteField(BufferedWriter& writer, std::string_view text, DelimitedFormat format) {
+    if (!NeedsQuotes(text, format)) {
+        writer.Write(text);
+        return;
+    }
+    writer.Put('"');
+    for (char c : text) {
+        if (c == '"') {
+            writer.Put('"');
+        }
+        writer.Put(c);
+    }
+    writer.Put('"');
+}
+
+// Число в формате потока по умолчанию, как в PrintValues.
+void WriteNumber(BufferedWriter& writer, double value) {
+    char buffer[32];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), value, std::chars_format::general, 6);
+    writer.Write({ buffer, static_cast<std::size_t>(result.ptr - buffer) });
+}
+
+template <typename WriteCell>
+void Export(const Sheet& sheet, std::ostream& output, DelimitedFormat format, WriteCell write_cell) {
+    BufferedWriter writer(output);
+    Position current;
+    bool row_started = false;
+    sheet.ForEachCell([&](Position pos, const Cell& cell) {
+        if (row_started && current.row < pos.row) {
+            writer.Put('\n');
+            ++current.row;
+            current.col = 0;
+        }
+        for (; current.row < pos.row; ++current.row) {
+            writer.Put('\n');
+        }
+        for (; current.col < pos.col; ++current.col) {
+            writer.Put(format.delimiter);
+        }
+        write_cell(writer, cell);
+        row_started = true;
+    });
+    if (row_started) {
+        writer.Put('\n');
+    }
+    writer.Flush();
+}
+
+}  // namespace
+
+void ImportDelimited(std::istream& input, Sheet& sheet, DelimitedFormat format) {
+    DelimitedReader(input, sheet, format).Run();
+}
+
+void ExportTexts(const Sheet& sheet, std::ostream& output, DelimitedFormat format) {
+    Export(sheet, output, format, [format](BufferedWriter& writer, const Cell& cell) {
+        WriteField(writer, cell.GetText(), format);
+    });
+}
+
+void ExportValues(const Sheet& sheet, std::ostream& output, DelimitedFormat format) {
+    Export(sheet, output, format, [format](BufferedWriter& writer, const Cell& cell) {
+        auto value = cell.GetValueView();
+        if (auto* number = std::get_if<double>(&value)) {
+            WriteNumber(writer, *number);
+        }
+        else if (auto* error = std::get_if<FormulaError>(&value)) {
+            writer.Write(error->ToString());
+        }
+        else {
+            WriteField(writer, std::get<std::string_view>(value), format);
+        }
+    });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <iosfwd>
+
+// Формат файла с разделителями: строка файла — строка таблицы, поля —
+// ячейки. В CSV поле можно заключить в двойные кавычки, чтобы записать в
+// нём разделитель, перевод строки или саму кавычку (удвоенной).
+struct DelimitedFormat {
+    char delimiter = '\t';
+    bool quoted = false;
+
+    static DelimitedFormat Tsv() {
+        return { '\t', false };
+    }
+
+    static DelimitedFormat Csv() {
+        return { ',', true };
+    }
+};
+
+// Читает ячейки из потока, начиная с A1. Поле записывается в ячейку как есть,
+// так же как в SetCell: "=" начинает формулу, "'" экранирует текст. Пустые
+// поля пропускаются. Поток читается блоками, а ячейки передаются в SetCells
+// пачками ограниченного размера, поэтому объём памяти не зависит от размера
+// файла. Если пачка отвергнута (некорректная формула, цикл или позиция за
+// пределами таблицы), исключение пробрасывается, а ячейки предыдущих пачек
+// остаются в таблице. Строки могут заканчиваться на "\n" или "\r\n".
+void ImportDelimited(std::istream& input, Sheet& sheet, DelimitedFormat format = DelimitedFormat::Tsv());
+
+// Выводит тексты непустых ячеек в порядке строк; результат читается обратно
+// ImportDelimited. Строка заканчивается на последней непустой ячейке, пустые
+// строки внутри печатной области выводятся пустыми. Запись буферизована.
+// В TSV кавычек нет, поэтому текст с табуляцией или переводом строки обратно
+// не читается.
+void ExportTexts(const Sheet& sheet, std::ostream& output, DelimitedFormat format = DelimitedFormat::Tsv());
+
+// То же для значений ячеек; числа и ошибки выводятся так же, как в
+// PrintValues.
+void ExportValues(const Sheet& sheet, std::ostream& output, DelimitedFormat format = DelimitedFormat::Tsv());
@@ -0,0 +1,247 @@
+#include "sheet_version.h"
+
+#include "FormulaAST.h"
+#include "cell.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <iostream>
+#include <variant>
+
+namespace {
+    // Размеры таблицы кратны размерам блока.
+    static_assert(Position::MAX_ROWS % SheetVersion::TILE_ROWS == 0
+                  && Position::MAX_COLS % SheetVersion::TILE_COLS == 0);
+    constexpr std::uint32_t TILES_PER_ROW = Position::MAX_COLS / SheetVersion::TILE_COLS;
+}  // namespace
+
+std::uint32_t SheetVersion::GetTileIndex(Position pos) {
+    return static_cast<std::uint32_t>(pos.row / TILE_ROWS) * TILES_PER_ROW
+        + static_cast<std::uint32_t>(pos.col / TILE_COLS);
+}
+
+std::size_t SheetVersion::GetEntryIndex(Position pos) {
+    return pos.row % TILE_ROWS * TILE_COLS + pos.col % TILE_COLS;
+}
+
+std::string_view SheetVersion::Tile::GetText(const Entry& entry) const {
+    return std::string_view(texts).substr(entry.text_offset, entry.text_size);
+}
+
+void SheetVersion::Changes::Add(Position pos, bool text_changed) {
+    auto& changed_texts = tiles_[GetTileIndex(pos)];
+    if (text_changed) {
+        changed_texts.set(GetEntryIndex(pos));
+    }
+}
+
+void SheetVersion::Changes::Clear() {
+    tiles_.clear();
+}
+
+std::shared_ptr<const SheetVersion> SheetVersion::Build(const Sheet& sheet, std::uint64_t number) {
+    Changes changes;
+    sheet.ForEachCell([&changes](Position pos, const Cell&) {
+        changes.Add(pos, true);
+    });
+    SheetVersion empty;
+    empty.number_ = number - 1;
+    return Update(empty, sheet, changes);
+}
+
+// Изменённые блоки обходятся по возрастанию номеров, поэтому каждая
+// затронутая группа и строка блоков копируется один раз.
+std::shared_ptr<const SheetVersion> SheetVersion::Update(const SheetVersion& previous, const Sheet& sheet,
+                                                         const Changes& changes) {
+    std::vector<std::uint32_t> changed_tiles;
+    changed_tiles.reserve(changes.tiles_.size());
+    for (const auto& [tile_index, changed_texts] : changes.tiles_) {
+        changed_tiles.push_back(tile_index);
+    }
+    std::sort(changed_tiles.begin(), changed_tiles.end());
+
+    auto version = std::make_shared<SheetVersion>();
+    version->number_ = previous.number_ + 1;
+    version->printable_size_ = sheet.GetPrintableSize();
+    version->groups_ = previous.groups_;
+
+    std::size_t i = 0;
+    while (i < changed_tiles.size()) {
+        std::uint32_t group_index = changed_tiles[i] / TILES_PER_ROW / TILE_ROWS_PER_GROUP;
+        if (group_index >= version->groups_.size()) {
+            version->groups_.resize(group_index + 1);
+        }
+        const auto& old_group = version->groups_[group_index];
+        auto group = old_group ? std::make_shared<TileRowGroup>(*old_group) : std::make_shared<TileRowGroup>();
+        while (i < changed_tiles.size() && changed_tiles[i] / TILES_PER_ROW / TILE_ROWS_PER_GROUP == group_index) {
+            std::uint32_t tile_row = changed_tiles[i] / TILES_PER_ROW;
+            auto& row_ptr = (*group)[tile_row % TILE_ROWS_PER_GROUP];
+            auto row = row_ptr ? std::make_shared<TileRow>(*row_ptr) : std::make_shared<TileRow>();
+            for (; i < changed_tiles.size() && changed_tiles[i] / TILES_PER_ROW == tile_row; ++i) {
+                std::uint32_t tile_index = changed_tiles[i];
+                std::uint32_t tile_col = tile_index % TILES_PER_ROW;
+                if (tile_col >= row->size()) {
+                    row->resize(tile_col + 1);
+                }
+                (*row)[tile_col] = BuildTile(sheet, tile_index, previous.FindTile(tile_index),
+                                             changes.tiles_.at(tile_index));
+            }
+            row_ptr = std::move(row);
+        }
+        version->groups_[group_index] = std::move(group);
+    }
+    return version;
+}
+
+// Значения формул берутся из кэша: перед публикацией таблица пересчитана.
+// Тексты ячеек копируются в буфер блока, а не ссылаются на строки в StringPool
+// таблицы: пул изменяется писателем и не защищён от одновременного чтения.
+// Неизменённые тексты берутся из буфера предыдущей версии блока.
+std::shared_ptr<const SheetVersion::Tile> SheetVersion::BuildTile(
+    const Sheet& sheet, std::uint32_t tile_index, const Tile* previous,
+    const std::bitset<TILE_ROWS * TILE_COLS>& changed_texts) {
+    Position from{ static_cast<int>(tile_index / TILES_PER_ROW) * TILE_ROWS,
+                   static_cast<int>(tile_index % TILES_PER_ROW) * TILE_COLS };
+    Range range{ from, { from.row + TILE_ROWS - 1, from.col + TILE_COLS - 1 } };
+
+    auto tile = std::make_shared<Tile>();
+    sheet.ForEachCell(range, [&](Position pos, const Cell& cell) {
+        std::size_t index = GetEntryIndex(pos);
+        Entry& entry = tile->entries[index];
+        entry.text_offset = static_cast<std::uint32_t>(tile->texts.size());
+        if (previous && !changed_texts[index]) {
+            tile->texts += previous->GetText(previous->entries[index]);
+        }
+        else {
+            tile->texts += cell.GetText();
+        }
+        entry.text_size = static_cast<std::uint32_t>(tile->texts.size() - entry.text_offset);
+        if (entry.text_size == 0 || !cell.IsFormula()) {
+            return;
+        }
+        entry.is_formula = true;
+        auto value = cell.GetCachedValue();
+        if (!value) {
+            value = cell.GetValue();
+        }
+        if (const double* number = std::get_if<double>(&*value)) {
+            entry.formula_value = *number;
+        }
+        else {
+            entry.formula_value = MakeErrorValue(std::get<FormulaError>(*value).GetCategory());
+        }
+    });
+    if (tile->texts.empty()) {
+        return nullptr;
+    }
+    tile->texts.shrink_to_fit();
+    return tile;
+}
+
+std::uint64_t SheetVersion::GetNumber() const {
+    return number_;
+}
+
+const SheetVersion::Tile* SheetVersion::FindTile(std::uint32_t tile_index) const {
+    std::uint32_t tile_row = tile_index / TILES_PER_ROW;
+    std::uint32_t tile_col = tile_index % TILES_PER_ROW;
+    std::uint32_t group_index = tile_row / TILE_ROWS_PER_GROUP;
+    if (group_index >= groups_.size() || !groups_[group_index]) {
+        return nullptr;
+    }
+    const auto& row = (*groups_[group_index])[tile_row % TILE_ROWS_PER_GROUP];
+    if (!row || tile_col >= row->size()) {
+        return nullptr;
+    }
+    return (*row)[tile_col].get();
+}
+
+CellInterface::ValueView SheetVersion::GetEntryValueView(const Tile& tile, const Entry& entry) {
+    if (entry.is_formula) {
+        if (IsErrorValue(entry.formula_value)) {
+            return FormulaError(GetErrorCategory(entry.formula_value));
+        }
+        return entry.formula_value;
+    }
+    std::string_view text = tile.GetText(entry);
+    if (!text.empty() && text[0] == '\'') {
+        text.remove_prefix(1);
+    }
+    return text;
+}
+
+CellInterface::Value SheetVersion::GetValue(Position pos) const {
+    return std::visit([](const auto& value) -> CellInterface::Value {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, std::string_view>) {
+            return std::string(value);
+        }
+        else {
+            return value;
+        }
+    }, GetValueView(pos));
+}
+
+CellInterface::ValueView SheetVersion::GetValueView(Position pos) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Invalid position for GetValueView()");
+    }
+    const Tile* tile = FindTile(GetTileIndex(pos));
+    return tile ? GetEntryValueView(*tile, tile->entries[GetEntryIndex(pos)]) : std::string_view();
+}
+
+std::string SheetVersion::GetText(Position pos) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Invalid position for GetText()");
+    }
+    const Tile* tile = FindTile(GetTileIndex(pos));
+    return tile ? std::string(tile->GetText(tile->entries[GetEntryIndex(pos)])) : std::string();
+}
+
+Size SheetVersion::GetPrintableSize() const {
+    return printable_size_;
+}
+
+void SheetVersion::PrintValues(std::ostream& output) const {
+    Print(output, [&output](const Tile& tile, const Entry& entry) {
+        std::visit([&output](const auto& value) { output << value; }, GetEntryValueView(tile, entry));
+    });
+}
+
+void SheetVersion::PrintTexts(std::ostream& output) const {
+    Print(output, [&output](const Tile& tile, const Entry& entry) {
+        output << tile.GetText(entry);
+    });
+}
+
+// Формат совпадает с Sheet::PrintValues и Sheet::PrintTexts. Обходятся
+// только существующие блоки: для отсутствующих выводятся одни разделители.
+template <typename PrintEntry>
+void SheetVersion::Print(std::ostream& output, PrintEntry&& print_entry) const {
+    for (int tile_row = 0; tile_row * TILE_ROWS < printable_size_.rows; ++tile_row) {
+        std::uint32_t group_index = static_cast<std::uint32_t>(tile_row) / TILE_ROWS_PER_GROUP;
+        const TileRow* tiles = nullptr;
+        if (group_index < groups_.size() && groups_[group_index]) {
+            tiles = (*groups_[group_index])[tile_row % TILE_ROWS_PER_GROUP].get();
+        }
+        int rows_end = std::min(printable_size_.rows, (tile_row + 1) * TILE_ROWS);
+        for (int row = tile_row * TILE_ROWS; row < rows_end; ++row) {
+            for (int col = 0; col < printable_size_.cols; col += TILE_COLS) {
+                std::size_t tile_col = static_cast<std::size_t>(col / TILE_COLS);
+                const Tile* tile = tiles && tile_col < tiles->size() ? (*tiles)[tile_col].get() : nullptr;
+                int cols_end = std::min(printable_size_.cols, col + TILE_COLS);
+                for (int c = col; c < cols_end; ++c) {
+                    if (c > 0) {
+                        output << '\t';
+                    }
+                    if (tile) {
+                        const Entry& entry = tile->entries[GetEntryIndex({ row, c })];
+                        if (entry.text_size > 0) {
+                            print_entry(*tile, entry);
+                        }
+                    }
+                }
+            }
+            output << '\n';
+        }
+    }
+}
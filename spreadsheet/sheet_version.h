@@ -0,0 +1,97 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class Sheet;
+
+// Неизменяемая версия таблицы: тексты и значения ячеек на момент публикации
+// (см. Sheet::PublishVersion). Версию можно читать из любого числа потоков без
+// блокировок, пока писатель меняет таблицу и публикует следующие версии.
+//
+// Ячейки хранятся блоками TILE_ROWS x TILE_COLS, строки блоков собраны в
+// группы по TILE_ROWS_PER_GROUP. Новая версия копирует только блоки с
+// изменёнными ячейками и содержащие их строки и группы, так что публикация
+// после небольшого изменения не зависит от размера таблицы; остальное общее с
+// предыдущей версией.
+class SheetVersion {
+public:
+    static constexpr int TILE_ROWS = 8;
+    static constexpr int TILE_COLS = 16;
+    static constexpr int TILE_ROWS_PER_GROUP = 32;
+
+    // Ячейки, изменившиеся с прошлой публикации, по блокам. Тексты
+    // неизменившихся ячеек блока берутся из прошлой версии: текст формулы
+    // приходится печатать заново, а значение читается из кэша.
+    class Changes {
+    public:
+        // Значение ячейки могло измениться; text_changed — изменился и текст.
+        void Add(Position pos, bool text_changed);
+        void Clear();
+
+    private:
+        friend class SheetVersion;
+        std::unordered_map<std::uint32_t, std::bitset<TILE_ROWS * TILE_COLS>> tiles_;
+    };
+
+    // Собирает версию из всех ячеек таблицы.
+    static std::shared_ptr<const SheetVersion> Build(const Sheet& sheet, std::uint64_t number);
+    // Собирает версию, которая отличается от previous только изменёнными
+    // ячейками; их содержимое берётся из таблицы.
+    static std::shared_ptr<const SheetVersion> Update(const SheetVersion& previous, const Sheet& sheet,
+                                                      const Changes& changes);
+
+    // Порядковый номер публикации.
+    std::uint64_t GetNumber() const;
+
+    // Значение и текст ячейки; для пустой позиции — пустая строка.
+    CellInterface::Value GetValue(Position pos) const;
+    CellInterface::ValueView GetValueView(Position pos) const;
+    std::string GetText(Position pos) const;
+
+    Size GetPrintableSize() const;
+    void PrintValues(std::ostream& output) const;
+    void PrintTexts(std::ostream& output) const;
+
+private:
+    // Текст ячейки лежит в общем буфере её блока; пустой текст означает пустую
+    // ячейку. Значение формулы — число или ошибка, записанная как в
+    // вычислениях формул (см. MakeErrorValue).
+    struct Entry {
+        std::uint32_t text_offset = 0;
+        std::uint32_t text_size = 0;
+        double formula_value = 0;
+        bool is_formula = false;
+    };
+    struct Tile {
+        std::array<Entry, TILE_ROWS * TILE_COLS> entries;
+        std::string texts;
+
+        std::string_view GetText(const Entry& entry) const;
+    };
+    using TileRow = std::vector<std::shared_ptr<const Tile>>;
+    using TileRowGroup = std::array<std::shared_ptr<const TileRow>, TILE_ROWS_PER_GROUP>;
+
+    static std::uint32_t GetTileIndex(Position pos);
+    static std::size_t GetEntryIndex(Position pos);
+    const Tile* FindTile(std::uint32_t tile_index) const;
+    static CellInterface::ValueView GetEntryValueView(const Tile& tile, const Entry& entry);
+    static std::shared_ptr<const Tile> BuildTile(const Sheet& sheet, std::uint32_t tile_index, const Tile* previous,
+                                                 const std::bitset<TILE_ROWS * TILE_COLS>& changed_texts);
+    template <typename PrintEntry>
+    void Print(std::ostream& output, PrintEntry&& print_entry) const;
+
+    std::uint64_t number_ = 0;
+    Size printable_size_;
+    std::vector<std::shared_ptr<const TileRowGroup>> groups_;
+};
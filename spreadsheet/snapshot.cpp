@@ -0,0 +1,437 @@
+#include "snapshot.h"
+
+#include "FormulaAST.h"
+#include "buffered_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Формат снимка. Все записи выровнены по восьми байтам, поэтому массивы чисел
+// и позиций читаются прямо из отображённого файла.
+//
+//   FileHeader
+//   cell_count раз: CellRecord и данные ячейки
+//     текст: size байт
+//     формула: numbers_size чисел, cells_size позиций, ranges_size
+//     диапазонов, size кодов операций
+//   edge_count раз: EdgeRecord, по возрастанию (from, to)
+//
+// Зависимости от диапазонов не записываются: при загрузке они берутся из
+// формул.
+namespace {
+
+constexpr char MAGIC[8] = { 'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P' };
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr std::size_t RECORD_ALIGNMENT = 8;
+
+enum class CellKind : std::uint8_t {
+    Empty,
+    Text,
+    Formula,
+};
+
+enum class ValueKind : std::uint8_t {
+    None,
+    Number,
+    Error,
+};
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t cell_count;
+    std::uint64_t edge_count;
+};
+
+struct CellRecord {
+    std::int32_t row;
+    std::int32_t col;
+    CellKind kind;
+    ValueKind value_kind;
+    std::uint8_t error_category;
+    std::uint8_t reserved;
+    // Длина текста или число инструкций формулы.
+    std::uint32_t size;
+    std::uint32_t numbers_size;
+    std::uint32_t cells_size;
+    std::uint32_t ranges_size;
+    std::uint32_t reserved2;
+    double value;
+};
+
+struct EdgeRecord {
+    std::int32_t from_row;
+    std::int32_t from_col;
+    std::int32_t to_row;
+    std::int32_t to_col;
+};
+
+static_assert(sizeof(FileHeader) % RECORD_ALIGNMENT == 0);
+static_assert(sizeof(CellRecord) % RECORD_ALIGNMENT == 0);
+static_assert(sizeof(EdgeRecord) % RECORD_ALIGNMENT == 0);
+static_assert(sizeof(Position) == 2 * sizeof(std::int32_t) && std::is_standard_layout_v<Position>);
+static_assert(sizeof(Range) == 2 * sizeof(Position) && std::is_standard_layout_v<Range>);
+static_assert(sizeof(ASTImpl::Program::OpCode) == 1);
+
+std::size_t AlignedSize(std::size_t size) {
+    return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(std::ostream& output) : writer_(output) {
+    }
+
+    template <typename T>
+    void WriteRecord(const T& record) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        WriteBytes(&record, sizeof(T));
+    }
+
+    void WriteBytes(const void* data, std::size_t size) {
+        writer_.Write({ static_cast<const char*>(data), size });
+        written_ += size;
+    }
+
+    void Align() {
+        while (written_ % RECORD_ALIGNMENT != 0) {
+            writer_.Put('\0');
+            ++written_;
+        }
+    }
+
+    void Flush() {
+        writer_.Flush();
+    }
+
+private:
+    BufferedWriter writer_;
+    std::size_t written_ = 0;
+};
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::string_view data) : data_(data) {
+    }
+
+    template <typename T>
+    T ReadRecord() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T record;
+        std::memcpy(&record, Take(sizeof(T)), sizeof(T));
+        return record;
+    }
+
+    // Возвращает следующие size байт и пропускает выравнивание после них.
+    const char* Take(std::size_t size) {
+        std::size_t aligned_size = AlignedSize(size);
+        if (aligned_size < size || aligned_size > data_.size() - offset_) {
+            throw SnapshotException("Snapshot is truncated");
+        }
+        const char* result = data_.data() + offset_;
+        offset_ += aligned_size;
+        return result;
+    }
+
+    bool AtEnd() const {
+        return offset_ == data_.size();
+    }
+
+private:
+    std::string_view data_;
+    std::size_t offset_ = 0;
+};
+
+Position ReadPosition(std::int32_t row, std::int32_t col) {
+    Position pos{ row, col };
+    if (!pos.IsValid()) {
+        throw SnapshotException("Snapshot contains an invalid position");
+    }
+    return pos;
+}
+
+}  // namespace
+
+void SheetSnapshot::Save(const Sheet& sheet, std::ostream& output) {
+    SnapshotWriter writer(output);
+
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.cell_count = sheet.cells_.Size();
+    header.edge_count = sheet.cells_dependencies_.GetEdgeCount();
+    writer.WriteRecord(header);
+
+    sheet.cells_.ForEach([&writer](Position pos, const Cell& cell) {
+        CellRecord record{};
+        record.row = pos.row;
+        record.col = pos.col;
+
+        if (const FormulaInterface* formula = cell.GetFormula()) {
+            const auto& program = formula->GetAST().GetProgram();
+            record.kind = CellKind::Formula;
+            record.size = program.code_size;
+            record.numbers_size = program.numbers_size;
+            record.cells_size = program.cells_size;
+            record.ranges_size = program.ranges_size;
+            if (auto value = cell.GetCachedValue()) {
+                if (auto* number = std::get_if<double>(&*value)) {
+                    record.value_kind = ValueKind::Number;
+                    record.value = *number;
+                }
+                else {
+                    record.value_kind = ValueKind::Error;
+                    record.error_category = static_cast<std::uint8_t>(std::get<FormulaError>(*value).GetCategory());
+                }
+            }
+            writer.WriteRecord(record);
+            writer.WriteBytes(program.numbers, program.numbers_size * sizeof(double));
+            writer.WriteBytes(program.cells, program.cells_size * sizeof(Position));
+            writer.WriteBytes(program.ranges, program.ranges_size * sizeof(Range));
+            for (std::uint32_t i = 0; i < program.code_size; ++i) {
+                auto code = program.code[i].code;
+                writer.WriteBytes(&code, sizeof(code));
+            }
+            writer.Align();
+            return;
+        }
+
+        std::string text = cell.GetText();
+        record.kind = text.empty() ? CellKind::Empty : CellKind::Text;
+        record.size = static_cast<std::uint32_t>(text.size());
+        writer.WriteRecord(record);
+        writer.WriteBytes(text.data(), text.size());
+        writer.Align();
+    });
+
+    // Списки зависимых упорядочены по идентификаторам, а в снимке рёбра идут
+    // по возрастанию позиций.
+    std::vector<Position> dependents;
+    sheet.cells_.ForEach([&](Position from, const Cell&) {
+        dependents.clear();
+        sheet.cells_dependencies_.ForEachDependent(sheet.cells_.FindId(from), [&](CellId dependent_id) {
+            dependents.push_back(sheet.cells_.GetPosition(dependent_id));
+        });
+        std::sort(dependents.begin(), dependents.end());
+        for (const auto& to : dependents) {
+            writer.WriteRecord(EdgeRecord{ from.row, from.col, to.row, to.col });
+        }
+    });
+    writer.Flush();
+    if (!output) {
+        throw SnapshotException("Failed to write snapshot");
+    }
+}
+
+void SheetSnapshot::SaveFile(const Sheet& sheet, const std::string& path) {
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw SnapshotException("Cannot open " + path + " for writing");
+    }
+    Save(sheet, output);
+    output.close();
+    if (!output) {
+        throw SnapshotException("Failed to write " + path);
+    }
+}
+
+std::unique_ptr<Sheet> SheetSnapshot::Load(std::string_view data) {
+    // Массивы формул читаются на месте, если данные выровнены; иначе они
+    // копируются в выровненный буфер.
+    std::vector<std::uint64_t> aligned_copy;
+    if (reinterpret_cast<std::uintptr_t>(data.data()) % RECORD_ALIGNMENT != 0) {
+        aligned_copy.resize(AlignedSize(data.size()) / sizeof(std::uint64_t));
+        std::memcpy(aligned_copy.data(), data.data(), data.size());
+        data = { reinterpret_cast<const char*>(aligned_copy.data()), data.size() };
+    }
+
+    SnapshotReader reader(data);
+    auto header = reader.ReadRecord<FileHeader>();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw SnapshotException("Not a sheet snapshot");
+    }
+    if (header.version != VERSION) {
+        throw SnapshotException("Unsupported snapshot version " + std::to_string(header.version));
+    }
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        throw SnapshotException("Snapshot was written with a different byte order");
+    }
+
+    auto sheet = std::make_unique<Sheet>();
+    // Ссылки формул на ячейки, из которых строится граф зависимостей, и
+    // признак того, что все ссылки ведут назад при построчном обходе: тогда
+    // циклов быть не может, как и в SetCells.
+    std::vector<std::pair<Position, CellId>> references;
+    bool refers_only_backward = true;
+    std::optional<Position> last_pos;
+    for (std::uint64_t i = 0; i < header.cell_count; ++i) {
+        auto record = reader.ReadRecord<CellRecord>();
+        Position pos = ReadPosition(record.row, record.col);
+        if (sheet->cells_.Find(pos)) {
+            throw SnapshotException("Snapshot contains cell " + pos.ToString() + " twice");
+        }
+        if (last_pos && pos < *last_pos) {
+            throw SnapshotException("Snapshot cells are not sorted");
+        }
+        last_pos = pos;
+        Cell& cell = sheet->cells_.EmplaceWithId(pos, *sheet);
+        CellId id = sheet->cells_.FindId(pos);
+
+        switch (record.kind) {
+        case CellKind::Empty:
+            break;
+        case CellKind::Text:
+            cell.Set(std::string(reader.Take(record.size), record.size), nullptr);
+            if (!cell.IsEmpty()) {
+                sheet->AddToPrintableArea(pos);
+            }
+            break;
+        case CellKind::Formula: {
+            if (record.numbers_size > record.size || record.cells_size > record.size
+                || record.ranges_size > record.size) {
+                throw SnapshotException("Snapshot contains an invalid formula at " + pos.ToString());
+            }
+            std::size_t cells_offset = record.numbers_size * sizeof(double);
+            std::size_t ranges_offset = cells_offset + record.cells_size * sizeof(Position);
+            std::size_t code_offset = ranges_offset + record.ranges_size * sizeof(Range);
+            const char* payload = reader.Take(code_offset + record.size);
+            try {
+                auto ast = BuildFormulaAST(
+                    reinterpret_cast<const ASTImpl::Program::OpCode*>(payload + code_offset), record.size,
+                    reinterpret_cast<const double*>(payload), record.numbers_size,
+                    reinterpret_cast<const Position*>(payload + cells_offset), record.cells_size,
+                    reinterpret_cast<const Range*>(payload + ranges_offset), record.ranges_size);
+                cell.Set(std::string(), MakeFormula(std::move(ast)));
+            }
+            catch (const ParsingError& ex) {
+                throw SnapshotException("Snapshot contains an invalid formula at " + pos.ToString() + ": " + ex.what());
+            }
+            sheet->AddToPrintableArea(pos);
+            sheet->AddRangeDependencies(id, cell.GetReferencedRanges());
+            const FormulaAST& ast = cell.GetFormula()->GetAST();
+            for (const Position& ref_cell : ast.GetCells()) {
+                references.emplace_back(ref_cell, id);
+                refers_only_backward = refers_only_backward && ref_cell < pos;
+            }
+            for (const Range& range : ast.GetRanges()) {
+                refers_only_backward = refers_only_backward && range.to < pos;
+            }
+
+            if (record.value_kind == ValueKind::Number) {
+                cell.SetCachedValue(record.value);
+            }
+            else if (record.value_kind == ValueKind::Error
+                     && record.error_category <= static_cast<std::uint8_t>(FormulaError::Category::Arithmetic)) {
+                cell.SetCachedValue(FormulaError(static_cast<FormulaError::Category>(record.error_category)));
+            }
+            else {
+                sheet->dirty_cells_.Insert(id);
+            }
+            break;
+        }
+        default:
+            throw SnapshotException("Snapshot contains an unknown cell kind at " + pos.ToString());
+        }
+    }
+
+    // Граф строится по ссылкам формул, а сохранённые рёбра лишь сверяются с
+    // ним: пропущенное ребро оставило бы зависимые формулы с устаревшими
+    // значениями. Ячейки созданы по возрастанию позиций, поэтому порядок
+    // рёбер графа по идентификаторам совпадает с их порядком в снимке.
+    for (const auto& [ref_cell, id] : references) {
+        CellId ref_id = sheet->cells_.FindId(ref_cell);
+        if (ref_id == Sheet::NO_CELL_ID) {
+            throw SnapshotException("Snapshot formula refers to missing cell " + ref_cell.ToString());
+        }
+        sheet->cells_dependencies_.AddEdge(ref_id, id);
+    }
+    if (header.edge_count != sheet->cells_dependencies_.GetEdgeCount()) {
+        throw SnapshotException("Snapshot dependency edges do not match formula references");
+    }
+    sheet->cells_dependencies_.ForEachEdge([&](CellId from_id, CellId to_id) {
+        auto record = reader.ReadRecord<EdgeRecord>();
+        if (!(ReadPosition(record.from_row, record.from_col) == sheet->cells_.GetPosition(from_id))
+            || !(ReadPosition(record.to_row, record.to_col) == sheet->cells_.GetPosition(to_id))) {
+            throw SnapshotException("Snapshot dependency edges do not match formula references");
+        }
+    });
+
+    if (!reader.AtEnd()) {
+        throw SnapshotException("Snapshot has trailing data");
+    }
+
+    // Цикл, который SetCell бы отверг, оставил бы свои ячейки вне порядка
+    // пересчёта, а их чтение ушло бы в бесконечную рекурсию.
+    if (!refers_only_backward) {
+        TiledGrid<const FormulaInterface*> formulas;
+        sheet->cells_.ForEach([&formulas](Position pos, const Cell& cell) {
+            if (const FormulaInterface* formula = cell.GetFormula()) {
+                formulas.Emplace(pos, formula);
+            }
+        });
+        if (!sheet->FindCyclicCells(formulas).empty()) {
+            throw SnapshotException("Snapshot contains circular references");
+        }
+    }
+    return sheet;
+}
+
+#ifdef _WIN32
+std::unique_ptr<Sheet> SheetSnapshot::LoadFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw SnapshotException("Cannot open " + path);
+    }
+    std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    return Load(data);
+}
+#else
+std::unique_ptr<Sheet> SheetSnapshot::LoadFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw SnapshotException("Cannot open " + path);
+    }
+    struct stat file_stat {};
+    if (::fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        throw SnapshotException("Cannot stat " + path);
+    }
+    std::size_t size = static_cast<std::size_t>(file_stat.st_size);
+    if (size == 0) {
+        ::close(fd);
+        throw SnapshotException("Snapshot is truncated");
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw SnapshotException("Cannot map " + path);
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    struct Unmap {
+        void* mapping;
+        std::size_t size;
+        ~Unmap() {
+            ::munmap(mapping, size);
+        }
+    } unmap{ mapping, size };
+    return Load({ static_cast<const char*>(mapping), size });
+}
+#endif
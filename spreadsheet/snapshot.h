@@ -0,0 +1,38 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Исключение, выбрасываемое, если снимок не удалось записать или прочитать:
+// файл недоступен, повреждён или записан другой версией формата.
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Двоичный снимок таблицы: тексты ячеек, байт-код формул, вычисленные
+// значения и рёбра графа зависимостей. При загрузке формулы восстанавливаются
+// по байт-коду без разбора текста, а сохранённые значения сразу попадают в кэш
+// и не пересчитываются. Рёбра графа должны в точности совпадать со ссылками
+// формул, а ссылки — не образовывать циклов; иначе снимок отвергается. Числа
+// записываются в порядке байтов машины, на которой создан снимок; снимок с
+// другим порядком байтов отвергается.
+class SheetSnapshot {
+public:
+    static constexpr std::uint32_t VERSION = 2;
+
+    static void Save(const Sheet& sheet, std::ostream& output);
+    static void SaveFile(const Sheet& sheet, const std::string& path);
+
+    // Загружает таблицу из снимка, целиком находящегося в памяти.
+    static std::unique_ptr<Sheet> Load(std::string_view data);
+    // Отображает файл в память и загружает из него таблицу. Отображение
+    // закрывается сразу после загрузки: таблица не ссылается на файл.
+    static std::unique_ptr<Sheet> LoadFile(const std::string& path);
+};
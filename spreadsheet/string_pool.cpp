@@ -0,0 +1,44 @@
+#include "string_pool.h"
+
+StringPool::Id StringPool::Intern(std::string_view text) {
+    if (auto it = index_.find(text); it != index_.end()) {
+        ++entries_[it->second].references;
+        return it->second;
+    }
+
+    Id id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+        entries_[id].text.assign(text);
+    }
+    else {
+        id = static_cast<Id>(entries_.size());
+        entries_.push_back({ std::string(text) });
+    }
+    entries_[id].references = 1;
+    index_.emplace(entries_[id].text, id);
+    return id;
+}
+
+void StringPool::Release(Id id) {
+    Entry& entry = entries_[id];
+    if (--entry.references > 0) {
+        return;
+    }
+    index_.erase(entry.text);
+    std::string().swap(entry.text);
+    free_ids_.push_back(id);
+}
+
+std::size_t StringPool::GetMemoryUsage() const {
+    std::size_t usage = entries_.size() * sizeof(Entry) + free_ids_.capacity() * sizeof(Id)
+        + index_.bucket_count() * sizeof(void*)
+        + index_.size() * (sizeof(std::pair<const std::string_view, Id>) + 2 * sizeof(void*));
+    for (const Entry& entry : entries_) {
+        if (entry.text.capacity() > std::string().capacity()) {
+            usage += entry.text.capacity() + 1;
+        }
+    }
+    return usage;
+}
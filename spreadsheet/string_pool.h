@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Общий для листа набор строк с подсчётом ссылок. Одинаковые строки хранятся
+// один раз под одним идентификатором, который не меняется, пока на строку
+// есть ссылки; идентификатор освобождённой строки достаётся следующей новой.
+// Строки не перемещаются, поэтому полученные string_view действительны до
+// освобождения строки.
+class StringPool {
+public:
+    using Id = std::uint32_t;
+
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // Возвращает идентификатор строки и добавляет на неё ссылку.
+    Id Intern(std::string_view text);
+    // Снимает ссылку; строка без ссылок удаляется.
+    void Release(Id id);
+
+    std::string_view Get(Id id) const {
+        return entries_[id].text;
+    }
+
+    // Число различных строк.
+    std::size_t Size() const {
+        return index_.size();
+    }
+
+    // Объём памяти, занимаемой строками и индексом, в байтах.
+    std::size_t GetMemoryUsage() const;
+
+private:
+    struct Entry {
+        std::string text;
+        std::uint32_t references = 0;
+    };
+
+    // Элементы std::deque не перемещаются при добавлении в конец, поэтому
+    // короткие строки, хранящиеся внутри std::string, тоже остаются на месте.
+    std::deque<Entry> entries_;
+    std::vector<Id> free_ids_;
+    std::unordered_map<std::string_view, Id> index_;
+};
@@ -1,8 +1,13 @@
 #include "common.h"
 
 #include <cctype>
-#include <sstream>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <charconv>
+#include <system_error>
 #include <algorithm>
+#include <tuple>
 
 const int LETTERS = 26;
 const int MAX_POSITION_LENGTH = 17;
@@ -58,9 +63,9 @@ Position Position::FromString(std::string_view str) {
         return Position::NONE;
     }
 
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
+    int row = 0;
+    auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), row);
+    if (error != std::errc() || end != digits.data() + digits.size()) {
         return Position::NONE;
     }
 
@@ -76,3 +81,94 @@ Position Position::FromString(std::string_view str) {
 bool Size::operator==(Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
 }
+
+bool Range::operator==(const Range& rhs) const {
+    return from == rhs.from && to == rhs.to;
+}
+
+bool Range::operator<(const Range& rhs) const {
+    return std::tie(from, to) < std::tie(rhs.from, rhs.to);
+}
+
+bool Range::IsValid() const {
+    return from.IsValid() && to.IsValid() && from.row <= to.row && from.col <= to.col;
+}
+
+bool Range::Contains(Position pos) const {
+    return pos.row >= from.row && pos.row <= to.row && pos.col >= from.col && pos.col <= to.col;
+}
+
+std::string Range::ToString() const {
+    if (!IsValid()) {
+        return "";
+    }
+    return from.ToString() + ":" + to.ToString();
+}
+
+Range Range::FromCorners(Position first, Position second) {
+    return { { std::min(first.row, second.row), std::min(first.col, second.col) },
+             { std::max(first.row, second.row), std::max(first.col, second.col) } };
+}
+
+NumericValue ParseNumericText(std::string_view text) {
+    using Kind = NumericValue::Kind;
+    if (text.empty()) {
+        return {};
+    }
+
+    // std::from_chars не пропускает пробелы и знак "+" и не разбирает
+    // шестнадцатеричную запись с префиксом 0x; такой текст, как и числа вне
+    // диапазона double, разбирается std::strtod.
+    double number = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        std::string copy(text);
+        char* copy_end = nullptr;
+        errno = 0;
+        number = std::strtod(copy.c_str(), &copy_end);
+        if (copy_end != copy.c_str() + copy.size() || errno == ERANGE) {
+            return { Kind::Text, FormulaError::Category::Value };
+        }
+    }
+    if (!std::isfinite(number)) {
+        return { Kind::Text, FormulaError::Category::Arithmetic };
+    }
+    return { Kind::Number, FormulaError::Category::Value, number };
+}
+
+NumericValue CellInterface::GetNumericValue() const {
+    auto value = GetValue();
+    if (const auto* number = std::get_if<double>(&value)) {
+        return { NumericValue::Kind::Number, FormulaError::Category::Value, *number };
+    }
+    if (const auto* error = std::get_if<FormulaError>(&value)) {
+        return { NumericValue::Kind::Error, error->GetCategory() };
+    }
+    return ParseNumericText(std::get<std::string>(value));
+}
+
+CellInterface::ValueView CellInterface::GetValueView() const {
+    thread_local std::string text;
+    auto value = GetValue();
+    if (const auto* number = std::get_if<double>(&value)) {
+        return *number;
+    }
+    if (const auto* error = std::get_if<FormulaError>(&value)) {
+        return *error;
+    }
+    text = std::move(std::get<std::string>(value));
+    return std::string_view(text);
+}
+
+void SheetInterface::ForEachCellInRange(const Range& range,
+                                        const std::function<bool(Position, const CellInterface&)>& func) const {
+    for (int row = range.from.row; row <= range.to.row; ++row) {
+        for (int col = range.from.col; col <= range.to.col; ++col) {
+            Position pos{ row, col };
+            const CellInterface* cell = GetCell(pos);
+            if (cell && !func(pos, *cell)) {
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+    // Пул и номер потока пула, в котором выполняется текущая задача.
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local std::size_t current_index = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    workers_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    threads_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this, i] { Run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+std::size_t ThreadPool::GetThreadCount() const {
+    return threads_.size();
+}
+
+void ThreadPool::Submit(Task task) {
+    std::size_t index = current_pool == this
+        ? current_index
+        : next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    // Счётчики увеличиваются под мьютексом очереди после вставки: задачу
+    // нельзя забрать раньше, чем они учтут её, а если вставка выбросит
+    // исключение, они останутся прежними.
+    {
+        Worker& worker = *workers_[index];
+        std::lock_guard lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        unfinished_.fetch_add(1);
+        queued_.fetch_add(1);
+    }
+
+    // Захват мьютекса перед оповещением исключает потерю сигнала потоком,
+    // который уже проверил условие, но ещё не уснул.
+    {
+        std::lock_guard lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock lock(sleep_mutex_);
+    done_.wait(lock, [this] { return unfinished_.load() == 0; });
+}
+
+bool ThreadPool::TryPop(std::size_t index, Task& task) {
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    for (std::size_t offset = 1; offset < workers_.size(); ++offset) {
+        Worker& victim = *workers_[(index + offset) % workers_.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Run(std::size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    Task task;
+    while (true) {
+        if (TryPop(index, task)) {
+            task();
+            task = nullptr;
+            if (unfinished_.fetch_sub(1) == 1) {
+                {
+                    std::lock_guard lock(sleep_mutex_);
+                }
+                done_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
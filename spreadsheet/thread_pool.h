@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с перехватом задач (work stealing). У каждого потока своя
+// очередь: задачи, поставленные изнутри пула, попадают в очередь текущего
+// потока и берутся из её конца, а простаивающие потоки забирают задачи из
+// начала чужих очередей.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(std::size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t GetThreadCount() const;
+
+    // Ставит задачу в очередь. Задачи не должны выбрасывать исключений:
+    // исключение в потоке пула завершает программу. Задачи, которые могут их
+    // выбросить, перехватывают их сами и передают ставившему их потоку.
+    void Submit(Task task);
+
+    // Блокирует вызывающий поток, пока не будут выполнены все поставленные
+    // задачи, в том числе поставленные самими задачами. Не вызывается из
+    // задач пула.
+    void Wait();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Run(std::size_t index);
+    bool TryPop(std::size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+
+    std::atomic<std::size_t> queued_ = 0;
+    std::atomic<std::size_t> unfinished_ = 0;
+    std::atomic<std::size_t> next_worker_ = 0;
+    bool stop_ = false;
+};
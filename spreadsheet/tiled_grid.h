@@ -0,0 +1,430 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Разреженная сетка значений, адресуемая позициями таблицы.
+//
+// Позиция отображается на номер слота через каталог блоков TILE_ROWS x
+// TILE_COLS, которые выделяются по мере заполнения. Полоса из TILE_ROWS строк
+// хранит группы по TILES_PER_GROUP блоков, а массив групп растёт только до
+// самой правой занятой группы, так что узкие и разреженные таблицы не платят
+// за всю ширину листа. Строка блока занимает одну кэш-линию, так что
+// построчный обход читает номера слотов подряд. Сами значения хранятся в пуле
+// кусками по CHUNK_SIZE и никогда не перемещаются: указатель на значение
+// действителен до его удаления, а при заполнении таблицы по строкам соседние
+// ячейки оказываются рядом и в пуле.
+//
+// Номер слота служит плотным идентификатором значения: идентификаторы меньше
+// GetIdBound(), поэтому сведения о значениях можно хранить в массивах,
+// индексируемых ими. Идентификатор удалённого значения достаётся следующему
+// созданному.
+template <typename T>
+class TiledGrid {
+public:
+    using Id = std::uint32_t;
+
+    static constexpr int TILE_ROWS = 4;
+    static constexpr int TILE_COLS = 16;
+    static constexpr Id NO_ID = UINT32_MAX;
+
+    TiledGrid() = default;
+    TiledGrid(const TiledGrid&) = delete;
+    TiledGrid& operator=(const TiledGrid&) = delete;
+
+    ~TiledGrid() {
+        Clear();
+    }
+
+    T* Find(Position pos) {
+        Slot slot = FindSlot(pos);
+        return slot != NO_SLOT ? SlotPtr(slot) : nullptr;
+    }
+
+    const T* Find(Position pos) const {
+        Slot slot = FindSlot(pos);
+        return slot != NO_SLOT ? SlotPtr(slot) : nullptr;
+    }
+
+    // Идентификатор значения в позиции или NO_ID, если позиция не занята.
+    Id FindId(Position pos) const {
+        return FindSlot(pos);
+    }
+
+    T& operator[](Id id) {
+        return *SlotPtr(id);
+    }
+
+    const T& operator[](Id id) const {
+        return *SlotPtr(id);
+    }
+
+    Position GetPosition(Id id) const {
+        return positions_[id];
+    }
+
+    // Граница идентификаторов: все они меньше неё.
+    Id GetIdBound() const {
+        return next_slot_;
+    }
+
+    // Создаёт значение в незанятой позиции.
+    template <typename... Args>
+    T& Emplace(Position pos, Args&&... args) {
+        return EmplaceSlot(pos, [&](T* value, Id) {
+            new (value) T(std::forward<Args>(args)...);
+        });
+    }
+
+    // То же, но последним аргументом конструктора передаётся идентификатор,
+    // который получит значение.
+    template <typename... Args>
+    T& EmplaceWithId(Position pos, Args&&... args) {
+        return EmplaceSlot(pos, [&](T* value, Id id) {
+            new (value) T(std::forward<Args>(args)..., id);
+        });
+    }
+
+    // Удаляет значение. Возвращает false, если позиция не занята.
+    bool Erase(Position pos) {
+        TileGroup* group = FindGroup(pos);
+        int tile_in_group = pos.col / TILE_COLS % TILES_PER_GROUP;
+        Tile* tile = group ? group->tiles[tile_in_group].get() : nullptr;
+        if (!tile || tile->slots[SlotIndex(pos)] == NO_SLOT) {
+            return false;
+        }
+
+        Slot& slot = tile->slots[SlotIndex(pos)];
+        SlotPtr(slot)->~T();
+        free_slots_.push_back(slot);
+        slot = NO_SLOT;
+        tile->row_masks[pos.row % TILE_ROWS] &= std::uint16_t(~(1u << (pos.col % TILE_COLS)));
+        --size_;
+
+        if (--tile->count == 0) {
+            ReleaseTile(pos);
+        }
+        return true;
+    }
+
+    void Clear() {
+        ForEach([](Position, T& value) { value.~T(); });
+        tile_rows_.clear();
+        chunks_.clear();
+        positions_.clear();
+        free_slots_.clear();
+        next_slot_ = 0;
+        size_ = 0;
+    }
+
+    std::size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Память каталога блоков и пула значений в байтах, без памяти, которую
+    // выделяют сами значения.
+    std::size_t GetMemoryUsage() const {
+        std::size_t usage = tile_rows_.capacity() * sizeof(TileRow) + chunks_.capacity() * sizeof(chunks_[0])
+                            + chunks_.size() * sizeof(Chunk) + positions_.capacity() * sizeof(Position)
+                            + free_slots_.capacity() * sizeof(Slot);
+        for (const auto& tile_row : tile_rows_) {
+            usage += tile_row.groups.capacity() * sizeof(tile_row.groups[0]);
+            for (const auto& group : tile_row.groups) {
+                if (group) {
+                    usage += sizeof(TileGroup)
+                             + static_cast<std::size_t>(std::bitset<TILES_PER_GROUP>(group->tile_mask).count()) * sizeof(Tile);
+                }
+            }
+        }
+        return usage;
+    }
+
+    // Вызывает func(Position, T&) для всех занятых позиций в порядке строк.
+    template <typename Func>
+    void ForEach(Func&& func) {
+        ForEachSlot([this, &func](Position pos, Slot slot) {
+            func(pos, *SlotPtr(slot));
+            return true;
+        });
+    }
+
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        ForEachSlot([this, &func](Position pos, Slot slot) {
+            func(pos, static_cast<const T&>(*SlotPtr(slot)));
+            return true;
+        });
+    }
+
+    // Обходит значения диапазона в том же порядке, что и ForEach.
+    template <typename Func>
+    void ForEachInRange(const Range& range, Func&& func) {
+        ForEachSlot(range.from, range.to, [this, &func](Position pos, Slot slot) {
+            func(pos, *SlotPtr(slot));
+            return true;
+        });
+    }
+
+    template <typename Func>
+    void ForEachInRange(const Range& range, Func&& func) const {
+        ForEachSlot(range.from, range.to, [this, &func](Position pos, Slot slot) {
+            func(pos, static_cast<const T&>(*SlotPtr(slot)));
+            return true;
+        });
+    }
+
+    // Обходит значения диапазона, пока func(Position, const T&) возвращает
+    // true. Возвращает false, если обход остановлен.
+    template <typename Func>
+    bool ForEachInRangeWhile(const Range& range, Func&& func) const {
+        return ForEachSlot(range.from, range.to, [this, &func](Position pos, Slot slot) {
+            return func(pos, static_cast<const T&>(*SlotPtr(slot)));
+        });
+    }
+
+private:
+    using Slot = Id;
+
+    static constexpr Slot NO_SLOT = NO_ID;
+    static constexpr int TILES_PER_GROUP = 16;
+    static constexpr std::size_t CHUNK_SIZE = 1024;
+
+    struct Tile {
+        Tile() {
+            slots.fill(NO_SLOT);
+        }
+
+        std::array<Slot, TILE_ROWS * TILE_COLS> slots;
+        std::array<std::uint16_t, TILE_ROWS> row_masks{};
+        int count = 0;
+    };
+
+    struct TileGroup {
+        std::array<std::unique_ptr<Tile>, TILES_PER_GROUP> tiles;
+        std::uint16_t tile_mask = 0;
+    };
+
+    // Группы полосы строк; массив доходит до самой правой занятой группы.
+    struct TileRow {
+        std::vector<std::unique_ptr<TileGroup>> groups;
+    };
+
+    struct Chunk {
+        alignas(T) unsigned char data[CHUNK_SIZE * sizeof(T)];
+    };
+
+    static int SlotIndex(Position pos) {
+        return (pos.row % TILE_ROWS) * TILE_COLS + pos.col % TILE_COLS;
+    }
+
+    static int CountTrailingZeros(std::uint64_t mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctzll(mask);
+#endif
+    }
+
+    T* SlotPtr(Slot slot) const {
+        unsigned char* data = chunks_[slot / CHUNK_SIZE]->data;
+        return std::launder(reinterpret_cast<T*>(data) + slot % CHUNK_SIZE);
+    }
+
+    TileGroup* FindGroup(Position pos) const {
+        std::size_t row_index = pos.row / TILE_ROWS;
+        if (row_index >= tile_rows_.size()) {
+            return nullptr;
+        }
+        const auto& groups = tile_rows_[row_index].groups;
+        std::size_t group_index = pos.col / TILE_COLS / TILES_PER_GROUP;
+        return group_index < groups.size() ? groups[group_index].get() : nullptr;
+    }
+
+    Slot FindSlot(Position pos) const {
+        const TileGroup* group = FindGroup(pos);
+        if (!group) {
+            return NO_SLOT;
+        }
+        const Tile* tile = group->tiles[pos.col / TILE_COLS % TILES_PER_GROUP].get();
+        return tile ? tile->slots[SlotIndex(pos)] : NO_SLOT;
+    }
+
+    Tile& GetOrCreateTile(Position pos) {
+        std::size_t row_index = pos.row / TILE_ROWS;
+        if (row_index >= tile_rows_.size()) {
+            tile_rows_.resize(row_index + 1);
+        }
+
+        auto& groups = tile_rows_[row_index].groups;
+        std::size_t group_index = pos.col / TILE_COLS / TILES_PER_GROUP;
+        if (group_index >= groups.size()) {
+            groups.resize(group_index + 1);
+        }
+        if (!groups[group_index]) {
+            groups[group_index] = std::make_unique<TileGroup>();
+        }
+
+        TileGroup& group = *groups[group_index];
+        int tile_in_group = pos.col / TILE_COLS % TILES_PER_GROUP;
+        if (!group.tiles[tile_in_group]) {
+            group.tiles[tile_in_group] = std::make_unique<Tile>();
+            group.tile_mask |= std::uint16_t(1u << tile_in_group);
+        }
+        return *group.tiles[tile_in_group];
+    }
+
+    // Выделяет слот в позиции pos и создаёт в нём значение вызовом
+    // construct(T*, Id).
+    template <typename Construct>
+    T& EmplaceSlot(Position pos, Construct&& construct) {
+        assert(FindSlot(pos) == NO_SLOT);
+
+        // Блок создаётся до значения: если выделить его не удастся, значение
+        // не будет создано и слот не потеряется. Если же не удастся создать
+        // значение, только что созданный пустой блок освобождается.
+        Tile& tile = GetOrCreateTile(pos);
+        Slot slot = NO_SLOT;
+        T* value = nullptr;
+        try {
+            slot = AllocateSlot();
+            value = SlotPtr(slot);
+            construct(value, slot);
+        }
+        catch (...) {
+            if (slot != NO_SLOT) {
+                free_slots_.push_back(slot);
+            }
+            if (tile.count == 0) {
+                ReleaseTile(pos);
+            }
+            throw;
+        }
+
+        tile.slots[SlotIndex(pos)] = slot;
+        positions_[slot] = pos;
+        tile.row_masks[pos.row % TILE_ROWS] |= std::uint16_t(1u << (pos.col % TILE_COLS));
+        ++tile.count;
+        ++size_;
+        return *value;
+    }
+
+    // Удаляет пустой блок позиции pos, а вместе с последним блоком группы и
+    // саму группу.
+    void ReleaseTile(Position pos) {
+        auto& group_ptr = tile_rows_[pos.row / TILE_ROWS].groups[pos.col / TILE_COLS / TILES_PER_GROUP];
+        int tile_in_group = pos.col / TILE_COLS % TILES_PER_GROUP;
+        assert(group_ptr->tiles[tile_in_group]->count == 0);
+        group_ptr->tiles[tile_in_group].reset();
+        group_ptr->tile_mask &= std::uint16_t(~(1u << tile_in_group));
+        if (group_ptr->tile_mask == 0) {
+            group_ptr.reset();
+        }
+    }
+
+    Slot AllocateSlot() {
+        if (!free_slots_.empty()) {
+            Slot slot = free_slots_.back();
+            free_slots_.pop_back();
+            return slot;
+        }
+        if (next_slot_ / CHUNK_SIZE == chunks_.size()) {
+            chunks_.push_back(std::unique_ptr<Chunk>(new Chunk));
+            positions_.resize(chunks_.size() * CHUNK_SIZE);
+        }
+        return next_slot_++;
+    }
+
+    // Биты с first по last включительно; границы вне [0, 63] обрезаются.
+    static std::uint64_t BitsBetween(int first, int last) {
+        first = std::max(first, 0);
+        last = std::min(last, 63);
+        if (first > last) {
+            return 0;
+        }
+        return (~std::uint64_t(0) >> (63 - last)) & (~std::uint64_t(0) << first);
+    }
+
+    // Обходит занятые слоты прямоугольника from..to по строкам, пока
+    // func(Position, Slot) возвращает true; возвращает false, если обход
+    // остановлен. Пустые группы и блоки пропускаются по маскам, не перебирая
+    // позиции.
+    template <typename Func>
+    bool ForEachSlot(Position from, Position to, Func&& func) const {
+        if (tile_rows_.empty() || from.row > to.row || from.col > to.col) {
+            return true;
+        }
+        std::size_t last_tile_row = std::min<std::size_t>(to.row / TILE_ROWS, tile_rows_.size() - 1);
+        int first_tile_col = from.col / TILE_COLS;
+        int last_tile_col = to.col / TILE_COLS;
+        for (std::size_t tile_row_index = from.row / TILE_ROWS; tile_row_index <= last_tile_row; ++tile_row_index) {
+            const auto& groups = tile_rows_[tile_row_index].groups;
+            if (groups.empty()) {
+                continue;
+            }
+            int last_group = std::min<int>(last_tile_col / TILES_PER_GROUP, static_cast<int>(groups.size()) - 1);
+            int tile_first_row = static_cast<int>(tile_row_index) * TILE_ROWS;
+            int first_row = std::max(from.row, tile_first_row);
+            int last_row = std::min(to.row, tile_first_row + TILE_ROWS - 1);
+            for (int row = first_row; row <= last_row; ++row) {
+                int row_in_tile = row - tile_first_row;
+                for (int group_index = first_tile_col / TILES_PER_GROUP; group_index <= last_group; ++group_index) {
+                    const TileGroup* group = groups[group_index].get();
+                    if (!group) {
+                        continue;
+                    }
+                    int group_first_tile = group_index * TILES_PER_GROUP;
+                    std::uint64_t tiles = group->tile_mask
+                        & BitsBetween(first_tile_col - group_first_tile, last_tile_col - group_first_tile);
+                    for (; tiles; tiles &= tiles - 1) {
+                        int tile_in_group = CountTrailingZeros(tiles);
+                        int tile_col = group_first_tile + tile_in_group;
+                        const Tile& tile = *group->tiles[tile_in_group];
+                        int tile_first_col = tile_col * TILE_COLS;
+                        std::uint64_t cols = tile.row_masks[row_in_tile]
+                            & BitsBetween(from.col - tile_first_col, to.col - tile_first_col);
+                        for (; cols; cols &= cols - 1) {
+                            int col_in_tile = CountTrailingZeros(cols);
+                            if (!func(Position{ row, tile_first_col + col_in_tile },
+                                      tile.slots[row_in_tile * TILE_COLS + col_in_tile])) {
+                                return false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    template <typename Func>
+    bool ForEachSlot(Func&& func) const {
+        return ForEachSlot(Position{ 0, 0 }, Position{ Position::MAX_ROWS - 1, Position::MAX_COLS - 1 },
+                    std::forward<Func>(func));
+    }
+
+    std::vector<TileRow> tile_rows_;
+    std::vector<std::unique_ptr<Chunk>> chunks_;
+    std::vector<Position> positions_;
+    std::vector<Slot> free_slots_;
+    Slot next_slot_ = 0;
+    std::size_t size_ = 0;
+};